@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include "can.h"
+
+#define CAN_CMSG_LEN 128
+// slots only a close can take, so closing never waits for the writer
+#define CAN_CAPTURE_CLOSE_SLOTS 8
+
+static uint64_t tsToNs(const struct timespec* ts){
+    return (uint64_t)ts->tv_sec*1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+// Opens a raw CAN socket on ifName accepting only the given ID/mask pairs, so
+// frames from other nodes are dropped in the kernel. Every frame is stamped by
+// the kernel in CLOCK_REALTIME, the time base of the event stamps; the raw
+// hardware stamps of the controller are in the controller's own clock and
+// are not used.
+int canOpen(const char* ifName, const struct can_filter* filters, unsigned int nFilters){
+    struct ifreq ifr;
+    struct sockaddr_can canAddr;
+    int canSocket = 0;
+    int err = -1;
+    int tsFlags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    int on = 1;
+
+    canSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if(canSocket < 0){
+        fprintf(stderr,"\tERR: Cannot initialize CAN socket...\n");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifName, IFNAMSIZ-1);
+    err = ioctl(canSocket, SIOCGIFINDEX, &ifr);
+    if(err < 0){
+        fprintf(stderr,"\tERR: Cannot find CAN interface %s...\n", ifName);
+        close(canSocket);
+        return -1;
+    }
+
+    memset(&canAddr, 0, sizeof(canAddr));
+    canAddr.can_family = AF_CAN;
+    canAddr.can_ifindex = ifr.ifr_ifindex;
+
+    err = bind(canSocket, (struct sockaddr *)&canAddr, sizeof(canAddr));
+    if(err < 0){
+        fprintf(stderr,"\tERR: Cannot bind CAN socket...\n");
+        close(canSocket);
+        return -1;
+    }
+
+    if(nFilters > 0){
+        err = setsockopt(canSocket, SOL_CAN_RAW, CAN_RAW_FILTER, filters, nFilters*sizeof(struct can_filter));
+        if(err < 0)
+            fprintf(stderr,"\tERR: Cannot set CAN filters...\n");
+    }
+
+    err = setsockopt(canSocket, SOL_SOCKET, SO_TIMESTAMPING, &tsFlags, sizeof(tsFlags));
+    if(err < 0){
+        err = setsockopt(canSocket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        if(err < 0)
+            fprintf(stderr,"\tERR: Cannot enable CAN timestamps...\n");
+    }
+
+    return canSocket;
+}
+
+// Blocks until at least one frame is available, then returns every queued
+// frame up to maxFrames with a single syscall. rxTime is CLOCK_REALTIME in ns.
+int canRecvBatch(int canSocket, canRxFrame_t* frames, unsigned int maxFrames){
+    struct mmsghdr msgs[CAN_BATCH_LEN];
+    struct iovec iovs[CAN_BATCH_LEN];
+    char cmsgBuf[CAN_BATCH_LEN][CAN_CMSG_LEN];
+    struct cmsghdr* cmsg;
+    struct scm_timestamping* stamps;
+    struct timespec now;
+    int nFrames = 0;
+
+    if(maxFrames > CAN_BATCH_LEN)
+        maxFrames = CAN_BATCH_LEN;
+
+    memset(msgs, 0, maxFrames*sizeof(struct mmsghdr));
+
+    for(unsigned int i = 0; i < maxFrames; i++){
+        iovs[i].iov_base = &frames[i].frame;
+        iovs[i].iov_len  = sizeof(struct can_frame);
+
+        msgs[i].msg_hdr.msg_iov        = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen     = 1;
+        msgs[i].msg_hdr.msg_control    = cmsgBuf[i];
+        msgs[i].msg_hdr.msg_controllen = CAN_CMSG_LEN;
+    }
+
+    nFrames = recvmmsg(canSocket, msgs, maxFrames, MSG_WAITFORONE, NULL);
+    if(nFrames <= 0)
+        return nFrames;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    for(int i = 0; i < nFrames; i++){
+        frames[i].rxTime = 0;
+
+        for(cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)){
+            if(cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if(cmsg->cmsg_type == SCM_TIMESTAMPING){
+                stamps = (struct scm_timestamping*)CMSG_DATA(cmsg);
+                frames[i].rxTime = tsToNs(&stamps->ts[0]);
+            }else if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                frames[i].rxTime = tsToNs((struct timespec*)CMSG_DATA(cmsg));
+        }
+
+        if(frames[i].rxTime == 0)
+            frames[i].rxTime = tsToNs(&now);
+    }
+
+    return nFrames;
+}
+
+static int captureRequest = 0;
+
+static int socketRecv(canSource_t* src, canRxFrame_t* frames, unsigned int maxFrames){
+    return canRecvBatch(src->fd, frames, maxFrames);
+}
+
+static void recordToFrame(const canCaptureRecord_t* rec, canRxFrame_t* rxFrame){
+    memset(rxFrame, 0, sizeof(canRxFrame_t));
+    rxFrame->frame.can_id  = rec->canId;
+    rxFrame->frame.can_dlc = rec->dlc;
+    memcpy(rxFrame->frame.data, rec->data, CAN_MAX_DLEN);
+    rxFrame->rxTime = rec->rxTime;
+}
+
+static uint64_t monotonicNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return tsToNs(&now);
+}
+
+// Waits until the capture time of rxTime is reached relative to the first
+// frame replayed.
+static void pace(canSource_t* src, uint64_t rxTime){
+    struct timespec deadline;
+    uint64_t wakeup;
+
+    if(src->firstWallTime == 0){
+        src->firstRxTime   = rxTime;
+        src->firstWallTime = monotonicNs();
+        return;
+    }
+
+    if(rxTime <= src->firstRxTime)
+        return;
+
+    wakeup = src->firstWallTime + (rxTime - src->firstRxTime);
+    deadline.tv_sec  = wakeup / 1000000000ULL;
+    deadline.tv_nsec = wakeup % 1000000000ULL;
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
+
+static int fileRecv(canSource_t* src, canRxFrame_t* frames, unsigned int maxFrames){
+    canCaptureRecord_t recs[CAN_BATCH_LEN];
+    size_t nRecs;
+
+    if(maxFrames > CAN_BATCH_LEN)
+        maxFrames = CAN_BATCH_LEN;
+
+    // with original timing frames are handed out one by one, each at its time
+    if(src->realTime)
+        maxFrames = 1;
+
+    nRecs = fread(recs, sizeof(canCaptureRecord_t), maxFrames, src->file);
+
+    for(size_t i = 0; i < nRecs; i++)
+        recordToFrame(&recs[i], &frames[i]);
+
+    if(src->realTime && nRecs > 0)
+        pace(src, frames[0].rxTime);
+
+    return (int)nRecs;
+}
+
+static int pipeRecv(canSource_t* src, canRxFrame_t* frames, unsigned int maxFrames){
+    canCaptureRecord_t rec;
+
+    if(maxFrames == 0 || fread(&rec, sizeof(rec), 1, src->file) != 1)
+        return 0;
+
+    recordToFrame(&rec, &frames[0]);
+
+    if(src->realTime)
+        pace(src, frames[0].rxTime);
+
+    return 1;
+}
+
+static int readHeader(canSource_t* src){
+    canCaptureHeader_t hdr;
+
+    if(fread(&hdr, sizeof(hdr), 1, src->file) != 1 || hdr.magic != CAN_CAPTURE_MAGIC){
+        fprintf(stderr,"\tERR: Not a CAN capture...\n");
+        return -1;
+    }
+
+    if(hdr.version != CAN_CAPTURE_VERSION || hdr.recordSize != sizeof(canCaptureRecord_t)){
+        fprintf(stderr,"\tERR: Unsupported CAN capture version %u...\n", hdr.version);
+        return -1;
+    }
+
+    return 0;
+}
+
+void canSourceSocket(canSource_t* src, int canSocket){
+    memset(src, 0, sizeof(canSource_t));
+    src->recv = socketRecv;
+    src->fd   = canSocket;
+}
+
+int canSourceFile(canSource_t* src, const char* path, uint8_t realTime){
+    memset(src, 0, sizeof(canSource_t));
+    src->recv     = fileRecv;
+    src->fd       = -1;
+    src->realTime = realTime;
+
+    src->file = fopen(path, "rb");
+    if(src->file == NULL){
+        fprintf(stderr,"\tERR: Cannot open CAN capture %s...\n", path);
+        return -1;
+    }
+
+    if(readHeader(src) < 0){
+        canSourceClose(src);
+        return -1;
+    }
+
+    return 0;
+}
+
+// A pipe carries the capture format too, but frames are handed out as soon as
+// they arrive (or at their time, with realTime) instead of waiting for a full
+// batch.
+int canSourcePipe(canSource_t* src, int fd, uint8_t realTime){
+    memset(src, 0, sizeof(canSource_t));
+    src->recv     = pipeRecv;
+    src->fd       = fd;
+    src->realTime = realTime;
+
+    src->file = fdopen(fd, "rb");
+    if(src->file == NULL){
+        fprintf(stderr,"\tERR: Cannot open CAN pipe...\n");
+        return -1;
+    }
+
+    if(readHeader(src) < 0){
+        canSourceClose(src);
+        return -1;
+    }
+
+    return 0;
+}
+
+void canSourceClose(canSource_t* src){
+    if(src->file != NULL)
+        fclose(src->file);
+    else if(src->fd >= 0)
+        close(src->fd);
+
+    src->file = NULL;
+    src->fd   = -1;
+}
+
+FILE* canCaptureOpen(const char* path){
+    canCaptureHeader_t hdr;
+    struct timespec now;
+    FILE* capFile;
+
+    capFile = fopen(path, "wb");
+    if(capFile == NULL)
+        return NULL;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic      = CAN_CAPTURE_MAGIC;
+    hdr.version    = CAN_CAPTURE_VERSION;
+    hdr.recordSize = sizeof(canCaptureRecord_t);
+    hdr.startTime  = tsToNs(&now);
+
+    fwrite(&hdr, sizeof(hdr), 1, capFile);
+
+    return capFile;
+}
+
+// Captured frames are written by a worker thread, so that a slow card never
+// holds up canReaderThread: the reader only copies the records into the queue
+// and frames that find it full are dropped (and counted). A close is queued
+// behind the records of its file. Without the worker (offline tools) the
+// caller writes them itself.
+typedef struct canCaptureJob{
+    FILE*              file;
+    uint8_t            close;
+    canCaptureRecord_t rec;
+} canCaptureJob_t;
+
+static pthread_mutex_t capLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  capCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  capDone = PTHREAD_COND_INITIALIZER;
+static canCaptureJob_t capQueue[CAN_CAPTURE_QUEUE_LEN];
+// jobs capHead..capTail-1 are pending
+static uint32_t        capHead, capTail;
+static uint8_t         capRunning;
+static uint64_t        capDropped;
+
+static void frameToRecord(const canRxFrame_t* frame, canCaptureRecord_t* rec){
+    memset(rec, 0, sizeof(canCaptureRecord_t));
+    rec->rxTime  = frame->rxTime;
+    rec->canId   = frame->frame.can_id;
+    rec->dlc     = frame->frame.can_dlc;
+    memcpy(rec->data, frame->frame.data, CAN_MAX_DLEN);
+}
+
+static void* canCaptureThread(void* arg){
+    canCaptureRecord_t recs[CAN_BATCH_LEN];
+    canCaptureJob_t* job;
+    FILE* file;
+    unsigned int n;
+    uint8_t isClose;
+
+    for(;;){
+        pthread_mutex_lock(&capLock);
+        while(capHead == capTail)
+            pthread_cond_wait(&capCond, &capLock);
+
+        // a run of records of the same file, or a close
+        job   = &capQueue[capHead % CAN_CAPTURE_QUEUE_LEN];
+        file  = job->file;
+        isClose = job->close;
+        for(n = 0; !isClose && n < CAN_BATCH_LEN && capHead + n != capTail; n++){
+            job = &capQueue[(capHead + n) % CAN_CAPTURE_QUEUE_LEN];
+            if(job->close || job->file != file)
+                break;
+            recs[n] = job->rec;
+        }
+        pthread_mutex_unlock(&capLock);
+
+        if(isClose)
+            fclose(file);
+        else
+            fwrite(recs, sizeof(canCaptureRecord_t), n, file);
+
+        pthread_mutex_lock(&capLock);
+        capHead += isClose ? 1 : n;
+        pthread_cond_broadcast(&capDone);
+        pthread_mutex_unlock(&capLock);
+    }
+
+    return arg;
+}
+
+int canCaptureStart(pthread_t* id){
+    int err = pthread_create(id, NULL, &canCaptureThread, NULL);
+
+    if(err == 0){
+        pthread_detach(*id);
+        pthread_mutex_lock(&capLock);
+        capRunning = 1;
+        pthread_mutex_unlock(&capLock);
+    }
+
+    return err;
+}
+
+void canCaptureWrite(FILE* capFile, const canRxFrame_t* frames, unsigned int nFrames){
+    canCaptureRecord_t recs[CAN_BATCH_LEN];
+    canCaptureJob_t* job;
+
+    if(nFrames > CAN_BATCH_LEN)
+        nFrames = CAN_BATCH_LEN;
+
+    pthread_mutex_lock(&capLock);
+
+    if(capRunning){
+        for(unsigned int i = 0; i < nFrames; i++){
+            if(capTail - capHead >= CAN_CAPTURE_QUEUE_LEN - CAN_CAPTURE_CLOSE_SLOTS){
+                capDropped += nFrames - i;
+                break;
+            }
+            job = &capQueue[capTail % CAN_CAPTURE_QUEUE_LEN];
+            job->file  = capFile;
+            job->close = 0;
+            frameToRecord(&frames[i], &job->rec);
+            capTail++;
+        }
+        pthread_cond_signal(&capCond);
+        pthread_mutex_unlock(&capLock);
+        return;
+    }
+
+    pthread_mutex_unlock(&capLock);
+
+    for(unsigned int i = 0; i < nFrames; i++)
+        frameToRecord(&frames[i], &recs[i]);
+
+    fwrite(recs, sizeof(canCaptureRecord_t), nFrames, capFile);
+}
+
+void canCaptureClose(FILE* capFile){
+    canCaptureJob_t* job;
+
+    if(capFile == NULL)
+        return;
+
+    pthread_mutex_lock(&capLock);
+
+    // only with more closes than CAN_CAPTURE_CLOSE_SLOTS pending
+    while(capRunning && capTail - capHead == CAN_CAPTURE_QUEUE_LEN)
+        pthread_cond_wait(&capDone, &capLock);
+
+    if(capRunning){
+        job = &capQueue[capTail % CAN_CAPTURE_QUEUE_LEN];
+        job->file  = capFile;
+        job->close = 1;
+        capTail++;
+        pthread_cond_signal(&capCond);
+        pthread_mutex_unlock(&capLock);
+        return;
+    }
+
+    pthread_mutex_unlock(&capLock);
+
+    fclose(capFile);
+}
+
+// Frames that found the capture queue full since the start.
+uint64_t canCaptureDropped(void){
+    uint64_t n;
+
+    pthread_mutex_lock(&capLock);
+    n = capDropped;
+    pthread_mutex_unlock(&capLock);
+
+    return n;
+}
+
+void canCaptureEnable(int enable){
+    __atomic_store_n(&captureRequest, enable, __ATOMIC_RELAXED);
+}
+
+int canCaptureEnabled(void){
+    return __atomic_load_n(&captureRequest, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,73 @@
+#ifndef CAN_H_
+#define CAN_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#define CAN_BATCH_LEN 32
+
+#define CAN_CAPTURE_MAGIC   0x43504143
+#define CAN_CAPTURE_VERSION 1
+#define CAN_CAPTURE_QUEUE_LEN 1024
+
+typedef struct canRxFrame{
+    struct can_frame frame;
+    uint64_t         rxTime;
+} canRxFrame_t;
+
+// Capture files are a canCaptureHeader_t followed by one canCaptureRecord_t per
+// frame, little endian, in reception order.
+typedef struct canCaptureHeader{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint64_t startTime;
+} canCaptureHeader_t;
+
+typedef struct canCaptureRecord{
+    uint64_t rxTime;
+    uint32_t canId;
+    uint8_t  dlc;
+    uint8_t  reserved[3];
+    uint8_t  data[CAN_MAX_DLEN];
+} canCaptureRecord_t;
+
+struct canSource;
+typedef int (*canRecvFunc_t)(struct canSource* src, canRxFrame_t* frames, unsigned int maxFrames);
+
+// Where canReaderThread and the offline tools get their frames from: a
+// SocketCAN socket, a capture file (replayed with its original timing or as
+// fast as possible) or a capture streamed through a pipe.
+typedef struct canSource{
+    canRecvFunc_t recv;
+    int           fd;
+    FILE*         file;
+    uint8_t       realTime;
+    uint64_t      firstRxTime;
+    uint64_t      firstWallTime;
+} canSource_t;
+
+int canOpen(const char* ifName, const struct can_filter* filters, unsigned int nFilters);
+int canRecvBatch(int canSocket, canRxFrame_t* frames, unsigned int maxFrames);
+
+void canSourceSocket(canSource_t* src, int canSocket);
+int canSourceFile(canSource_t* src, const char* path, uint8_t realTime);
+int canSourcePipe(canSource_t* src, int fd, uint8_t realTime);
+void canSourceClose(canSource_t* src);
+
+int canCaptureStart(pthread_t* id);
+FILE* canCaptureOpen(const char* path);
+void canCaptureWrite(FILE* capFile, const canRxFrame_t* frames, unsigned int nFrames);
+void canCaptureClose(FILE* capFile);
+uint64_t canCaptureDropped(void);
+void canCaptureEnable(int enable);
+int canCaptureEnabled(void);
+
+static inline int canSourceRecv(canSource_t* src, canRxFrame_t* frames, unsigned int maxFrames){
+    return src->recv(src, frames, maxFrames);
+}
+
+#endif
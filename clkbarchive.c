@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include "eventfile.h"
+#include "crc32.h"
+
+// Consolidates the closed event files of a directory (clkb_event_*.dat and
+// their .att sidecars, without the .lock suffix) into one archive per day:
+//
+//   clkbarchive [-o outdir] [-n] [-k] [dir]
+//     -o  where archives are written, default dir (default /srv/ftp)
+//     -n  only list what would be archived
+//     -k  keep the source files
+//
+// Archives are named clkb_archive_YYYYMMDD-NNNN.arc with the first free NNNN,
+// so running again (e.g. from cron) adds new archives and never rewrites old
+// ones. Members are copied in the kernel (copy_file_range, then sendfile,
+// then read/write as fallbacks) after their records have been checked on a
+// read-only mapping of the source; damaged records are counted in the table
+// of contents but still archived, the copy is byte for byte.
+//
+// An archive is written as .arc.lock, fsynced, renamed and the directory
+// fsynced before any of its sources is removed. Sources found with the same
+// name and length in the table of contents of an existing archive of their
+// day are not archived again: a run stopped before removing them, or one with
+// -k, left them behind, and they are only removed (unless -k).
+
+#define ARC_SRC_DIR      "/srv/ftp"
+#define ARC_PREFIX       "clkb_event_"
+#define ARC_DAY_LEN      8
+#define ARC_PATH_LEN     512
+#define ARC_COPY_CHUNK   (1 << 20)
+
+typedef struct arcSource{
+    char          name[ARC_NAME_LEN];
+    char          day[ARC_DAY_LEN + 1];
+    uint8_t       archived;
+    arcTocEntry_t toc;
+} arcSource_t;
+
+static int isMember(const char* name){
+    size_t len = strlen(name);
+    size_t prefixLen = strlen(ARC_PREFIX);
+
+    if(strncmp(name, ARC_PREFIX, prefixLen) != 0 || len >= ARC_NAME_LEN || len < prefixLen + ARC_DAY_LEN + 4)
+        return 0;
+
+    for(size_t i = prefixLen; i < prefixLen + ARC_DAY_LEN; i++)
+        if(name[i] < '0' || name[i] > '9')
+            return 0;
+
+    return strcmp(name + len - 4, ".dat") == 0 || strcmp(name + len - 4, ".att") == 0;
+}
+
+static int compareSource(const void* p1, const void* p2){
+    return strcmp(((const arcSource_t*)p1)->name, ((const arcSource_t*)p2)->name);
+}
+
+static int fsyncDir(const char* dir){
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    int ret;
+
+    if(fd < 0)
+        return -1;
+
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
+
+// Walks the records of a mapped .dat member and fills its table entry.
+static void checkMember(const uint8_t* map, size_t len, arcTocEntry_t* toc){
+    evtZState_t z;
+    spb2Data_t data;
+    size_t pos = 0, used;
+    uint32_t header = 0;
+    int ret, skipping = 0;
+
+    evtZReset(&z, 0);
+
+    while(pos < len){
+        ret = evtDecodeNext(map + pos, len - pos, &z, &data, &used);
+        if(ret == 1)
+            break;
+
+        if(ret == 2 || ret == 3){
+            pos += used;
+            continue;
+        }
+
+        if(ret == -2){
+            toc->nBad += !skipping;
+            skipping = 1;
+        }else{
+            skipping = 0;
+            if(ret < 0)
+                toc->nBad++;
+            else{
+                if(toc->nRecords == toc->nBad)
+                    toc->firstTrgCount = data.trgCount;
+                toc->lastTrgCount = data.trgCount;
+            }
+            toc->nRecords++;
+        }
+
+        pos += used;
+    }
+
+    // a tail which is neither a record nor a trailer
+    if(len - pos >= sizeof(uint32_t))
+        memcpy(&header, map + pos, sizeof(header));
+    if(pos < len && header != EVT_INDEX_HEADER)
+        toc->nBad++;
+}
+
+static int copyFd(int in, int out, off_t outOffset, size_t len){
+    static char buf[ARC_COPY_CHUNK];
+    off_t inOffset = 0;
+    ssize_t n;
+
+#ifdef SYS_copy_file_range
+    while((size_t)inOffset < len){
+        n = syscall(SYS_copy_file_range, in, &inOffset, out, &outOffset, len - inOffset, 0);
+        if(n <= 0)
+            break;
+    }
+    if((size_t)inOffset == len)
+        return 0;
+#endif
+
+    if(lseek(out, outOffset, SEEK_SET) < 0)
+        return -1;
+
+    while((size_t)inOffset < len){
+        n = sendfile(out, in, &inOffset, len - inOffset);
+        if(n <= 0)
+            break;
+    }
+
+    while((size_t)inOffset < len){
+        n = pread(in, buf, len - inOffset < sizeof(buf) ? len - inOffset : sizeof(buf), inOffset);
+        if(n <= 0 || write(out, buf, n) != n)
+            return -1;
+        inOffset += n;
+    }
+
+    return 0;
+}
+
+static int addMember(const char* dir, int out, off_t offset, arcSource_t* src){
+    char path[ARC_PATH_LEN];
+    const uint8_t* map;
+    struct stat st;
+    int in;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, src->name);
+
+    in = open(path, O_RDONLY);
+    if(in < 0 || fstat(in, &st) < 0){
+        fprintf(stderr,"\tERR: cannot open %s: %s\n", path, strerror(errno));
+        if(in >= 0)
+            close(in);
+        return -1;
+    }
+
+    memset(&src->toc, 0, sizeof(src->toc));
+    strncpy(src->toc.name, src->name, ARC_NAME_LEN - 1);
+    src->toc.offset = offset;
+    src->toc.length = st.st_size;
+
+    if(strcmp(src->name + strlen(src->name) - 4, ".dat") != 0)
+        src->toc.flags |= ARC_MEMBER_UNVERIFIED;
+    else if(st.st_size > 0){
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+        if(map == MAP_FAILED){
+            fprintf(stderr,"\tERR: cannot map %s: %s\n", path, strerror(errno));
+            close(in);
+            return -1;
+        }
+        madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+        checkMember(map, st.st_size, &src->toc);
+        munmap((void*)map, st.st_size);
+    }
+
+    if(copyFd(in, out, offset, st.st_size) < 0){
+        fprintf(stderr,"\tERR: cannot copy %s: %s\n", path, strerror(errno));
+        close(in);
+        return -1;
+    }
+
+    close(in);
+
+    return 0;
+}
+
+static int writeToc(int out, off_t offset, const arcSource_t* srcs, size_t n){
+    arcFooter_t footer;
+    unsigned int crc = startCRC32;
+
+    for(size_t i = 0; i < n; i++){
+        if(pwrite(out, &srcs[i].toc, sizeof(arcTocEntry_t), offset + i*sizeof(arcTocEntry_t)) != sizeof(arcTocEntry_t))
+            return -1;
+        crc = crc_32((unsigned char *)&srcs[i].toc, sizeof(arcTocEntry_t), crc);
+    }
+
+    memset(&footer, 0, sizeof(footer));
+    footer.header    = ARC_FOOTER_HEADER;
+    footer.version   = ARC_VERSION;
+    footer.tocOffset = offset;
+    footer.nEntries  = n;
+    footer.tocCrc    = crc;
+    footer.crc       = crc_32((unsigned char *)&footer, sizeof(footer)-sizeof(footer.crc), startCRC32);
+
+    if(pwrite(out, &footer, sizeof(footer), offset + n*sizeof(arcTocEntry_t)) != sizeof(footer))
+        return -1;
+
+    return 0;
+}
+
+// Marks the srcs that arcName already holds, a damaged archive holds none.
+static void markArchived(const char* arcName, const char* dir, arcSource_t* srcs, size_t n){
+    char path[ARC_PATH_LEN];
+    arcTocEntry_t* toc = NULL;
+    arcFooter_t footer;
+    struct stat st;
+    size_t len;
+    int fd;
+
+    fd = open(arcName, O_RDONLY);
+    if(fd < 0)
+        return;
+
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(footer) ||
+       pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) != sizeof(footer) ||
+       footer.header != ARC_FOOTER_HEADER ||
+       footer.crc != crc_32((unsigned char *)&footer, sizeof(footer)-sizeof(footer.crc), startCRC32))
+        goto done;
+
+    len = (size_t)footer.nEntries*sizeof(arcTocEntry_t);
+    toc = malloc(len > 0 ? len : 1);
+    if(toc == NULL || pread(fd, toc, len, footer.tocOffset) != (ssize_t)len ||
+       footer.tocCrc != crc_32((unsigned char *)toc, len, startCRC32))
+        goto done;
+
+    for(uint32_t e = 0; e < footer.nEntries; e++){
+        for(size_t i = 0; i < n; i++){
+            if(srcs[i].archived || strncmp(toc[e].name, srcs[i].name, ARC_NAME_LEN) != 0)
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s", dir, srcs[i].name);
+            if(stat(path, &st) == 0 && (uint64_t)st.st_size == toc[e].length)
+                srcs[i].archived = 1;
+        }
+    }
+
+done:
+    free(toc);
+    close(fd);
+}
+
+// Archives srcs (all of the same day), returns 0 once the archive is durable.
+// Sources already in an archive are only removed.
+static int archiveDay(const char* dir, const char* outDir, arcSource_t* srcs, size_t n, int keep){
+    char lockName[ARC_PATH_LEN + 8];
+    char arcName[ARC_PATH_LEN];
+    char path[ARC_PATH_LEN];
+    off_t offset = 0;
+    uint32_t nBad = 0;
+    size_t m = 0;
+    int out = -1;
+
+    for(int seq = 0; out < 0; seq++){
+        snprintf(arcName, sizeof(arcName), "%s/clkb_archive_%s-%04d.arc", outDir, srcs[0].day, seq);
+        snprintf(lockName, sizeof(lockName), "%s.lock", arcName);
+
+        if(access(arcName, F_OK) == 0){
+            markArchived(arcName, dir, srcs, n);
+            continue;
+        }
+
+        out = open(lockName, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(out < 0 && errno != EEXIST){
+            fprintf(stderr,"\tERR: cannot create %s: %s\n", lockName, strerror(errno));
+            return -1;
+        }
+    }
+
+    for(size_t i = 0; i < n; i++){
+        if(!srcs[i].archived){
+            srcs[m++] = srcs[i];
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", dir, srcs[i].name);
+        printf("%s already archived\n", path);
+        if(!keep && unlink(path) < 0)
+            fprintf(stderr,"\tERR: cannot remove %s: %s\n", path, strerror(errno));
+    }
+
+    if(m < n && !keep)
+        fsyncDir(dir);
+
+    n = m;
+    if(n == 0){
+        close(out);
+        unlink(lockName);
+        return 0;
+    }
+
+    for(size_t i = 0; i < n; i++){
+        if(addMember(dir, out, offset, &srcs[i]) < 0)
+            goto fail;
+        offset += srcs[i].toc.length;
+        nBad += srcs[i].toc.nBad;
+    }
+
+    if(writeToc(out, offset, srcs, n) < 0 || fsync(out) < 0){
+        fprintf(stderr,"\tERR: cannot write %s: %s\n", lockName, strerror(errno));
+        goto fail;
+    }
+
+    close(out);
+
+    if(rename(lockName, arcName) < 0 || fsyncDir(outDir) < 0){
+        fprintf(stderr,"\tERR: cannot commit %s: %s\n", arcName, strerror(errno));
+        return -1;
+    }
+
+    printf("%s files=%zu bytes=%lld bad=%u\n", arcName, n, (long long)offset, nBad);
+
+    if(keep)
+        return 0;
+
+    for(size_t i = 0; i < n; i++){
+        snprintf(path, sizeof(path), "%s/%s", dir, srcs[i].name);
+        if(unlink(path) < 0)
+            fprintf(stderr,"\tERR: cannot remove %s: %s\n", path, strerror(errno));
+    }
+
+    fsyncDir(dir);
+
+    return 0;
+
+fail:
+    close(out);
+    unlink(lockName);
+
+    return -1;
+}
+
+int main(int argc, char *argv[]){
+    const char* dir = ARC_SRC_DIR;
+    const char* outDir = NULL;
+    arcSource_t* srcs = NULL;
+    arcSource_t* tmp;
+    struct dirent* ent;
+    DIR* d;
+    size_t n = 0, cap = 0, first;
+    int dryRun = 0, keep = 0, err = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:nk")) != -1){
+        switch(opt){
+            case 'o':
+                outDir = optarg;
+                break;
+            case 'n':
+                dryRun = 1;
+                break;
+            case 'k':
+                keep = 1;
+                break;
+            default:
+                fprintf(stderr,"Usage: %s [-o outdir] [-n] [-k] [dir]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if(optind < argc)
+        dir = argv[optind];
+    if(outDir == NULL)
+        outDir = dir;
+
+    d = opendir(dir);
+    if(d == NULL){
+        fprintf(stderr,"\tERR: cannot open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    while((ent = readdir(d)) != NULL){
+        if(!isMember(ent->d_name))
+            continue;
+
+        if(n == cap){
+            cap = cap ? 2*cap : 1024;
+            tmp = realloc(srcs, cap*sizeof(arcSource_t));
+            if(tmp == NULL){
+                fprintf(stderr,"\tERR: out of memory\n");
+                return -1;
+            }
+            srcs = tmp;
+        }
+
+        memset(&srcs[n], 0, sizeof(arcSource_t));
+        memcpy(srcs[n].name, ent->d_name, strlen(ent->d_name) + 1);
+        memcpy(srcs[n].day, ent->d_name + strlen(ARC_PREFIX), ARC_DAY_LEN);
+        n++;
+    }
+
+    closedir(d);
+
+    qsort(srcs, n, sizeof(arcSource_t), compareSource);
+
+    for(first = 0; first < n; ){
+        size_t last = first;
+
+        while(last < n && strcmp(srcs[last].day, srcs[first].day) == 0)
+            last++;
+
+        if(dryRun)
+            printf("%s files=%zu\n", srcs[first].day, last - first);
+        else if(archiveDay(dir, outDir, &srcs[first], last - first, keep) < 0)
+            err = 1;
+
+        first = last;
+    }
+
+    free(srcs);
+
+    return err ? 1 : 0;
+}
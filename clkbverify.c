@@ -0,0 +1,481 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "eventfile.h"
+#include "crc32.h"
+
+// Checks event files (plain or compressed records, with or without the index
+// trailer) and optionally dumps their fields. Files are mapped and verified in
+// parallel, one file per worker at a time.
+//
+//   clkbverify [-j threads] [-d fields] <event file|directory> ...
+//     -d  comma separated list of trg,gtu,time,nsec,flag,alive,dead,status,imu,gps
+//         printed as CSV (path,record,fields...) on stdout
+//
+// Directories are searched for clkb_event_*.dat files. Files are taken in name
+// order, which is the order they were written in, to find trigger counter gaps
+// across file boundaries. Problems are reported one per line:
+//   bad_crc <path> record <n> offset <o>
+//   no_header <path> offset <o> bytes <n>
+//   gap <path> record <n> trg <previous> <current>
+//   lost <path> record <n> <dropped|degraded|upstream> events <n> trg <first> <last>
+//   truncated <path> offset <o> bytes <n>
+//   bad_index <path>
+//   layout <path> version <v> record_size <n>
+//   error <path> <reason>
+// followed by a summary line. lost lines are the gap markers written by the
+// daemon; the trigger counters they account for are not reported as gaps.
+// The report goes on stdout, or on stderr when fields are dumped. The exit
+// status is 1 when anything but gaps and markers was found.
+
+#define VERIFY_PREFIX "clkb_event_"
+#define VERIFY_SUFFIX ".dat"
+#define FIELDS_MAX    10
+
+typedef enum{
+    FIELD_TRG, FIELD_GTU, FIELD_TIME, FIELD_NSEC, FIELD_FLAG, FIELD_ALIVE, FIELD_DEAD, FIELD_STATUS, FIELD_IMU, FIELD_GPS
+} field_t;
+
+static const char* fieldNames[FIELDS_MAX] = {"trg", "gtu", "time", "nsec", "flag", "alive", "dead", "status", "imu", "gps"};
+
+typedef struct verifyFile{
+    char*    path;
+    uint64_t bytes;
+    uint64_t nRecords;
+    uint64_t badCrc;
+    uint64_t noHeader;
+    uint64_t gaps;
+    uint64_t lost;
+    uint64_t degraded;
+    uint32_t firstTrg;
+    uint32_t lastTrg;
+    uint8_t  hasRecords;
+    uint8_t  leadGap;
+    uint8_t  truncated;
+    uint8_t  badIndex;
+    uint8_t  layout;
+    uint8_t  error;
+    char*    report;
+    size_t   reportLen;
+    char*    dump;
+    size_t   dumpLen;
+} verifyFile_t;
+
+typedef struct verifyJob{
+    verifyFile_t* files;
+    size_t        nFiles;
+    size_t        next;
+    field_t       fields[FIELDS_MAX];
+    int           nFields;
+} verifyJob_t;
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void dumpRecord(FILE* out, const verifyJob_t* job, const char* path, uint64_t record, const spb2Data_t* data){
+    uint32_t imuTimestamp;
+
+    fprintf(out, "%s,%llu", path, (unsigned long long)record);
+
+    for(int i = 0; i < job->nFields; i++){
+        switch(job->fields[i]){
+            case FIELD_TRG:
+                fprintf(out, ",%u", data->trgCount);
+                break;
+            case FIELD_GTU:
+                fprintf(out, ",%u", data->gtuCount);
+                break;
+            case FIELD_TIME:
+                fprintf(out, ",%u", data->unixTime);
+                break;
+            case FIELD_NSEC:
+                fprintf(out, ",%09u", data->unixNsec);
+                break;
+            case FIELD_FLAG:
+                fprintf(out, ",0x%08x", data->trgFlag);
+                break;
+            case FIELD_ALIVE:
+                fprintf(out, ",%u", data->aliveTime);
+                break;
+            case FIELD_DEAD:
+                fprintf(out, ",%u", data->deadTime);
+                break;
+            case FIELD_STATUS:
+                fprintf(out, ",0x%08x", data->status);
+                break;
+            case FIELD_IMU:
+                imuTimestamp = (uint8_t)data->gpsStr[DATA_GPS_BYTES-3] |
+                               ((uint32_t)(uint8_t)data->gpsStr[DATA_GPS_BYTES-2] << 8) |
+                               ((uint32_t)(uint8_t)data->gpsStr[DATA_GPS_BYTES-1] << 16);
+                fprintf(out, ",%u", imuTimestamp);
+                break;
+            case FIELD_GPS:
+                fputs(",\"", out);
+                for(int c = 0; c < DATA_GPS_BYTES-3 && data->gpsStr[c] != '\0'; c++)
+                    fputc(data->gpsStr[c] == '\r' || data->gpsStr[c] == '\n' || data->gpsStr[c] == '"' ?
+                          ' ' : data->gpsStr[c], out);
+                fputc('"', out);
+                break;
+        }
+    }
+
+    fputc('\n', out);
+}
+
+static void verifyOne(verifyFile_t* f, const verifyJob_t* job){
+    FILE* report = open_memstream(&f->report, &f->reportLen);
+    FILE* dump = job->nFields > 0 ? open_memstream(&f->dump, &f->dumpLen) : NULL;
+    const uint8_t* map = NULL;
+    struct stat st;
+    evtZState_t z;
+    evtIndex_t idx;
+    evtFileHeader_t hdr;
+    spb2Data_t data;
+    evtGap_t gap;
+    FILE* file;
+    size_t pos = 0, used, skipFrom = 0, skipped = 0;
+    uint32_t header = 0;
+    int contiguous = 0;
+    int fd, ret;
+
+    fd = open(f->path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0){
+        fprintf(report, "error %s %s\n", f->path, strerror(errno));
+        f->error = 1;
+        goto done;
+    }
+
+    f->bytes = st.st_size;
+    if(st.st_size > 0){
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED){
+            fprintf(report, "error %s %s\n", f->path, strerror(errno));
+            f->error = 1;
+            map = NULL;
+            goto done;
+        }
+        madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    evtZReset(&z, 0);
+
+    while(pos < f->bytes){
+        ret = evtDecodeNext(map + pos, f->bytes - pos, &z, &data, &used);
+
+        if(ret == -2){
+            if(skipped++ == 0)
+                skipFrom = pos;
+            pos += used;
+            continue;
+        }
+
+        if(skipped > 0){
+            fprintf(report, "no_header %s offset %zu bytes %zu\n", f->path, skipFrom, skipped);
+            f->noHeader++;
+            skipped = 0;
+            contiguous = 0;
+        }
+
+        if(ret == 1)
+            break;
+
+        // records of another layout cannot be checked by this build
+        if(ret == 2){
+            if(evtFileHeaderParse(map + pos, f->bytes - pos, &hdr) < 0 || !evtFileLayoutNative(&hdr)){
+                fprintf(report, "layout %s version %u record_size %u\n", f->path, hdr.info.version, hdr.info.recordSize);
+                f->layout = 1;
+                goto done;
+            }
+            pos += used;
+            continue;
+        }
+
+        if(ret == 3){
+            memcpy(&gap, &data, sizeof(gap));
+            fprintf(report, "lost %s record %llu %s events %u trg %u %u\n", f->path, (unsigned long long)f->nRecords,
+                    gap.kind == EVT_GAP_DEGRADED ? "degraded" : gap.kind == EVT_GAP_UPSTREAM ? "upstream" : "dropped",
+                    gap.nEvents, gap.firstTrgCount, gap.lastTrgCount);
+
+            if(gap.kind == EVT_GAP_DEGRADED)
+                f->degraded += gap.nEvents;
+            else{
+                f->lost += gap.nEvents;
+                // the next record follows the missing ones, the ranges of the
+                // markers before the same record can interleave
+                if(!f->hasRecords && (!f->leadGap || (int32_t)(gap.firstTrgCount - f->firstTrg) < 0))
+                    f->firstTrg = gap.firstTrgCount;
+                if(!f->hasRecords && !f->leadGap)
+                    f->lastTrg = gap.lastTrgCount;
+                if((int32_t)(gap.lastTrgCount - f->lastTrg) > 0)
+                    f->lastTrg = gap.lastTrgCount;
+                f->leadGap = 1;
+                contiguous = contiguous || !f->hasRecords;
+            }
+            pos += used;
+            continue;
+        }
+
+        if(ret < 0){
+            fprintf(report, "bad_crc %s record %llu offset %zu\n", f->path, (unsigned long long)f->nRecords, pos);
+            f->badCrc++;
+            contiguous = 0;
+        }else{
+            // the counter of damaged records is unknown, no gap is reported across them
+            if(contiguous && data.trgCount != f->lastTrg + 1){
+                fprintf(report, "gap %s record %llu trg %u %u\n", f->path, (unsigned long long)f->nRecords,
+                        f->lastTrg, data.trgCount);
+                f->gaps++;
+            }
+
+            if(!f->hasRecords && !f->leadGap)
+                f->firstTrg = data.trgCount;
+            f->lastTrg = data.trgCount;
+            f->hasRecords = 1;
+            contiguous = 1;
+
+            if(dump != NULL)
+                dumpRecord(dump, job, f->path, f->nRecords, &data);
+        }
+
+        f->nRecords++;
+        pos += used;
+    }
+
+    if(skipped > 0){
+        fprintf(report, "no_header %s offset %zu bytes %zu\n", f->path, skipFrom, skipped);
+        f->noHeader++;
+    }
+
+    if(pos < f->bytes && f->bytes - pos >= sizeof(uint32_t))
+        memcpy(&header, map + pos, sizeof(header));
+
+    if(pos < f->bytes && header == EVT_INDEX_HEADER){
+        file = fopen(f->path, "rb");
+        if(file == NULL || evtIndexRead(file, &idx) < 0 ||
+           idx.summary.nBytes != pos || idx.summary.nRecords != f->nRecords){
+            fprintf(report, "bad_index %s\n", f->path);
+            f->badIndex = 1;
+        }
+        if(file != NULL)
+            fclose(file);
+    }else if(pos < f->bytes){
+        fprintf(report, "truncated %s offset %zu bytes %llu\n", f->path, pos, (unsigned long long)(f->bytes - pos));
+        f->truncated = 1;
+    }
+
+done:
+    if(map != NULL)
+        munmap((void*)map, f->bytes);
+    if(fd >= 0)
+        close(fd);
+    fclose(report);
+    if(dump != NULL)
+        fclose(dump);
+}
+
+static void* verifyThread(void* arg){
+    verifyJob_t* job = (verifyJob_t*)arg;
+    size_t i;
+
+    while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nFiles)
+        verifyOne(&job->files[i], job);
+
+    return NULL;
+}
+
+static int addFile(verifyJob_t* job, size_t* cap, const char* path){
+    verifyFile_t* files;
+
+    if(job->nFiles == *cap){
+        *cap = *cap ? 2*(*cap) : 1024;
+        files = realloc(job->files, *cap*sizeof(verifyFile_t));
+        if(files == NULL)
+            return -1;
+        job->files = files;
+    }
+
+    memset(&job->files[job->nFiles], 0, sizeof(verifyFile_t));
+    job->files[job->nFiles].path = strdup(path);
+
+    return job->files[job->nFiles++].path != NULL ? 0 : -1;
+}
+
+static int addPath(verifyJob_t* job, size_t* cap, const char* path){
+    struct stat st;
+    struct dirent* ent;
+    DIR* dir;
+    char* name;
+    size_t len;
+    int ret = 0;
+
+    if(stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+        return addFile(job, cap, path);
+
+    dir = opendir(path);
+    if(dir == NULL)
+        return addFile(job, cap, path);
+
+    while(ret == 0 && (ent = readdir(dir)) != NULL){
+        len = strlen(ent->d_name);
+        if(strncmp(ent->d_name, VERIFY_PREFIX, strlen(VERIFY_PREFIX)) != 0 || len < strlen(VERIFY_SUFFIX) ||
+           strcmp(ent->d_name + len - strlen(VERIFY_SUFFIX), VERIFY_SUFFIX) != 0)
+            continue;
+
+        if(asprintf(&name, "%s/%s", path, ent->d_name) < 0)
+            ret = -1;
+        else{
+            ret = addFile(job, cap, name);
+            free(name);
+        }
+    }
+
+    closedir(dir);
+
+    return ret;
+}
+
+static int parseFields(verifyJob_t* job, char* list){
+    char* tok;
+    int i;
+
+    for(tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")){
+        for(i = 0; i < FIELDS_MAX; i++)
+            if(strcmp(tok, fieldNames[i]) == 0)
+                break;
+
+        if(i == FIELDS_MAX || job->nFields == FIELDS_MAX){
+            fprintf(stderr,"\tERR: unknown field %s\n", tok);
+            return -1;
+        }
+
+        job->fields[job->nFields++] = (field_t)i;
+    }
+
+    return 0;
+}
+
+static int comparePath(const void* p1, const void* p2){
+    return strcmp(((const verifyFile_t*)p1)->path, ((const verifyFile_t*)p2)->path);
+}
+
+int main(int argc, char *argv[]){
+    verifyJob_t job;
+    pthread_t* threads;
+    FILE* rep;
+    verifyFile_t* f;
+    verifyFile_t* prev = NULL;
+    size_t cap = 0, truncated = 0, badIndex = 0, layout = 0, errors = 0;
+    uint64_t records = 0, badCrc = 0, noHeader = 0, gaps = 0, lost = 0, degraded = 0, bytes = 0, start, elapsed;
+    long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    memset(&job, 0, sizeof(job));
+
+    while((opt = getopt(argc, argv, "j:d:")) != -1){
+        switch(opt){
+            case 'j':
+                nThreads = strtol(optarg, NULL, 0);
+                break;
+            case 'd':
+                if(parseFields(&job, optarg) < 0)
+                    return -1;
+                break;
+            default:
+                fprintf(stderr,"Usage: %s [-j threads] [-d fields] <event file|directory> ...\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if(optind >= argc){
+        fprintf(stderr,"Usage: %s [-j threads] [-d fields] <event file|directory> ...\n", argv[0]);
+        return -1;
+    }
+
+    for(int i = optind; i < argc; i++)
+        if(addPath(&job, &cap, argv[i]) < 0){
+            fprintf(stderr,"\tERR: out of memory\n");
+            return -1;
+        }
+
+    qsort(job.files, job.nFiles, sizeof(verifyFile_t), comparePath);
+
+    if(nThreads < 1)
+        nThreads = 1;
+    if((size_t)nThreads > job.nFiles && job.nFiles > 0)
+        nThreads = job.nFiles;
+
+    threads = malloc(nThreads*sizeof(pthread_t));
+    if(threads == NULL){
+        fprintf(stderr,"\tERR: out of memory\n");
+        return -1;
+    }
+
+    start = nowNs();
+
+    for(long i = 0; i < nThreads; i++)
+        if(pthread_create(&threads[i], NULL, verifyThread, &job) != 0){
+            fprintf(stderr,"\tERR: cannot start worker %ld\n", i);
+            nThreads = i;
+            verifyThread(&job);
+            break;
+        }
+
+    for(long i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    elapsed = nowNs() - start;
+
+    rep = job.nFields > 0 ? stderr : stdout;
+
+    for(size_t i = 0; i < job.nFiles; i++){
+        f = &job.files[i];
+
+        if(f->dump != NULL)
+            fwrite(f->dump, 1, f->dumpLen, stdout);
+
+        if(f->hasRecords && prev != NULL && f->firstTrg != prev->lastTrg + 1){
+            fprintf(rep, "gap %s record 0 trg %u %u\n", f->path, prev->lastTrg, f->firstTrg);
+            gaps++;
+        }
+        if(f->hasRecords)
+            prev = f;
+
+        fwrite(f->report, 1, f->reportLen, rep);
+
+        records   += f->nRecords;
+        badCrc    += f->badCrc;
+        noHeader  += f->noHeader;
+        gaps      += f->gaps;
+        lost      += f->lost;
+        degraded  += f->degraded;
+        bytes     += f->bytes;
+        truncated += f->truncated;
+        badIndex  += f->badIndex;
+        layout    += f->layout;
+        errors    += f->error;
+    }
+
+    fprintf(rep, "files=%zu records=%llu bad_crc=%llu no_header=%llu gaps=%llu lost=%llu degraded=%llu "
+            "truncated=%zu bad_index=%zu layout=%zu errors=%zu MB=%.1f seconds=%.3f MB_s=%.1f threads=%ld\n",
+            job.nFiles, (unsigned long long)records, (unsigned long long)badCrc, (unsigned long long)noHeader,
+            (unsigned long long)gaps, (unsigned long long)lost, (unsigned long long)degraded,
+            truncated, badIndex, layout, errors, bytes/1e6, elapsed/1e9,
+            elapsed > 0 ? bytes*1e3/elapsed : 0.0, nThreads);
+
+    return (badCrc || noHeader || truncated || badIndex || layout || errors) ? 1 : 0;
+}
@@ -97,6 +97,14 @@ static void writeCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
     write(connfd, c->feedbackStr, strlen(c->feedbackStr));
 }
 
+// the GTU counter restarts, the clock model fitted on the old counts is dropped
+static void gtuResetCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    writeReg(regDev->ctrlReg, c->baseAddr, c->regAddr, c->cmdVal);
+    gtuClockInit();
+    printf("%s", c->feedbackStr);
+    write(connfd, c->feedbackStr, strlen(c->feedbackStr));
+}
+
 static void readCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
     uint32_t regVal = 0;
     char resStr[TCP_SND_BUF] = "";
@@ -130,6 +138,87 @@ static void readCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
     write(connfd, resStr, strlen(resStr));
 }
 
+static void traceCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    char resStr[TCP_SND_BUF] = "";
+    int nEvents = traceDump(TRACE_DUMP_PATH);
+
+    if(nEvents < 0)
+        snprintf(resStr, TCP_SND_BUF, "%sERR cannot write %s\n", c->feedbackStr, TRACE_DUMP_PATH);
+    else
+        snprintf(resStr, TCP_SND_BUF, "%s%d events in %s\n", c->feedbackStr, nEvents, TRACE_DUMP_PATH);
+
+    printf("%s", resStr);
+    write(connfd, resStr, strlen(resStr));
+}
+
+static void captureCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    canCaptureEnable(c->cmdVal == CAN_CAPTURE_ON);
+
+    printf("%s", c->feedbackStr);
+    write(connfd, c->feedbackStr, strlen(c->feedbackStr));
+}
+
+static void indexCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    evtIndexEnable(c->cmdVal == EVT_INDEX_ON);
+
+    printf("%s", c->feedbackStr);
+    write(connfd, c->feedbackStr, strlen(c->feedbackStr));
+}
+
+static void clockCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    char resStr[TCP_SND_BUF] = "";
+    gtuClockParams_t p;
+
+    gtuClockGet(&p);
+
+    snprintf(resStr, TCP_SND_BUF,
+             "%svalid=%u refGtu=%u refNs=%" PRIu64 " tickNs=%.9f samples=%u pps=%u "
+             "rmsNs=%.0f ppsRmsNs=%.0f lastNs=%.0f maxNs=%.0f rejected=%u resets=%u\n",
+             c->feedbackStr, p.valid, p.refGtu, p.refNs, p.tickNs, p.nSamples, p.nPps,
+             p.rmsNs, p.ppsRmsNs, p.lastNs, p.maxNs, p.nRejected, p.nResets);
+
+    printf("%s", resStr);
+    write(connfd, resStr, strlen(resStr));
+}
+
+static void finalizeCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    char resStr[TCP_SND_BUF] = "";
+    finalizeStats_t s;
+
+    finalizeGetStats(&s);
+
+    snprintf(resStr, TCP_SND_BUF,
+             "%sdepth=%u maxDepth=%u done=%u failed=%u waits=%u skipped=%u maxWaitUs=%" PRIu64 " lastUs=%" PRIu64 " avgUs=%" PRIu64 " maxUs=%" PRIu64 "\n",
+             c->feedbackStr, s.depth, s.maxDepth, s.nDone, s.nFailed, s.nWaits, s.nSkipped, s.maxWaitNs/1000,
+             s.lastNs/1000, s.nDone ? s.totalNs/s.nDone/1000 : 0, s.maxNs/1000);
+
+    printf("%s", resStr);
+    write(connfd, resStr, strlen(resStr));
+}
+
+static void queuePolicyCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    evtQueueSetPolicy(c->cmdVal - WQ_BLOCK + EVT_QUEUE_BLOCK);
+
+    printf("%s", c->feedbackStr);
+    write(connfd, c->feedbackStr, strlen(c->feedbackStr));
+}
+
+static void queueCmd(axiRegisters_t *regDev, int connfd, cmd_t *c){
+    char resStr[TCP_SND_BUF] = "";
+    evtQueueStats_t s;
+
+    evtQueueGetStats(&s);
+
+    snprintf(resStr, TCP_SND_BUF,
+             "%spolicy=%s len=%u depth=%u liteDepth=%u maxDepth=%u pushed=%" PRIu64 " written=%" PRIu64 " "
+             "dropped=%" PRIu64 " degraded=%" PRIu64 " upstream=%" PRIu64 " blocked=%" PRIu64 " blockedUs=%" PRIu64 "\n",
+             c->feedbackStr, evtQueuePolicyName(s.policy), s.len, s.depth, s.liteDepth, s.maxDepth, s.pushed, s.popped,
+             s.dropped, s.degraded, s.upstream, s.blocked, s.blockedNs/1000);
+
+    printf("%s", resStr);
+    write(connfd, resStr, strlen(resStr));
+}
+
 static void echo(axiRegisters_t *regDev, int connfd, cmd_t *c){
     printf("%s", c->feedbackStr);
     write(connfd, c->feedbackStr, strlen(c->feedbackStr));
@@ -149,10 +238,10 @@ static cmd_t commands[] = {
     {"gps2 no",       NO_GPS2,         "NO GPS2\n",         writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
     {"gpsauto on",    GPSAUTO_ON,      "GPS AUTO ON\n",     writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
     {"gpsauto no",    GPSAUTO_NO,      "GPS AUTO NO\n",     writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
-    {"gtu reset",     RESET_GTU_COUNT, "RESET GTU COUNT\n", writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
+    {"gtu reset",     RESET_GTU_COUNT, "RESET GTU COUNT\n", gtuResetCmd, CTRL_REG_ADDR, CMD_RECV_ADDR},
     {"pck reset",     RESET_PACKET_NR, "RESET PACKET NR\n", writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
     {"trg reset",     RESET_TRG_COUNT, "RESET TRG COUNT\n", writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
-    {"all reset",     RESET_ALL_COUNT, "RESET ALL COUNT\n", writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
+    {"all reset",     RESET_ALL_COUNT, "RESET ALL COUNT\n", gtuResetCmd, CTRL_REG_ADDR, CMD_RECV_ADDR},
     {"ppstrg on",     PPS_TRG_ON,      "PPS TRG ON\n",      writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
     {"ppstrg off",    PPS_TRG_OFF,     "PPS TRG OFF\n",     writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
     {"msk exttrg",    MASK_EXT_TRG,    "MASK EXT TRG\n",    writeCmd, CTRL_REG_ADDR,   CMD_RECV_ADDR},
@@ -171,6 +260,18 @@ static cmd_t commands[] = {
     {"l11 counter",   READ_L11COUNTER, "L1_1 COUNTER=",     readCmd,  L1CNT_REG_ADDR,  L1_1_COUNTER_ADDR},
     {"l12 counter",   READ_L12COUNTER, "L1_2 COUNTER=",     readCmd,  L1CNT_REG_ADDR,  L1_2_COUNTER_ADDR},
     {"l13 counter",   READ_L13COUNTER, "L1_3 COUNTER=",     readCmd,  L1CNT_REG_ADDR,  L1_3_COUNTER_ADDR},
+    {"trace dump",    TRACE_DUMP,      "TRACE DUMP=",       traceCmd, NONE,            NONE},
+    {"can cap on",    CAN_CAPTURE_ON,  "CAN CAPTURE ON\n",  captureCmd, NONE,          NONE},
+    {"can cap off",   CAN_CAPTURE_OFF, "CAN CAPTURE OFF\n", captureCmd, NONE,          NONE},
+    {"evt idx on",    EVT_INDEX_ON,    "EVT INDEX ON\n",    indexCmd,   NONE,          NONE},
+    {"evt idx off",   EVT_INDEX_OFF,   "EVT INDEX OFF\n",   indexCmd,   NONE,          NONE},
+    {"gtu clock",     GTU_CLOCK,       "GTU CLOCK ",        clockCmd,   NONE,          NONE},
+    {"fin stats",     FINALIZE_STATS,  "FINALIZE ",         finalizeCmd, NONE,         NONE},
+    {"wq block",      WQ_BLOCK,        "WQ BLOCK\n",        queuePolicyCmd, NONE,      NONE},
+    {"wq drop newest", WQ_DROP_NEWEST, "WQ DROP NEWEST\n",  queuePolicyCmd, NONE,      NONE},
+    {"wq drop oldest", WQ_DROP_OLDEST, "WQ DROP OLDEST\n",  queuePolicyCmd, NONE,      NONE},
+    {"wq degrade",    WQ_DEGRADE,      "WQ DEGRADE\n",      queuePolicyCmd, NONE,      NONE},
+    {"wq stats",      WQ_STATS,        "WQ ",               queueCmd,   NONE,          NONE},
     {"exit",          EXIT,            "EXIT\n",            echo,     NONE,            NONE},
 };
 
@@ -15,6 +15,12 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include "registers.h"
+#include "trace.h"
+#include "can.h"
+#include "eventfile.h"
+#include "gtuclock.h"
+#include "finalize.h"
+#include "evtqueue.h"
 
 #define NONE            0x00
 
@@ -53,6 +59,18 @@
 #define NO_GPS2         0x22
 #define GPSAUTO_ON      0x23
 #define GPSAUTO_NO      0x24
+#define TRACE_DUMP      0x25
+#define CAN_CAPTURE_ON  0x26
+#define CAN_CAPTURE_OFF 0x27
+#define EVT_INDEX_ON    0x28
+#define EVT_INDEX_OFF   0x29
+#define GTU_CLOCK       0x2A
+#define FINALIZE_STATS  0x2B
+#define WQ_BLOCK        0x2C
+#define WQ_DROP_NEWEST  0x2D
+#define WQ_DROP_OLDEST  0x2E
+#define WQ_DEGRADE      0x2F
+#define WQ_STATS        0x30
 
 #define EXIT            0xFF
 
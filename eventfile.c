@@ -0,0 +1,657 @@
+#define _FILE_OFFSET_BITS 64
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "eventfile.h"
+#include "crc32.h"
+
+_Static_assert(sizeof(evtIndexBlock_t) == sizeof(spb2Data_t), "index blocks must be record sized");
+_Static_assert(sizeof(evtFileHeader_t) == sizeof(spb2Data_t), "file headers must be record sized");
+_Static_assert(sizeof(evtGap_t) == sizeof(spb2Data_t), "gap markers must be record sized");
+
+#define FIELD(n, f, s, t) {n, offsetof(spb2Data_t, f), s, t, {0}}
+
+static const evtField_t nativeFields[] = {
+    FIELD("header",    header,    4,                  EVT_TYPE_U32),
+    FIELD("unixTime",  unixTime,  4,                  EVT_TYPE_U32),
+    FIELD("trgCount",  trgCount,  4,                  EVT_TYPE_U32),
+    FIELD("gtuCount",  gtuCount,  4,                  EVT_TYPE_U32),
+    FIELD("trgFlag",   trgFlag,   4,                  EVT_TYPE_U32),
+    FIELD("aliveTime", aliveTime, 4,                  EVT_TYPE_U32),
+    FIELD("deadTime",  deadTime,  4,                  EVT_TYPE_U32),
+    FIELD("status",    status,    4,                  EVT_TYPE_U32),
+    FIELD("gpsStr",    gpsStr,    DATA_GPS_BYTES - 3, EVT_TYPE_CHAR),
+    {"imuStamp", offsetof(spb2Data_t, gpsStr) + DATA_GPS_BYTES - 3, 3, EVT_TYPE_U24, {0}},
+    FIELD("unixNsec",  unixNsec,  4,                  EVT_TYPE_U32),
+    FIELD("crc",       crc,       4,                  EVT_TYPE_U32),
+};
+
+// zero runs shorter than this are cheaper inside a literal run
+#define EVT_Z_MIN_ZEROS 3
+
+static int indexRequest = 1;
+
+static uint32_t keyOf(const evtIndexEntry_t* e, int key){
+    switch(key){
+        case EVT_KEY_GTU:
+            return e->gtuCount;
+        case EVT_KEY_TIME:
+            return e->unixTime;
+        default:
+            return e->trgCount;
+    }
+}
+
+static uint32_t recordKey(const spb2Data_t* data, int key){
+    evtIndexEntry_t e = {data->trgCount, data->gtuCount, data->unixTime, 0, 0};
+
+    return keyOf(&e, key);
+}
+
+static size_t putVarint(uint8_t* out, uint32_t v){
+    size_t n = 0;
+
+    while(v >= 0x80){
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+
+    return n;
+}
+
+static int getVarint(const uint8_t* in, size_t len, size_t* pos, uint32_t* v){
+    uint32_t shift = 0;
+
+    *v = 0;
+    while(*pos < len && shift < 32){
+        *v |= (uint32_t)(in[*pos] & 0x7F) << shift;
+        if(!(in[(*pos)++] & 0x80))
+            return 0;
+        shift += 7;
+    }
+
+    return -1;
+}
+
+// keyInterval 0 makes every record a keyframe
+void evtZReset(evtZState_t* z, uint32_t keyInterval){
+    memset(z->prev, 0, DATA_GPS_BYTES);
+    z->keyInterval = keyInterval;
+    z->count       = 0;
+    z->valid       = 0;
+    z->keyDue      = 0;
+}
+
+// Codes data into out (at least EVT_Z_MAX_LEN bytes), returns the record length.
+size_t evtZEncode(evtZState_t* z, const spb2Data_t* data, uint8_t* out){
+    spb2ZData_t hdr;
+    uint8_t* dst = out + sizeof(spb2ZData_t);
+    uint8_t delta[DATA_GPS_BYTES];
+    size_t len = 0, pos = 0, zeros, lit, run;
+    uint8_t key = z->keyInterval == 0 || z->count % z->keyInterval == 0 || z->keyDue;
+
+    for(size_t i = 0; i < DATA_GPS_BYTES; i++){
+        delta[i] = (uint8_t)data->gpsStr[i] ^ (key ? 0 : z->prev[i]);
+        z->prev[i] = (uint8_t)data->gpsStr[i];
+    }
+
+    while(pos < DATA_GPS_BYTES){
+        for(zeros = 0; pos + zeros < DATA_GPS_BYTES && delta[pos + zeros] == 0; zeros++);
+        if(pos + zeros == DATA_GPS_BYTES)
+            break;
+
+        // literal run up to the next zero run worth coding
+        lit = zeros;
+        while(pos + lit < DATA_GPS_BYTES){
+            for(run = 0; pos + lit + run < DATA_GPS_BYTES && delta[pos + lit + run] == 0; run++);
+            if(run >= EVT_Z_MIN_ZEROS || pos + lit + run == DATA_GPS_BYTES)
+                break;
+            lit += run + 1;
+        }
+        lit -= zeros;
+
+        len += putVarint(dst + len, zeros);
+        len += putVarint(dst + len, lit);
+        memcpy(dst + len, delta + pos + zeros, lit);
+        len += lit;
+        pos += zeros + lit;
+    }
+
+    hdr.header    = DATA_ZHEADER;
+    hdr.length    = (uint16_t)len;
+    hdr.flags     = key ? EVT_Z_KEYFRAME : 0;
+    hdr.reserved  = 0;
+    hdr.unixTime  = data->unixTime;
+    hdr.trgCount  = data->trgCount;
+    hdr.gtuCount  = data->gtuCount;
+    hdr.trgFlag   = data->trgFlag;
+    hdr.aliveTime = data->aliveTime;
+    hdr.deadTime  = data->deadTime;
+    hdr.status    = data->status;
+    hdr.unixNsec  = data->unixNsec;
+    hdr.crc       = data->crc;
+    memcpy(out, &hdr, sizeof(hdr));
+
+    z->count++;
+    z->keyDue = 0;
+
+    return sizeof(spb2ZData_t) + len;
+}
+
+// Rebuilds the record coded in in, -1 if it is damaged or if it is a delta
+// whose keyframe has not been decoded.
+int evtZDecode(evtZState_t* z, const uint8_t* in, size_t len, spb2Data_t* data){
+    spb2ZData_t hdrBuf;
+    const spb2ZData_t* hdr = &hdrBuf;
+    const uint8_t* src = in + sizeof(spb2ZData_t);
+    size_t srcLen, pos = 0, gps = 0;
+    uint32_t zeros, lit;
+
+    if(len < sizeof(spb2ZData_t))
+        return -1;
+
+    memcpy(&hdrBuf, in, sizeof(hdrBuf));
+    if(hdr->header != DATA_ZHEADER || sizeof(spb2ZData_t) + hdr->length > len)
+        return -1;
+
+    if(hdr->flags & EVT_Z_KEYFRAME){
+        memset(z->prev, 0, DATA_GPS_BYTES);
+        z->valid = 1;
+    }else if(!z->valid)
+        return -1;
+
+    srcLen = hdr->length;
+    while(pos < srcLen){
+        if(getVarint(src, srcLen, &pos, &zeros) < 0 || getVarint(src, srcLen, &pos, &lit) < 0 ||
+           gps + zeros + lit > DATA_GPS_BYTES || pos + lit > srcLen){
+            z->valid = 0;
+            return -1;
+        }
+
+        gps += zeros;
+        for(uint32_t i = 0; i < lit; i++, gps++)
+            z->prev[gps] ^= src[pos++];
+    }
+
+    data->header    = DATA_HEADER;
+    data->unixTime  = hdr->unixTime;
+    data->trgCount  = hdr->trgCount;
+    data->gtuCount  = hdr->gtuCount;
+    data->trgFlag   = hdr->trgFlag;
+    data->aliveTime = hdr->aliveTime;
+    data->deadTime  = hdr->deadTime;
+    data->status    = hdr->status;
+    memcpy(data->gpsStr, z->prev, DATA_GPS_BYTES);
+    data->unixNsec  = hdr->unixNsec;
+    data->crc       = hdr->crc;
+
+    if(data->crc != crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32)){
+        z->valid = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+// A record written without evtZEncode() (a reduced one) keeps its place in the
+// keyframe schedule; when it took the place of a keyframe, the next coded
+// record is one so that index entries on it can still be decoded from.
+void evtZSkip(evtZState_t* z){
+    if(z->keyInterval == 0 || z->count % z->keyInterval == 0)
+        z->keyDue = 1;
+
+    z->count++;
+}
+
+// data->crc must already be set, the rest of gpsStr is expected to be zero.
+void evtLiteEncode(const spb2Data_t* data, spb2LData_t* lite){
+    lite->header       = DATA_LHEADER;
+    lite->unixTime     = data->unixTime;
+    lite->trgCount     = data->trgCount;
+    lite->gtuCount     = data->gtuCount;
+    lite->trgFlag      = data->trgFlag;
+    lite->aliveTime    = data->aliveTime;
+    lite->deadTime     = data->deadTime;
+    lite->status       = data->status;
+    lite->imuTimestamp = (uint8_t)data->gpsStr[DATA_GPS_BYTES-3] |
+                         (uint8_t)data->gpsStr[DATA_GPS_BYTES-2] << 8 |
+                         (uint8_t)data->gpsStr[DATA_GPS_BYTES-1] << 16;
+    lite->unixNsec     = data->unixNsec;
+    lite->crc          = data->crc;
+}
+
+// Rebuilds the record reduced in in, -1 if it is damaged.
+int evtLiteDecode(const uint8_t* in, size_t len, spb2Data_t* data){
+    spb2LData_t lite;
+
+    if(len < sizeof(spb2LData_t))
+        return -1;
+
+    memcpy(&lite, in, sizeof(lite));
+    if(lite.header != DATA_LHEADER)
+        return -1;
+
+    memset(data->gpsStr, 0, DATA_GPS_BYTES);
+    data->header    = DATA_HEADER;
+    data->unixTime  = lite.unixTime;
+    data->trgCount  = lite.trgCount;
+    data->gtuCount  = lite.gtuCount;
+    data->trgFlag   = lite.trgFlag;
+    data->aliveTime = lite.aliveTime;
+    data->deadTime  = lite.deadTime;
+    data->status    = lite.status;
+    data->gpsStr[DATA_GPS_BYTES-3] = (char)(lite.imuTimestamp & 0x0000FF);
+    data->gpsStr[DATA_GPS_BYTES-2] = (char)((lite.imuTimestamp & 0x00FF00) >> 8);
+    data->gpsStr[DATA_GPS_BYTES-1] = (char)((lite.imuTimestamp & 0xFF0000) >> 16);
+    data->unixNsec  = lite.unixNsec;
+    data->crc       = lite.crc;
+
+    if(data->crc != crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32))
+        return -1;
+
+    return 0;
+}
+
+// fileNumber and createdTime are left to the writer, they change every file.
+void evtFileHeaderInit(evtFileHeader_t* hdr, uint32_t boardId, uint32_t keyInterval, uint8_t clockSource, const char* software){
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->header           = EVT_FILE_HEADER;
+    hdr->info.version     = EVT_FILE_VERSION;
+    hdr->info.recordSize  = sizeof(spb2Data_t);
+    hdr->info.byteOrder   = EVT_BYTE_ORDER;
+    hdr->info.boardId     = boardId;
+    hdr->info.keyInterval = keyInterval;
+    hdr->info.clockSource = clockSource;
+    hdr->info.nFields     = sizeof(nativeFields)/sizeof(nativeFields[0]);
+    strncpy(hdr->info.software, software, EVT_SOFTWARE_LEN - 1);
+    memcpy(hdr->info.fields, nativeFields, sizeof(nativeFields));
+}
+
+void evtFileHeaderSeal(evtFileHeader_t* hdr){
+    hdr->crc = crc_32((unsigned char *)hdr, sizeof(*hdr)-sizeof(hdr->crc), startCRC32);
+}
+
+int evtFileHeaderWrite(FILE* file, evtFileHeader_t* hdr){
+    evtFileHeaderSeal(hdr);
+
+    return fwrite(hdr, sizeof(*hdr), 1, file) == 1 ? 0 : -1;
+}
+
+int evtFileHeaderParse(const uint8_t* buf, size_t len, evtFileHeader_t* hdr){
+    if(len < sizeof(*hdr))
+        return -1;
+
+    memcpy(hdr, buf, sizeof(*hdr));
+
+    if(hdr->header != EVT_FILE_HEADER ||
+       hdr->crc != crc_32((unsigned char *)hdr, sizeof(*hdr)-sizeof(hdr->crc), startCRC32))
+        return -1;
+
+    return 0;
+}
+
+int evtFileHeaderRead(FILE* file, evtFileHeader_t* hdr){
+    uint8_t buf[sizeof(evtFileHeader_t)];
+
+    if(fseeko(file, 0, SEEK_SET) != 0 || fread(buf, sizeof(buf), 1, file) != 1)
+        return -1;
+
+    return evtFileHeaderParse(buf, sizeof(buf), hdr);
+}
+
+// Whether the records described by hdr can be read as this build's spb2Data_t.
+int evtFileLayoutNative(const evtFileHeader_t* hdr){
+    size_t n = sizeof(nativeFields)/sizeof(nativeFields[0]);
+
+    return hdr->info.version == EVT_FILE_VERSION && hdr->info.recordSize == sizeof(spb2Data_t) &&
+           hdr->info.byteOrder == EVT_BYTE_ORDER && hdr->info.nFields == n &&
+           memcmp(hdr->info.fields, nativeFields, sizeof(nativeFields)) == 0;
+}
+
+// stride must be a multiple of the keyframe interval of compressed files, so
+// that every index entry is a record decoding can start from; offset is where
+// the first record will be, after the file header.
+void evtIndexReset(evtIndex_t* idx, uint32_t stride, uint32_t offset){
+    memset(&idx->summary, 0, sizeof(evtIndexSummary_t));
+    idx->summary.version    = EVT_INDEX_VERSION;
+    idx->summary.recordSize = sizeof(spb2Data_t);
+    idx->summary.stride     = stride > 0 ? stride : EVT_INDEX_STRIDE;
+    idx->summary.nBytes     = offset;
+}
+
+// Called for every record written to the file, length is the number of bytes
+// it takes. When the index is full the stride doubles and every other entry is
+// dropped, so any file size fits.
+void evtIndexAdd(evtIndex_t* idx, const spb2Data_t* data, uint32_t length){
+    evtIndexSummary_t* s = &idx->summary;
+    evtIndexEntry_t* e;
+
+    if(s->nRecords == 0){
+        s->firstTrgCount = data->trgCount;
+        s->firstGtuCount = data->gtuCount;
+        s->firstUnixTime = data->unixTime;
+    }
+
+    s->lastTrgCount = data->trgCount;
+    s->lastGtuCount = data->gtuCount;
+    s->lastUnixTime = data->unixTime;
+
+    if(s->nRecords % s->stride == 0){
+        if(s->nEntries == EVT_INDEX_MAX_ENTRIES){
+            for(uint32_t i = 0; i < EVT_INDEX_MAX_ENTRIES/2; i++)
+                idx->entries[i] = idx->entries[2*i];
+            s->nEntries = EVT_INDEX_MAX_ENTRIES/2;
+            s->stride  *= 2;
+        }
+
+        if(s->nRecords % s->stride == 0){
+            e = &idx->entries[s->nEntries++];
+            e->trgCount = data->trgCount;
+            e->gtuCount = data->gtuCount;
+            e->unixTime = data->unixTime;
+            e->record   = s->nRecords;
+            e->offset   = s->nBytes;
+        }
+    }
+
+    s->nRecords++;
+    s->nBytes += length;
+}
+
+// For what is written between records and is not one (gap markers).
+void evtIndexSkip(evtIndex_t* idx, uint32_t length){
+    idx->summary.nBytes += length;
+}
+
+// Appends the trailer at the current end of file, returns the number of blocks.
+int evtIndexWrite(FILE* file, const evtIndex_t* idx){
+    evtIndexBlock_t blk;
+    size_t len = sizeof(evtIndexSummary_t) + idx->summary.nEntries*sizeof(evtIndexEntry_t);
+    size_t nBlocks = (len + EVT_BLOCK_PAYLOAD - 1)/EVT_BLOCK_PAYLOAD;
+    const uint8_t* src = (const uint8_t*)idx;
+    size_t n;
+
+    if(fseeko(file, 0, SEEK_END) != 0)
+        return -1;
+
+    for(size_t b = 0; b < nBlocks; b++){
+        memset(&blk, 0, sizeof(blk));
+        blk.header  = EVT_INDEX_HEADER;
+        blk.block   = (uint16_t)b;
+        blk.nBlocks = (uint16_t)nBlocks;
+
+        n = len - b*EVT_BLOCK_PAYLOAD;
+        if(n > EVT_BLOCK_PAYLOAD)
+            n = EVT_BLOCK_PAYLOAD;
+        memcpy(blk.payload, src + b*EVT_BLOCK_PAYLOAD, n);
+
+        blk.crc = crc_32((unsigned char *)&blk, sizeof(blk)-sizeof(blk.crc), startCRC32);
+
+        if(fwrite(&blk, sizeof(blk), 1, file) != 1)
+            return -1;
+    }
+
+    return (int)nBlocks;
+}
+
+static int readBlock(FILE* file, off_t offset, evtIndexBlock_t* blk){
+    if(fseeko(file, offset, SEEK_SET) != 0 || fread(blk, sizeof(*blk), 1, file) != 1)
+        return -1;
+
+    if(blk->header != EVT_INDEX_HEADER ||
+       blk->crc != crc_32((unsigned char *)blk, sizeof(*blk)-sizeof(blk->crc), startCRC32))
+        return -1;
+
+    return 0;
+}
+
+// Loads the trailer of file, -1 if it has none or it is damaged.
+int evtIndexRead(FILE* file, evtIndex_t* idx){
+    evtIndexBlock_t blk;
+    uint8_t* dst = (uint8_t*)idx;
+    off_t size, start;
+    size_t len, n;
+
+    if(fseeko(file, 0, SEEK_END) != 0)
+        return -1;
+
+    size = ftello(file);
+    if(size < (off_t)sizeof(blk))
+        return -1;
+
+    if(readBlock(file, size - sizeof(blk), &blk) < 0 || blk.block != blk.nBlocks - 1)
+        return -1;
+
+    start = size - (off_t)blk.nBlocks*sizeof(blk);
+    if(start < 0)
+        return -1;
+
+    len = 0;
+    for(uint16_t b = 0; b < blk.nBlocks; b++){
+        if(readBlock(file, start + (off_t)b*sizeof(blk), &blk) < 0 || blk.block != b)
+            return -1;
+
+        n = sizeof(evtIndex_t) - len;
+        if(n > EVT_BLOCK_PAYLOAD)
+            n = EVT_BLOCK_PAYLOAD;
+        memcpy(dst + len, blk.payload, n);
+        len += n;
+    }
+
+    if(idx->summary.version != EVT_INDEX_VERSION || idx->summary.recordSize != sizeof(spb2Data_t) ||
+       idx->summary.nEntries > EVT_INDEX_MAX_ENTRIES || idx->summary.nBytes != start ||
+       len < sizeof(evtIndexSummary_t) + idx->summary.nEntries*sizeof(evtIndexEntry_t))
+        return -1;
+
+    return 0;
+}
+
+// Whether value lies between the first and last record of the file, readers
+// skip the files where it does not.
+int evtIndexCovers(const evtIndex_t* idx, int key, uint32_t value){
+    evtIndexEntry_t first = {idx->summary.firstTrgCount, idx->summary.firstGtuCount, idx->summary.firstUnixTime, 0, 0};
+    evtIndexEntry_t last  = {idx->summary.lastTrgCount, idx->summary.lastGtuCount, idx->summary.lastUnixTime, 0, 0};
+
+    return keyOf(&first, key) <= value && value <= keyOf(&last, key);
+}
+
+void evtReaderInit(evtReader_t* rd, FILE* file){
+    rd->file = file;
+    evtReaderSeek(rd, 0, 0);
+}
+
+// offset must be the one of a plain record or of a keyframe
+void evtReaderSeek(evtReader_t* rd, int64_t offset, long record){
+    rd->offset = offset;
+    rd->record = record;
+    evtZReset(&rd->z, 0);
+}
+
+void evtGapSeal(evtGap_t* gap){
+    gap->header = DATA_GAP_HEADER;
+    gap->crc    = crc_32((unsigned char *)gap, sizeof(*gap)-sizeof(gap->crc), startCRC32);
+}
+
+// Decodes the record at the start of buf, plain, compressed or reduced, and
+// sets used to the bytes to step over. Returns 0 with a good record in data, 1
+// at the end of the records (end of buf or trailer), 2 for a file header, 3 for
+// a gap marker (copied into data, to be read as an evtGap_t), -1 for a damaged
+// record or marker and -2 when buf does not start with a record header (used
+// is then 1, so callers resynchronise on the next one).
+int evtDecodeNext(const uint8_t* buf, size_t len, evtZState_t* z, spb2Data_t* data, size_t* used){
+    spb2ZData_t hdr;
+
+    *used = 0;
+    if(len < sizeof(uint32_t))
+        return 1;
+
+    memcpy(&hdr.header, buf, sizeof(uint32_t));
+
+    switch(hdr.header){
+        case EVT_INDEX_HEADER:
+            return 1;
+        case EVT_FILE_HEADER:
+            if(len < sizeof(evtFileHeader_t))
+                return 1;
+
+            *used = sizeof(evtFileHeader_t);
+
+            return 2;
+        case DATA_GAP_HEADER:
+            if(len < sizeof(evtGap_t))
+                return 1;
+
+            *used = sizeof(evtGap_t);
+            memcpy(data, buf, sizeof(evtGap_t));
+
+            if(data->crc != crc_32((unsigned char *)data, sizeof(evtGap_t)-sizeof(uint32_t), startCRC32))
+                return -1;
+
+            return 3;
+        case DATA_HEADER:
+            if(len < sizeof(spb2Data_t))
+                return 1;
+
+            *used = sizeof(spb2Data_t);
+            memcpy(data, buf, sizeof(spb2Data_t));
+
+            if(data->crc != crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32))
+                return -1;
+
+            return 0;
+        case DATA_ZHEADER:
+            if(len < sizeof(spb2ZData_t))
+                return 1;
+
+            memcpy(&hdr, buf, sizeof(hdr));
+            if(sizeof(spb2ZData_t) + hdr.length > EVT_Z_MAX_LEN)
+                break;
+            if(len < sizeof(spb2ZData_t) + hdr.length)
+                return 1;
+
+            *used = sizeof(spb2ZData_t) + hdr.length;
+
+            return evtZDecode(z, buf, *used, data);
+        case DATA_LHEADER:
+            if(len < sizeof(spb2LData_t))
+                return 1;
+
+            *used = sizeof(spb2LData_t);
+
+            return evtLiteDecode(buf, *used, data);
+        default:
+            break;
+    }
+
+    *used = 1;
+
+    return -2;
+}
+
+// Reads the next record, same returns as evtDecodeNext but file headers and
+// gap markers are skipped; after a negative one the reader is already past the damaged bytes
+// so the caller can keep reading.
+int evtReaderNext(evtReader_t* rd, spb2Data_t* data){
+    uint32_t words[(EVT_Z_MAX_LEN + 3)/4];
+    size_t len, used;
+    int ret;
+
+    do{
+        if(fseeko(rd->file, rd->offset, SEEK_SET) != 0)
+            return 1;
+
+        len = fread(words, 1, EVT_Z_MAX_LEN, rd->file);
+        ret = evtDecodeNext((const uint8_t*)words, len, &rd->z, data, &used);
+
+        rd->offset += used;
+    }while(ret == 2 || ret == 3);
+
+    if(ret >= -1 && used > 0)
+        rd->record++;
+
+    return ret;
+}
+
+long evtRecordCount(FILE* file){
+    evtIndex_t idx;
+    evtReader_t rd;
+    spb2Data_t data;
+
+    if(evtIndexRead(file, &idx) == 0)
+        return idx.summary.nRecords;
+
+    evtReaderInit(&rd, file);
+    while(evtReaderNext(&rd, &data) <= 0);
+
+    return rd.record;
+}
+
+static int monotonic(const evtIndex_t* idx, int key){
+    for(uint32_t i = 1; i < idx->summary.nEntries; i++)
+        if(keyOf(&idx->entries[i], key) < keyOf(&idx->entries[i-1], key))
+            return 0;
+
+    return evtIndexCovers(idx, key, keyOf(&idx->entries[idx->summary.nEntries-1], key));
+}
+
+// Reads records up to last (-1 for all of them) looking for value.
+static long scan(evtReader_t* rd, long last, int key, uint32_t value, spb2Data_t* data){
+    long r;
+    int ret;
+
+    do{
+        r = rd->record;
+        ret = evtReaderNext(rd, data);
+        if(ret == 0 && recordKey(data, key) == value)
+            return r;
+    }while(ret <= 0 && (last < 0 || rd->record <= last));
+
+    return -1;
+}
+
+// Returns the first record of file whose key equals value and reads it into
+// data, -1 if there is none. With an index only the stride around the binary
+// search result is read; counters reset during the file fall back to a scan.
+long evtIndexFind(FILE* file, const evtIndex_t* idx, int key, uint32_t value, spb2Data_t* data){
+    evtReader_t rd;
+    long lo, hi, mid, r;
+
+    evtReaderInit(&rd, file);
+
+    if(idx == NULL || idx->summary.nEntries == 0)
+        return scan(&rd, -1, key, value, data);
+
+    if(monotonic(idx, key) && !evtIndexCovers(idx, key, value))
+        return -1;
+
+    // first entry with key >= value, the match is between it and the previous one
+    lo = 0;
+    hi = idx->summary.nEntries;
+    while(lo < hi){
+        mid = (lo + hi)/2;
+        if(keyOf(&idx->entries[mid], key) < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo > 0)
+        evtReaderSeek(&rd, idx->entries[lo - 1].offset, idx->entries[lo - 1].record);
+
+    r = scan(&rd, lo < (long)idx->summary.nEntries ? (long)idx->entries[lo].record : -1, key, value, data);
+    if(r >= 0 || monotonic(idx, key))
+        return r;
+
+    evtReaderSeek(&rd, 0, 0);
+
+    return scan(&rd, -1, key, value, data);
+}
+
+void evtIndexEnable(int enable){
+    __atomic_store_n(&indexRequest, enable, __ATOMIC_RELAXED);
+}
+
+int evtIndexEnabled(void){
+    return __atomic_load_n(&indexRequest, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,313 @@
+#ifndef EVENTFILE_H_
+#define EVENTFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DATA_HEADER      0x424B4C43
+#define DATA_BYTES       512
+#define DATA_NUMERICS    6
+#define DATA_WORDS       (DATA_BYTES/4)
+#define DATA_GPS_BYTES   (DATA_BYTES-(DATA_NUMERICS*4))
+
+#define DATA_ZHEADER     0x5A4B4C43
+#define DATA_LHEADER     0x4C4B4C43
+#define DATA_GAP_HEADER  0x50414743
+#define ATT_HEADER       0x54544143
+#define EVT_Z_KEYFRAME   0x01
+#define EVT_Z_MAX_LEN    (sizeof(spb2ZData_t) + 2*DATA_GPS_BYTES)
+
+#define EVT_FILE_HEADER       0x464B4C43
+#define EVT_FILE_VERSION      1
+#define EVT_BYTE_ORDER        0x01020304
+#define EVT_FIELDS_MAX        16
+#define EVT_FIELD_NAME_LEN    12
+#define EVT_SOFTWARE_LEN      32
+
+#define EVT_TYPE_U32          1
+#define EVT_TYPE_CHAR         2
+#define EVT_TYPE_U24          3
+
+#define EVT_CLOCK_SYSTEM      0
+#define EVT_CLOCK_TIMESVC     1
+#define EVT_CLOCK_GTU         2
+
+#define EVT_INDEX_HEADER      0x58444E49
+#define EVT_INDEX_VERSION     1
+#define EVT_INDEX_STRIDE      4
+#define EVT_INDEX_MAX_ENTRIES 256
+
+#define EVT_GAP_DROPPED  1
+#define EVT_GAP_DEGRADED 2
+#define EVT_GAP_UPSTREAM 3
+
+#define EVT_KEY_TRG  0
+#define EVT_KEY_GTU  1
+#define EVT_KEY_TIME 2
+
+typedef struct spb2Data{
+    uint32_t     header;
+    uint32_t     unixTime;
+    uint32_t     trgCount;
+    uint32_t     gtuCount;
+    uint32_t     trgFlag;
+    uint32_t     aliveTime;
+    uint32_t     deadTime;
+    uint32_t     status;
+    char         gpsStr[DATA_GPS_BYTES];
+    uint32_t     unixNsec;
+    unsigned int crc;
+} spb2Data_t;
+
+// First block of every event file, as big as a record so plain files without
+// reduced records keep records at multiples of sizeof(spb2Data_t). It starts with EVT_FILE_HEADER
+// and ends with its own CRC like the index trailer. byteOrder is EVT_BYTE_ORDER
+// in the writer's byte order and fields describes where each record field is,
+// so readers built for another layout can still find them.
+typedef struct evtField{
+    char     name[EVT_FIELD_NAME_LEN];
+    uint16_t offset;
+    uint16_t size;
+    uint8_t  type;
+    uint8_t  reserved[3];
+} evtField_t;
+
+// GTU clock model the records of the file were stamped with (clockSource
+// EVT_CLOCK_GTU): the time of GTU count g is refSec.refNsec plus
+// (int32_t)(g - refGtu) ticks of tickNs + tickFrac/2^32 ns. The residuals are
+// those of the fit when the file was opened, zero without a model.
+typedef struct evtClockInfo{
+    uint32_t refGtu;
+    uint32_t refSec;
+    uint32_t refNsec;
+    uint32_t tickNs;
+    uint32_t tickFrac;
+    uint32_t nSamples;
+    uint32_t nPps;
+    uint32_t rmsNs;
+    uint32_t ppsRmsNs;
+    uint32_t maxNs;
+} evtClockInfo_t;
+
+typedef struct evtFileInfo{
+    uint16_t   version;
+    uint16_t   recordSize;
+    uint32_t   byteOrder;
+    uint32_t   boardId;
+    uint32_t   runNumber;
+    uint32_t   fileNumber;
+    uint32_t   createdTime;
+    uint32_t   keyInterval;
+    uint8_t    clockSource;
+    uint8_t    nFields;
+    uint8_t    reserved[2];
+    char       software[EVT_SOFTWARE_LEN];
+    evtField_t fields[EVT_FIELDS_MAX];
+    evtClockInfo_t clock;
+} evtFileInfo_t;
+
+typedef struct evtFileHeader{
+    uint32_t      header;
+    evtFileInfo_t info;
+    uint8_t       reserved[sizeof(spb2Data_t) - sizeof(evtFileInfo_t) - 2*sizeof(uint32_t)];
+    uint32_t      crc;
+} evtFileHeader_t;
+
+// Attitude at trigger time, one per event, in a sidecar file next to the event
+// file (same name with the .att extension) so the event record is unchanged.
+// flags are the IMU_HIST_* result of the lookup: with IMU_HIST_NONE there was
+// no attitude and quat is the identity.
+typedef struct spb2Att{
+    uint32_t     header;
+    uint32_t     trgCount;
+    uint32_t     gtuCount;
+    uint32_t     imuTimestamp;
+    uint64_t     eventTime;
+    uint32_t     flags;
+    float        quat[4];
+    unsigned int crc;
+} spb2Att_t;
+
+// Marker written in the record stream where events are missing, as big as a
+// record and with its own CRC. DROPPED: nEvents events with the given counters
+// were dropped by the write queue of the daemon. UPSTREAM: the trigger counter
+// jumped, nEvents triggers between first and last were lost before the daemon
+// read them (no GTU counts). DEGRADED: the next nEvents records of the file
+// were reduced by the write queue to their numeric fields (spb2LData_t).
+// first/last are the counters of the oldest and newest of the events: the
+// ranges of a DROPPED and an UPSTREAM marker before the same record can
+// interleave, the record follows the highest last. unixTime/unixNsec are those
+// of the record that follows the marker, policy the overload policy of the
+// queue at the time.
+typedef struct evtGap{
+    uint32_t header;
+    uint32_t kind;
+    uint32_t nEvents;
+    uint32_t firstTrgCount;
+    uint32_t lastTrgCount;
+    uint32_t firstGtuCount;
+    uint32_t lastGtuCount;
+    uint32_t unixTime;
+    uint32_t unixNsec;
+    uint32_t policy;
+    uint8_t  reserved[sizeof(spb2Data_t) - 11*sizeof(uint32_t)];
+    uint32_t crc;
+} evtGap_t;
+
+// Compressed record: the numeric fields as they are, followed by length bytes
+// of gpsStr XORed with the previous record's one (with zeros in keyframes) and
+// coded as pairs of varints (zero run, literal run) plus the literal bytes.
+// crc is the one of the uncompressed spb2Data_t.
+typedef struct spb2ZData{
+    uint32_t     header;
+    uint16_t     length;
+    uint8_t      flags;
+    uint8_t      reserved;
+    uint32_t     unixTime;
+    uint32_t     trgCount;
+    uint32_t     gtuCount;
+    uint32_t     trgFlag;
+    uint32_t     aliveTime;
+    uint32_t     deadTime;
+    uint32_t     status;
+    uint32_t     unixNsec;
+    unsigned int crc;
+} spb2ZData_t;
+
+// Reduced record of an event the write queue kept without gpsStr: the numeric
+// fields and the IMU timestamp of the last three gpsStr bytes. It decodes to a
+// spb2Data_t with the rest of gpsStr zero, crc is the one of that record.
+typedef struct spb2LData{
+    uint32_t     header;
+    uint32_t     unixTime;
+    uint32_t     trgCount;
+    uint32_t     gtuCount;
+    uint32_t     trgFlag;
+    uint32_t     aliveTime;
+    uint32_t     deadTime;
+    uint32_t     status;
+    uint32_t     imuTimestamp;
+    uint32_t     unixNsec;
+    unsigned int crc;
+} spb2LData_t;
+
+typedef struct evtZState{
+    uint8_t  prev[DATA_GPS_BYTES];
+    uint32_t keyInterval;
+    uint32_t count;
+    uint8_t  valid;
+    uint8_t  keyDue;
+} evtZState_t;
+
+// Optional trailer written when an event file is closed: a summary of the file
+// and a sparse index (one entry every stride records) packed into blocks of the
+// same size as spb2Data_t. Every block starts with EVT_INDEX_HEADER instead of
+// DATA_HEADER and carries its own CRC, so readers that walk the file record by
+// record see the trailer as records to ignore, and readers that know about it
+// find it by reading the last record-sized block only.
+typedef struct evtIndexEntry{
+    uint32_t trgCount;
+    uint32_t gtuCount;
+    uint32_t unixTime;
+    uint32_t record;
+    uint32_t offset;
+} evtIndexEntry_t;
+
+typedef struct evtIndexSummary{
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t nRecords;
+    uint32_t nBytes;
+    uint32_t stride;
+    uint32_t nEntries;
+    uint32_t firstTrgCount;
+    uint32_t lastTrgCount;
+    uint32_t firstGtuCount;
+    uint32_t lastGtuCount;
+    uint32_t firstUnixTime;
+    uint32_t lastUnixTime;
+} evtIndexSummary_t;
+
+#define EVT_BLOCK_PAYLOAD (sizeof(spb2Data_t) - 3*sizeof(uint32_t))
+
+typedef struct evtIndexBlock{
+    uint32_t header;
+    uint16_t block;
+    uint16_t nBlocks;
+    uint8_t  payload[EVT_BLOCK_PAYLOAD];
+    uint32_t crc;
+} evtIndexBlock_t;
+
+typedef struct evtIndex{
+    evtIndexSummary_t summary;
+    evtIndexEntry_t   entries[EVT_INDEX_MAX_ENTRIES];
+} evtIndex_t;
+
+// Archive of closed event files (clkbarchive): the files one after the other,
+// byte for byte, then a table of contents and a footer at the very end.
+#define ARC_FOOTER_HEADER     0x434F5443
+#define ARC_VERSION           1
+#define ARC_NAME_LEN          48
+#define ARC_MEMBER_UNVERIFIED 0x01
+
+typedef struct arcTocEntry{
+    char     name[ARC_NAME_LEN];
+    uint64_t offset;
+    uint64_t length;
+    uint32_t nRecords;
+    uint32_t nBad;
+    uint32_t firstTrgCount;
+    uint32_t lastTrgCount;
+    uint32_t flags;
+    uint32_t reserved;
+} arcTocEntry_t;
+
+typedef struct arcFooter{
+    uint32_t header;
+    uint32_t version;
+    uint64_t tocOffset;
+    uint32_t nEntries;
+    uint32_t tocCrc;
+    uint32_t reserved;
+    uint32_t crc;
+} arcFooter_t;
+
+typedef struct evtReader{
+    FILE*       file;
+    int64_t     offset;
+    long        record;
+    evtZState_t z;
+} evtReader_t;
+
+void evtZReset(evtZState_t* z, uint32_t keyInterval);
+size_t evtZEncode(evtZState_t* z, const spb2Data_t* data, uint8_t* out);
+int evtZDecode(evtZState_t* z, const uint8_t* in, size_t len, spb2Data_t* data);
+void evtZSkip(evtZState_t* z);
+void evtLiteEncode(const spb2Data_t* data, spb2LData_t* lite);
+int evtLiteDecode(const uint8_t* in, size_t len, spb2Data_t* data);
+
+void evtFileHeaderInit(evtFileHeader_t* hdr, uint32_t boardId, uint32_t keyInterval, uint8_t clockSource, const char* software);
+void evtFileHeaderSeal(evtFileHeader_t* hdr);
+int evtFileHeaderWrite(FILE* file, evtFileHeader_t* hdr);
+int evtFileHeaderParse(const uint8_t* buf, size_t len, evtFileHeader_t* hdr);
+int evtFileHeaderRead(FILE* file, evtFileHeader_t* hdr);
+int evtFileLayoutNative(const evtFileHeader_t* hdr);
+
+void evtIndexReset(evtIndex_t* idx, uint32_t stride, uint32_t offset);
+void evtIndexAdd(evtIndex_t* idx, const spb2Data_t* data, uint32_t length);
+void evtIndexSkip(evtIndex_t* idx, uint32_t length);
+int evtIndexWrite(FILE* file, const evtIndex_t* idx);
+int evtIndexRead(FILE* file, evtIndex_t* idx);
+int evtIndexCovers(const evtIndex_t* idx, int key, uint32_t value);
+long evtIndexFind(FILE* file, const evtIndex_t* idx, int key, uint32_t value, spb2Data_t* data);
+void evtIndexEnable(int enable);
+int evtIndexEnabled(void);
+
+void evtGapSeal(evtGap_t* gap);
+int evtDecodeNext(const uint8_t* buf, size_t len, evtZState_t* z, spb2Data_t* data, size_t* used);
+void evtReaderInit(evtReader_t* rd, FILE* file);
+void evtReaderSeek(evtReader_t* rd, int64_t offset, long record);
+int evtReaderNext(evtReader_t* rd, spb2Data_t* data);
+long evtRecordCount(FILE* file);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "eventfile.h"
+#include "crc32.h"
+
+// Compression ratio and speed of the compressed event records ("-z" option of
+// ethCmd) on recorded event files or on synthetic NMEA records.
+//
+//   evtbench [-k keyframes] [-n records] [event file ...]
+//
+// Output is CSV on stdout, one line per keyframe interval, preceded by a '#'
+// line with the source description:
+//   keyframes,records,raw_bytes,z_bytes,ratio,enc_MB_s,dec_MB_s
+// MB/s are of uncompressed records; every record is decoded back and compared
+// with the original before timing.
+
+#define BENCH_RECORDS 10000
+#define BENCH_MIN_NS  200000000ULL
+
+static const uint32_t keyIntervals[] = {1, 4, 16, 64};
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void synthRecord(spb2Data_t* data, uint32_t i){
+    uint32_t sec = 43200 + i/3;
+    uint32_t imuTimestamp = i*9973;
+
+    memset(data, 0, sizeof(*data));
+    data->header    = DATA_HEADER;
+    data->unixTime  = 1700000000 + i/3;
+    data->unixNsec  = (i*333333333u + (i*7919)%100000)%1000000000u;
+    data->trgCount  = i;
+    data->gtuCount  = i*4000 + (i*7919)%4000;
+    data->trgFlag   = 1 << (i%3);
+    data->aliveTime = i*1200;
+    data->deadTime  = i*37;
+    data->status    = 0x00000011;
+
+    snprintf(data->gpsStr, DATA_GPS_BYTES,
+             "$GPGGA,%02u%02u%02u.00,4124.%04u,N,00208.%04u,E,1,08,0.9,%u.%u,M,46.9,M,,*47\r\n"
+             "$GPRMC,%02u%02u%02u.00,A,4124.%04u,N,00208.%04u,E,0.%03u,054.7,191026,,,A*6A\r\n",
+             sec/3600, (sec/60)%60, sec%60, 8961 + (i*13)%7, 3412 + (i*29)%5, 545 + (i*3)%4, i%10,
+             sec/3600, (sec/60)%60, sec%60, 8961 + (i*13)%7, 3412 + (i*29)%5, (i*151)%1000);
+
+    data->gpsStr[DATA_GPS_BYTES-3] = (char)(imuTimestamp & 0x0000FF);
+    data->gpsStr[DATA_GPS_BYTES-2] = (char)((imuTimestamp & 0x00FF00) >> 8);
+    data->gpsStr[DATA_GPS_BYTES-1] = (char)((imuTimestamp & 0xFF0000) >> 16);
+
+    data->crc = crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32);
+}
+
+static int loadFile(const char* path, spb2Data_t* records, size_t maxRecords, size_t* nRecords){
+    evtReader_t rd;
+    FILE* file = fopen(path, "rb");
+    int ret;
+
+    if(file == NULL){
+        fprintf(stderr,"\tERR: cannot open %s\n", path);
+        return -1;
+    }
+
+    evtReaderInit(&rd, file);
+    while(*nRecords < maxRecords && (ret = evtReaderNext(&rd, &records[*nRecords])) <= 0)
+        if(ret == 0)
+            (*nRecords)++;
+
+    fclose(file);
+
+    return 0;
+}
+
+static size_t encodeAll(const spb2Data_t* records, size_t n, uint32_t keyInterval, uint8_t* out, size_t* offsets){
+    evtZState_t z;
+    size_t len = 0;
+
+    evtZReset(&z, keyInterval);
+    for(size_t i = 0; i < n; i++){
+        offsets[i] = len;
+        len += evtZEncode(&z, &records[i], out + len);
+    }
+    offsets[n] = len;
+
+    return len;
+}
+
+static int decodeAll(const uint8_t* in, const size_t* offsets, size_t n, spb2Data_t* out){
+    evtZState_t z;
+    int bad = 0;
+
+    evtZReset(&z, 0);
+    for(size_t i = 0; i < n; i++)
+        bad += evtZDecode(&z, in + offsets[i], offsets[i+1] - offsets[i], &out[i]) < 0;
+
+    return bad;
+}
+
+static int bench(const spb2Data_t* records, size_t n, uint32_t keyInterval){
+    uint8_t* zData = malloc(n*EVT_Z_MAX_LEN);
+    size_t* offsets = malloc((n + 1)*sizeof(size_t));
+    spb2Data_t* decoded = malloc(n*sizeof(spb2Data_t));
+    size_t raw = n*sizeof(spb2Data_t), zLen = 0;
+    uint64_t start, encNs, decNs, rounds;
+
+    if(zData == NULL || offsets == NULL || decoded == NULL){
+        fprintf(stderr,"\tERR: out of memory\n");
+        return -1;
+    }
+
+    zLen = encodeAll(records, n, keyInterval, zData, offsets);
+    if(decodeAll(zData, offsets, n, decoded) != 0 || memcmp(records, decoded, raw) != 0){
+        fprintf(stderr,"\tERR: round trip mismatch with keyframes %u\n", keyInterval);
+        return -1;
+    }
+
+    start = nowNs();
+    for(rounds = 0; (encNs = nowNs() - start) < BENCH_MIN_NS; rounds++)
+        encodeAll(records, n, keyInterval, zData, offsets);
+    encNs /= rounds;
+
+    start = nowNs();
+    for(rounds = 0; (decNs = nowNs() - start) < BENCH_MIN_NS; rounds++)
+        decodeAll(zData, offsets, n, decoded);
+    decNs /= rounds;
+
+    printf("%u,%zu,%zu,%zu,%.2f,%.1f,%.1f\n", keyInterval, n, raw, zLen, (double)raw/zLen,
+           raw*1e3/encNs, raw*1e3/decNs);
+
+    free(zData);
+    free(offsets);
+    free(decoded);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    spb2Data_t* records;
+    size_t maxRecords = BENCH_RECORDS;
+    size_t nRecords = 0;
+    uint32_t keyInterval = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "k:n:")) != -1){
+        switch(opt){
+            case 'k':
+                keyInterval = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                maxRecords = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr,"Usage: %s [-k keyframes] [-n records] [event file ...]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if(maxRecords == 0)
+        maxRecords = BENCH_RECORDS;
+
+    records = malloc(maxRecords*sizeof(spb2Data_t));
+    if(records == NULL){
+        fprintf(stderr,"\tERR: out of memory\n");
+        return -1;
+    }
+
+    if(optind < argc){
+        for(int i = optind; i < argc; i++)
+            if(loadFile(argv[i], records, maxRecords, &nRecords) < 0)
+                return -1;
+    }else{
+        for(nRecords = 0; nRecords < maxRecords; nRecords++)
+            synthRecord(&records[nRecords], nRecords);
+    }
+
+    if(nRecords == 0){
+        fprintf(stderr,"\tERR: no valid records\n");
+        return -1;
+    }
+
+    printf("# evtbench source=%s files=%d compiler=\"%s\"\n",
+           optind < argc ? argv[optind] : "synthetic", optind < argc ? argc - optind : 0, __VERSION__);
+    printf("keyframes,records,raw_bytes,z_bytes,ratio,enc_MB_s,dec_MB_s\n");
+
+    if(keyInterval > 0)
+        return bench(records, nRecords, keyInterval) < 0 ? -1 : 0;
+
+    for(size_t i = 0; i < sizeof(keyIntervals)/sizeof(keyIntervals[0]); i++)
+        if(bench(records, nRecords, keyIntervals[i]) < 0)
+            return -1;
+
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "evtqueue.h"
+
+// Bounded queue between the acquisition thread, which pushes every event read
+// from the FIFO, and the storage thread, which writes them. What happens to a
+// push with the queue full depends on the policy:
+//   BLOCK        the acquisition waits for room, and for the lite ring to
+//                drain, so nothing is lost (the FPGA FIFO fills instead)
+//   DROP_NEWEST  the pushed event is dropped
+//   DROP_OLDEST  the oldest queued event is dropped to make room
+//   DEGRADE      the event is kept in a second, larger ring without gpsStr
+// Dropped events are merged into the gap of the next item that is kept, so
+// the storage thread can mark them in the files in trigger order.
+//
+// Items are popped in push order: the full ring first, then the lite ring,
+// and while the lite ring is not empty new pushes go to it too (but under
+// BLOCK). Close items are never dropped, with no room they wait like BLOCK.
+typedef struct evtQueueLite{
+    uint8_t       type;
+    uint64_t      eventTime;
+    uint32_t      trgCount;
+    uint32_t      gtuCount;
+    uint32_t      trgFlag;
+    uint32_t      aliveTime;
+    uint32_t      deadTime;
+    uint32_t      status;
+    uint32_t      imuTimestamp;
+    spb2Att_t     att;
+    evtQueueGap_t dropped;
+    evtQueueGap_t upstream;
+} evtQueueLite_t;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  notEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  notFull = PTHREAD_COND_INITIALIZER;
+static evtQueueItem_t* ring;
+static evtQueueLite_t* lite;
+static uint32_t        ringLen, liteLen;
+// head..tail-1 are queued
+static uint32_t        head, tail, liteHead, liteTail;
+// lost after the last kept item
+static evtQueueGap_t   pending, pendingUpstream;
+static evtQueueStats_t stats;
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// to is the later of the two gaps
+void evtQueueGapMerge(evtQueueGap_t* to, const evtQueueGap_t* from){
+    if(from->nEvents == 0)
+        return;
+
+    if(to->nEvents == 0){
+        *to = *from;
+        return;
+    }
+
+    to->nEvents      += from->nEvents;
+    to->firstTrgCount = from->firstTrgCount;
+    to->firstGtuCount = from->firstGtuCount;
+}
+
+static void addEvent(evtQueueGap_t* gap, uint32_t trgCount, uint32_t gtuCount){
+    evtQueueGap_t one = {1, trgCount, trgCount, gtuCount, gtuCount};
+
+    evtQueueGapMerge(&one, gap);
+    *gap = one;
+}
+
+// under queueLock, the item and what it carried go to the gaps of the next one
+static void dropItem(const evtQueueItem_t* item, evtQueueGap_t* dropped, evtQueueGap_t* upstream){
+    evtQueueGap_t gap = item->dropped;
+
+    addEvent(&gap, item->data.trgCount, item->data.gtuCount);
+    evtQueueGapMerge(dropped, &gap);
+    evtQueueGapMerge(upstream, &item->upstream);
+    stats.dropped++;
+}
+
+static void toLite(evtQueueLite_t* l, const evtQueueItem_t* item){
+    l->type      = item->type;
+    l->eventTime = item->eventTime;
+    l->trgCount  = item->data.trgCount;
+    l->gtuCount  = item->data.gtuCount;
+    l->trgFlag   = item->data.trgFlag;
+    l->aliveTime = item->data.aliveTime;
+    l->deadTime  = item->data.deadTime;
+    l->status    = item->data.status;
+    l->imuTimestamp = (uint8_t)item->data.gpsStr[DATA_GPS_BYTES-3] |
+                      (uint8_t)item->data.gpsStr[DATA_GPS_BYTES-2] << 8 |
+                      (uint8_t)item->data.gpsStr[DATA_GPS_BYTES-1] << 16;
+    l->att       = item->att;
+    l->dropped   = item->dropped;
+    l->upstream  = item->upstream;
+}
+
+static void fromLite(evtQueueItem_t* item, const evtQueueLite_t* l){
+    memset(item, 0, sizeof(*item));
+    item->type      = l->type;
+    item->degraded  = l->type == EVT_ITEM_EVENT;
+    item->eventTime = l->eventTime;
+    item->data.header    = DATA_HEADER;
+    item->data.trgCount  = l->trgCount;
+    item->data.gtuCount  = l->gtuCount;
+    item->data.trgFlag   = l->trgFlag;
+    item->data.aliveTime = l->aliveTime;
+    item->data.deadTime  = l->deadTime;
+    item->data.status    = l->status;
+    item->data.gpsStr[DATA_GPS_BYTES-3] = (char)(l->imuTimestamp & 0x0000FF);
+    item->data.gpsStr[DATA_GPS_BYTES-2] = (char)((l->imuTimestamp & 0x00FF00) >> 8);
+    item->data.gpsStr[DATA_GPS_BYTES-1] = (char)((l->imuTimestamp & 0xFF0000) >> 16);
+    item->att       = l->att;
+    item->dropped   = l->dropped;
+    item->upstream  = l->upstream;
+}
+
+int evtQueueInit(uint32_t len, uint8_t policy){
+    if(len < 2)
+        len = 2;
+
+    free(ring);
+    free(lite);
+
+    ring = malloc(len*sizeof(evtQueueItem_t));
+    lite = malloc(len*EVT_QUEUE_LITE_RATIO*sizeof(evtQueueLite_t));
+    if(ring == NULL || lite == NULL)
+        return -1;
+
+    pthread_mutex_lock(&queueLock);
+    ringLen = len;
+    liteLen = len*EVT_QUEUE_LITE_RATIO;
+    head = tail = liteHead = liteTail = 0;
+    memset(&pending, 0, sizeof(pending));
+    memset(&pendingUpstream, 0, sizeof(pendingUpstream));
+    memset(&stats, 0, sizeof(stats));
+    stats.len    = len;
+    stats.policy = policy;
+    pthread_mutex_unlock(&queueLock);
+
+    return 0;
+}
+
+// Returns 0 when the item was queued whole, 1 when it was queued without
+// gpsStr and -1 when it was dropped.
+int evtQueuePush(evtQueueItem_t* item){
+    int isEvent = item->type == EVT_ITEM_EVENT;
+    evtQueueItem_t* victim;
+    uint64_t start = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&queueLock);
+
+    if(isEvent){
+        stats.pushed++;
+        stats.upstream += item->upstream.nEvents;
+    }
+
+    evtQueueGapMerge(&item->dropped, &pending);
+    evtQueueGapMerge(&item->upstream, &pendingUpstream);
+    memset(&pending, 0, sizeof(pending));
+    memset(&pendingUpstream, 0, sizeof(pendingUpstream));
+
+    if(isEvent && stats.policy == EVT_QUEUE_BLOCK){
+        // events left in the lite ring by DEGRADE go first, this one is kept whole
+        if(liteHead != liteTail || tail - head == ringLen){
+            stats.blocked++;
+            start = nowNs();
+            while(liteHead != liteTail || tail - head == ringLen)
+                pthread_cond_wait(&notFull, &queueLock);
+            stats.blockedNs += nowNs() - start;
+        }
+    }else if(liteHead == liteTail && tail - head == ringLen && !(isEvent && stats.policy == EVT_QUEUE_DEGRADE)){
+        victim = &ring[head % ringLen];
+
+        if(!isEvent){
+            stats.blocked++;
+            start = nowNs();
+            while(tail - head == ringLen)
+                pthread_cond_wait(&notFull, &queueLock);
+            stats.blockedNs += nowNs() - start;
+        }else if(stats.policy == EVT_QUEUE_DROP_NEWEST || victim->type != EVT_ITEM_EVENT){
+            dropItem(item, &pending, &pendingUpstream);
+            pthread_mutex_unlock(&queueLock);
+            return -1;
+        }else{
+            // the new head follows the victim
+            dropItem(victim, &ring[(head + 1) % ringLen].dropped, &ring[(head + 1) % ringLen].upstream);
+            head++;
+        }
+    }
+
+    if(liteHead == liteTail && tail - head < ringLen){
+        ring[tail % ringLen] = *item;
+        tail++;
+    }else{
+        while(!isEvent && liteTail - liteHead == liteLen)
+            pthread_cond_wait(&notFull, &queueLock);
+
+        if(liteTail - liteHead == liteLen){
+            dropItem(item, &pending, &pendingUpstream);
+            pthread_mutex_unlock(&queueLock);
+            return -1;
+        }
+
+        toLite(&lite[liteTail % liteLen], item);
+        liteTail++;
+        stats.degraded += isEvent;
+        ret = isEvent;
+    }
+
+    if(tail - head > stats.maxDepth)
+        stats.maxDepth = tail - head;
+
+    pthread_cond_signal(&notEmpty);
+    pthread_mutex_unlock(&queueLock);
+
+    return ret;
+}
+
+// Waits for the next item. For a degraded event, returns how many of the next
+// events, this one included and at most limit, are degraded too (they follow
+// without a close item in between); run gets their counters.
+uint32_t evtQueuePop(evtQueueItem_t* item, uint32_t limit, evtQueueGap_t* run){
+    evtQueueLite_t* l;
+    uint32_t n = 0;
+
+    pthread_mutex_lock(&queueLock);
+
+    while(head == tail && liteHead == liteTail)
+        pthread_cond_wait(&notEmpty, &queueLock);
+
+    if(head != tail){
+        *item = ring[head % ringLen];
+        head++;
+    }else{
+        fromLite(item, &lite[liteHead % liteLen]);
+        liteHead++;
+
+        if(item->degraded){
+            memset(run, 0, sizeof(*run));
+            addEvent(run, item->data.trgCount, item->data.gtuCount);
+            for(n = 1; n < limit && liteHead + n - 1 != liteTail; n++){
+                l = &lite[(liteHead + n - 1) % liteLen];
+                if(l->type != EVT_ITEM_EVENT)
+                    break;
+                run->nEvents++;
+                run->lastTrgCount = l->trgCount;
+                run->lastGtuCount = l->gtuCount;
+            }
+        }
+    }
+
+    if(item->type == EVT_ITEM_EVENT)
+        stats.popped++;
+
+    pthread_cond_broadcast(&notFull);
+    pthread_mutex_unlock(&queueLock);
+
+    return n;
+}
+
+void evtQueueSetPolicy(uint8_t policy){
+    pthread_mutex_lock(&queueLock);
+    stats.policy = policy;
+    pthread_mutex_unlock(&queueLock);
+}
+
+void evtQueueGetStats(evtQueueStats_t* s){
+    pthread_mutex_lock(&queueLock);
+    *s = stats;
+    s->depth     = tail - head;
+    s->liteDepth = liteTail - liteHead;
+    pthread_mutex_unlock(&queueLock);
+}
+
+static const char* policyNames[] = {"block", "drop-newest", "drop-oldest", "degrade"};
+
+const char* evtQueuePolicyName(uint8_t policy){
+    return policy <= EVT_QUEUE_DEGRADE ? policyNames[policy] : "unknown";
+}
+
+// -1 for an unknown name
+int evtQueuePolicyParse(const char* name){
+    for(int i = 0; i <= EVT_QUEUE_DEGRADE; i++)
+        if(strcmp(name, policyNames[i]) == 0)
+            return i;
+
+    return -1;
+}
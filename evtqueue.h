@@ -0,0 +1,65 @@
+#ifndef EVTQUEUE_H_
+#define EVTQUEUE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "eventfile.h"
+
+#define EVT_QUEUE_BLOCK       0
+#define EVT_QUEUE_DROP_NEWEST 1
+#define EVT_QUEUE_DROP_OLDEST 2
+#define EVT_QUEUE_DEGRADE     3
+
+#define EVT_QUEUE_LEN         256
+// header-only events kept for every full one under EVT_QUEUE_DEGRADE
+#define EVT_QUEUE_LITE_RATIO  4
+
+#define EVT_ITEM_EVENT        0
+#define EVT_ITEM_CLOSE        1
+
+// Events missing just before an item, first/last are the counters of the
+// oldest and newest of them.
+typedef struct evtQueueGap{
+    uint32_t nEvents;
+    uint32_t firstTrgCount;
+    uint32_t lastTrgCount;
+    uint32_t firstGtuCount;
+    uint32_t lastGtuCount;
+} evtQueueGap_t;
+
+// EVT_ITEM_CLOSE asks the storage side to close the current files (end of run).
+typedef struct evtQueueItem{
+    uint8_t       type;
+    uint8_t       degraded;
+    uint64_t      eventTime;
+    spb2Data_t    data;
+    spb2Att_t     att;
+    evtQueueGap_t dropped;
+    evtQueueGap_t upstream;
+} evtQueueItem_t;
+
+typedef struct evtQueueStats{
+    uint8_t  policy;
+    uint32_t len;
+    uint32_t depth;
+    uint32_t liteDepth;
+    uint32_t maxDepth;
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t dropped;
+    uint64_t degraded;
+    uint64_t upstream;
+    uint64_t blocked;
+    uint64_t blockedNs;
+} evtQueueStats_t;
+
+void evtQueueGapMerge(evtQueueGap_t* to, const evtQueueGap_t* from);
+int evtQueueInit(uint32_t len, uint8_t policy);
+int evtQueuePush(evtQueueItem_t* item);
+uint32_t evtQueuePop(evtQueueItem_t* item, uint32_t limit, evtQueueGap_t* run);
+void evtQueueSetPolicy(uint8_t policy);
+void evtQueueGetStats(evtQueueStats_t* stats);
+const char* evtQueuePolicyName(uint8_t policy);
+int evtQueuePolicyParse(const char* name);
+
+#endif
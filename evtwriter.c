@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <linux/falloc.h>
+#include "evtwriter.h"
+#include "uring.h"
+
+#define URING_FILES   4
+#define URING_ENTRIES (2*EVT_WRITER_DEPTH)
+
+#define OP_WRITE      1
+#define OP_FALLOC     2
+#define OP_FSYNC      3
+
+#define USER_DATA(op, file, slot) (((uint64_t)(op) << 32) | ((uint64_t)(file) << 16) | (uint64_t)(slot))
+
+// The io_uring backend cycles through a few registered file slots, so that new
+// files can be opened while the data syncs of the previous ones run; the
+// descriptor of a file is closed when its last operation completes.
+typedef struct evtUring{
+    uring_t  ring;
+    uint8_t* bufs;
+    uint16_t freeSlots[EVT_WRITER_DEPTH];
+    uint32_t nFree;
+    uint32_t lengths[EVT_WRITER_DEPTH];
+    int      fds[URING_FILES];
+    uint32_t inFlight[URING_FILES];
+    uint32_t writesInFlight[URING_FILES];
+    uint8_t  closing[URING_FILES];
+    // end of the FALLOC_FL_KEEP_SIZE preallocation, 0 without one
+    uint64_t preallocEnd[URING_FILES];
+    char     paths[URING_FILES][EVT_WRITER_PATH_LEN];
+    int      cur;
+    int      next;
+    uint8_t  fixedBufs;
+    uint8_t  fixedFiles;
+} evtUring_t;
+
+static int stdioOpen(evtWriter_t* w, const char* path, uint64_t prealloc){
+    strncpy(w->path, path, EVT_WRITER_PATH_LEN - 1);
+    w->path[EVT_WRITER_PATH_LEN - 1] = '\0';
+
+    return 0;
+}
+
+static int stdioWrite(evtWriter_t* w, const void* buf, size_t len){
+    FILE* file = fopen(w->path, "ab");
+    int ok;
+
+    if(file == NULL){
+        w->stats.errors++;
+        return -1;
+    }
+
+    ok = fwrite(buf, len, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+
+    w->stats.writes++;
+    w->stats.bytes  += len;
+    w->stats.errors += !ok;
+
+    return ok ? 0 : -1;
+}
+
+static int stdioClose(evtWriter_t* w){
+    w->path[0] = '\0';
+
+    return 0;
+}
+
+void evtWriterStdio(evtWriter_t* w){
+    memset(w, 0, sizeof(evtWriter_t));
+    w->open    = stdioOpen;
+    w->write   = stdioWrite;
+    w->close   = stdioClose;
+    w->backend = EVT_WRITER_STDIO;
+}
+
+static void setFile(evtUring_t* u, int file, int fd){
+    struct io_uring_files_update update;
+
+    if(!u->fixedFiles)
+        return;
+
+    memset(&update, 0, sizeof(update));
+    update.offset = file;
+    update.fds    = (uint64_t)(uintptr_t)&fd;
+
+    if(uringRegister(&u->ring, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+        u->fixedFiles = 0;
+}
+
+static void complete(evtWriter_t* w, const struct io_uring_cqe* cqe){
+    evtUring_t* u = w->uring;
+    uint32_t op   = (uint32_t)(cqe->user_data >> 32);
+    uint32_t file = (uint32_t)(cqe->user_data >> 16) & 0xFFFF;
+    uint32_t slot = (uint32_t)cqe->user_data & 0xFFFF;
+
+    u->inFlight[file]--;
+
+    switch(op){
+        case OP_WRITE:
+            u->writesInFlight[file]--;
+            u->freeSlots[u->nFree++] = slot;
+            if(cqe->res != (int)u->lengths[slot]){
+                w->stats.errors++;
+                fprintf(stderr,"\tERR: write to %s failed: %s\n", u->paths[file],
+                        cqe->res < 0 ? strerror(-cqe->res) : "short write");
+            }
+            break;
+        case OP_FSYNC:
+            if(cqe->res < 0){
+                w->stats.errors++;
+                fprintf(stderr,"\tERR: sync of %s failed: %s\n", u->paths[file], strerror(-cqe->res));
+            }
+            break;
+        default:
+            // preallocation is only a hint, not every file system has it
+            break;
+    }
+
+    if(u->closing[file] && u->inFlight[file] == 0){
+        setFile(u, file, -1);
+        close(u->fds[file]);
+        u->fds[file]     = -1;
+        u->closing[file] = 0;
+    }
+}
+
+static void reap(evtWriter_t* w){
+    struct io_uring_cqe cqe;
+
+    while(uringPeekCqe(&w->uring->ring, &cqe))
+        complete(w, &cqe);
+}
+
+static int waitOne(evtWriter_t* w){
+    struct io_uring_cqe cqe;
+    int ret = uringWaitCqe(&w->uring->ring, &cqe);
+
+    if(ret < 0)
+        return ret;
+
+    complete(w, &cqe);
+
+    return 0;
+}
+
+static struct io_uring_sqe* prep(evtWriter_t* w, uint8_t opcode, int file){
+    evtUring_t* u = w->uring;
+    struct io_uring_sqe* sqe;
+
+    while((sqe = uringGetSqe(&u->ring)) == NULL){
+        uringSubmit(&u->ring, 0);
+        if(waitOne(w) < 0)
+            return NULL;
+    }
+
+    sqe->opcode = opcode;
+    if(u->fixedFiles){
+        sqe->fd     = file;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }else
+        sqe->fd = u->fds[file];
+
+    u->inFlight[file]++;
+
+    return sqe;
+}
+
+static int uringClose(evtWriter_t* w){
+    evtUring_t* u = w->uring;
+    struct io_uring_sqe* sqe;
+    int file = u->cur;
+
+    if(file < 0)
+        return 0;
+
+    while(u->writesInFlight[file] > 0)
+        if(waitOne(w) < 0)
+            return -1;
+
+    // blocks preallocated past the data stay allocated until the size is set again
+    if(u->preallocEnd[file] > w->offset){
+        while(u->inFlight[file] > 0)
+            if(waitOne(w) < 0)
+                return -1;
+
+        if(ftruncate(u->fds[file], w->offset) < 0){
+            w->stats.errors++;
+            fprintf(stderr,"\tERR: cannot trim %s: %s\n", u->paths[file], strerror(errno));
+        }
+    }
+    u->preallocEnd[file] = 0;
+
+    u->closing[file] = 1;
+    u->cur = -1;
+    w->path[0] = '\0';
+
+    sqe = prep(w, IORING_OP_FSYNC, file);
+    if(sqe == NULL)
+        return -1;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data   = USER_DATA(OP_FSYNC, file, 0);
+
+    return uringSubmit(&u->ring, 0) < 0 ? -1 : 0;
+}
+
+static int uringOpen(evtWriter_t* w, const char* path, uint64_t prealloc){
+    evtUring_t* u = w->uring;
+    struct io_uring_sqe* sqe;
+    int file = u->next;
+    int fd;
+    off_t end;
+
+    if(u->cur >= 0 && uringClose(w) < 0)
+        return -1;
+
+    reap(w);
+    while(u->inFlight[file] > 0){
+        w->stats.stalls++;
+        if(waitOne(w) < 0)
+            return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT, 0666);
+    if(fd < 0){
+        w->stats.errors++;
+        return -1;
+    }
+
+    end = lseek(fd, 0, SEEK_END);
+    w->offset = end > 0 ? (uint64_t)end : 0;
+
+    strncpy(w->path, path, EVT_WRITER_PATH_LEN - 1);
+    w->path[EVT_WRITER_PATH_LEN - 1] = '\0';
+    memcpy(u->paths[file], w->path, EVT_WRITER_PATH_LEN);
+    u->fds[file] = fd;
+    setFile(u, file, fd);
+    u->cur  = file;
+    u->next = (file + 1) % URING_FILES;
+
+    if(prealloc > 0){
+        sqe = prep(w, IORING_OP_FALLOCATE, file);
+        if(sqe == NULL)
+            return -1;
+        sqe->off       = w->offset;
+        sqe->addr      = prealloc;
+        sqe->len       = FALLOC_FL_KEEP_SIZE;
+        sqe->user_data = USER_DATA(OP_FALLOC, file, 0);
+        uringSubmit(&u->ring, 0);
+        u->preallocEnd[file] = w->offset + prealloc;
+    }
+
+    return 0;
+}
+
+static int uringWrite(evtWriter_t* w, const void* buf, size_t len){
+    evtUring_t* u = w->uring;
+    struct io_uring_sqe* sqe;
+    uint32_t slot, inFlight;
+    uint8_t* dst;
+
+    if(u->cur < 0 || len > EVT_WRITER_SLOT){
+        w->stats.errors++;
+        return -1;
+    }
+
+    reap(w);
+    while(u->nFree == 0){
+        w->stats.stalls++;
+        if(waitOne(w) < 0)
+            return -1;
+    }
+
+    slot = u->freeSlots[--u->nFree];
+    dst  = u->bufs + slot*EVT_WRITER_SLOT;
+    memcpy(dst, buf, len);
+    u->lengths[slot] = len;
+
+    sqe = prep(w, u->fixedBufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, u->cur);
+    if(sqe == NULL){
+        u->freeSlots[u->nFree++] = slot;
+        return -1;
+    }
+    sqe->addr      = (uint64_t)(uintptr_t)dst;
+    sqe->len       = len;
+    sqe->off       = w->offset;
+    sqe->buf_index = 0;
+    sqe->user_data = USER_DATA(OP_WRITE, u->cur, slot);
+
+    u->writesInFlight[u->cur]++;
+    w->offset += len;
+    w->stats.writes++;
+    w->stats.bytes += len;
+
+    inFlight = EVT_WRITER_DEPTH - u->nFree;
+    if(inFlight > w->stats.maxInFlight)
+        w->stats.maxInFlight = inFlight;
+
+    return uringSubmit(&u->ring, 0) < 0 ? -1 : 0;
+}
+
+// Returns -errno when io_uring, or one of the operations it is used for here,
+// is not available; w is then left unusable.
+int evtWriterUring(evtWriter_t* w){
+    evtUring_t* u;
+    struct iovec iov;
+    int fds[URING_FILES];
+    uint8_t ops[3];
+    int err;
+
+    memset(w, 0, sizeof(evtWriter_t));
+
+    u = calloc(1, sizeof(evtUring_t));
+    if(u == NULL)
+        return -ENOMEM;
+
+    err = uringInit(&u->ring, URING_ENTRIES);
+    if(err < 0){
+        free(u);
+        return err;
+    }
+
+    if(posix_memalign((void**)&u->bufs, 4096, EVT_WRITER_DEPTH*EVT_WRITER_SLOT) != 0){
+        uringExit(&u->ring);
+        free(u);
+        return -ENOMEM;
+    }
+
+    for(uint32_t i = 0; i < EVT_WRITER_DEPTH; i++)
+        u->freeSlots[i] = EVT_WRITER_DEPTH - 1 - i;
+    u->nFree = EVT_WRITER_DEPTH;
+
+    for(int i = 0; i < URING_FILES; i++)
+        u->fds[i] = fds[i] = -1;
+
+    // both registrations are optimisations, plain writes and descriptors work without them
+    iov.iov_base  = u->bufs;
+    iov.iov_len   = EVT_WRITER_DEPTH*EVT_WRITER_SLOT;
+    u->fixedBufs  = uringRegister(&u->ring, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    u->fixedFiles = uringRegister(&u->ring, IORING_REGISTER_FILES, fds, URING_FILES) == 0;
+    u->cur        = -1;
+
+    // io_uring_setup() works from 5.1, the opcodes used here came later
+    ops[0] = u->fixedBufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    ops[1] = IORING_OP_FALLOCATE;
+    ops[2] = IORING_OP_FSYNC;
+    err = uringProbe(&u->ring, ops, 3);
+    if(err < 0){
+        uringExit(&u->ring);
+        free(u->bufs);
+        free(u);
+        return err;
+    }
+
+    w->open    = uringOpen;
+    w->write   = uringWrite;
+    w->close   = uringClose;
+    w->backend = EVT_WRITER_URING;
+    w->uring   = u;
+
+    return 0;
+}
+
+// Waits for everything in flight and releases the backend.
+void evtWriterFree(evtWriter_t* w){
+    evtUring_t* u = w->uring;
+
+    if(u == NULL)
+        return;
+
+    evtWriterClose(w);
+
+    for(int i = 0; i < URING_FILES; i++){
+        while(u->inFlight[i] > 0)
+            if(waitOne(w) < 0)
+                break;
+        if(u->fds[i] >= 0)
+            close(u->fds[i]);
+    }
+
+    uringExit(&u->ring);
+    free(u->bufs);
+    free(u);
+    w->uring = NULL;
+}
+
+const char* evtWriterName(const evtWriter_t* w){
+    return w->backend == EVT_WRITER_URING ? "uring" : "stdio";
+}
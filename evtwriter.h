@@ -0,0 +1,66 @@
+#ifndef EVTWRITER_H_
+#define EVTWRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "eventfile.h"
+
+#define EVT_WRITER_STDIO    0
+#define EVT_WRITER_URING    1
+
+#define EVT_WRITER_PATH_LEN 64
+// records in flight on the io_uring backend, and the largest record it takes
+#define EVT_WRITER_DEPTH    16
+#define EVT_WRITER_SLOT     1024
+
+typedef struct evtWriterStats{
+    uint64_t writes;
+    uint64_t bytes;
+    uint32_t errors;
+    uint32_t stalls;
+    uint32_t maxInFlight;
+} evtWriterStats_t;
+
+struct evtWriter;
+struct evtUring;
+typedef int (*evtWriterOpenFunc_t)(struct evtWriter* w, const char* path, uint64_t prealloc);
+typedef int (*evtWriterWriteFunc_t)(struct evtWriter* w, const void* buf, size_t len);
+typedef int (*evtWriterCloseFunc_t)(struct evtWriter* w);
+
+// Where checkFifo's records go. The stdio backend opens, appends to and
+// closes the file for every record, as the daemon always did. The io_uring
+// backend keeps the file open and registered, copies each record into a
+// registered buffer and returns once the write is queued; it preallocates
+// the file when it is opened, gives back what the data did not use and starts
+// a data sync when it is closed.
+// Either way every write has reached the file when close returns, so the
+// finalizer can append the trailer.
+typedef struct evtWriter{
+    evtWriterOpenFunc_t  open;
+    evtWriterWriteFunc_t write;
+    evtWriterCloseFunc_t close;
+    uint8_t              backend;
+    char                 path[EVT_WRITER_PATH_LEN];
+    uint64_t             offset;
+    struct evtUring*     uring;
+    evtWriterStats_t     stats;
+} evtWriter_t;
+
+void evtWriterStdio(evtWriter_t* w);
+int evtWriterUring(evtWriter_t* w);
+void evtWriterFree(evtWriter_t* w);
+const char* evtWriterName(const evtWriter_t* w);
+
+static inline int evtWriterOpen(evtWriter_t* w, const char* path, uint64_t prealloc){
+    return w->open(w, path, prealloc);
+}
+
+static inline int evtWriterWrite(evtWriter_t* w, const void* buf, size_t len){
+    return w->write(w, buf, len);
+}
+
+static inline int evtWriterClose(evtWriter_t* w){
+    return w->close(w);
+}
+
+#endif
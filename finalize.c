@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "finalize.h"
+
+// Closed event and attitude files are finalized on a worker thread: the index
+// trailer is appended, the file fsynced, renamed away from its .lock name and
+// the directory fsynced, so that the rename survives a crash. The storage
+// thread only copies the name (and the index) into a slot of the queue, and
+// never does the job itself: with the queue full it waits for a slot, at most
+// FINALIZE_WAIT_S, then leaves the file with its .lock name.
+typedef struct finalizeJob{
+    char       lockName[FINALIZE_NAME_LEN];
+    uint8_t    hasIndex;
+    uint64_t   submitNs;
+    evtIndex_t idx;
+} finalizeJob_t;
+
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queueCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  notFull = PTHREAD_COND_INITIALIZER;
+static finalizeJob_t   queue[FINALIZE_QUEUE_LEN];
+// jobs head..tail-1 are pending, head is the one the worker is on
+static uint32_t        head, tail;
+static finalizeStats_t stats;
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int fsyncDir(const char* path){
+    char dir[FINALIZE_NAME_LEN] = ".";
+    const char* slash = strrchr(path, '/');
+    int fd, ret;
+
+    if(slash == path)
+        strcpy(dir, "/");
+    else if(slash != NULL){
+        memcpy(dir, path, slash - path);
+        dir[slash - path] = '\0';
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if(fd < 0)
+        return -1;
+
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
+
+static int runJob(finalizeJob_t* job){
+    char name[FINALIZE_NAME_LEN];
+    size_t len = strlen(job->lockName);
+    FILE* file;
+    int fd, err = 0;
+
+    if(len <= 5 || strcmp(job->lockName + len - 5, ".lock") != 0)
+        return -1;
+
+    memcpy(name, job->lockName, len - 5);
+    name[len - 5] = '\0';
+
+    fd = open(job->lockName, O_WRONLY | O_APPEND);
+    if(fd < 0){
+        fprintf(stderr,"\tERR: cannot finalize %s\n", job->lockName);
+        return -1;
+    }
+
+    if(job->hasIndex){
+        file = fdopen(fd, "ab");
+        if(file == NULL || evtIndexWrite(file, &job->idx) < 0 || fflush(file) != 0){
+            fprintf(stderr,"\tERR: cannot write index of %s\n", job->lockName);
+            err = -1;
+        }
+        if(fsync(fd) < 0)
+            err = -1;
+        if(file != NULL)
+            fclose(file);
+        else
+            close(fd);
+    }else{
+        if(fsync(fd) < 0)
+            err = -1;
+        close(fd);
+    }
+
+    if(rename(job->lockName, name) < 0 || fsyncDir(name) < 0){
+        fprintf(stderr,"\tERR: cannot rename %s\n", job->lockName);
+        return -1;
+    }
+
+    return err;
+}
+
+// under queueLock
+static void account(int err, uint64_t submitNs){
+    uint64_t ns = nowNs() - submitNs;
+
+    stats.nDone++;
+    stats.nFailed += err < 0;
+    stats.lastNs   = ns;
+    stats.totalNs += ns;
+    if(ns > stats.maxNs)
+        stats.maxNs = ns;
+}
+
+static void* finalizeThread(void* arg){
+    finalizeJob_t* job;
+    int err;
+
+    for(;;){
+        pthread_mutex_lock(&queueLock);
+        while(head == tail)
+            pthread_cond_wait(&queueCond, &queueLock);
+        job = &queue[head % FINALIZE_QUEUE_LEN];
+        pthread_mutex_unlock(&queueLock);
+
+        err = runJob(job);
+
+        pthread_mutex_lock(&queueLock);
+        account(err, job->submitNs);
+        head++;
+        pthread_cond_signal(&notFull);
+        pthread_mutex_unlock(&queueLock);
+    }
+
+    return arg;
+}
+
+int finalizeStart(pthread_t* id){
+    int err = pthread_create(id, NULL, &finalizeThread, NULL);
+
+    if(err == 0)
+        pthread_detach(*id);
+
+    return err;
+}
+
+static void fillJob(finalizeJob_t* job, const char* lockName, const evtIndex_t* idx){
+    strncpy(job->lockName, lockName, FINALIZE_NAME_LEN - 1);
+    job->lockName[FINALIZE_NAME_LEN - 1] = '\0';
+    job->hasIndex = idx != NULL;
+    job->submitNs = nowNs();
+    if(idx != NULL)
+        memcpy(&job->idx, idx, sizeof(evtIndex_t));
+}
+
+// lockName ends with .lock; idx, when not NULL, is appended as the trailer.
+void finalizeSubmit(const char* lockName, const evtIndex_t* idx){
+    struct timespec deadline;
+    uint64_t start, waited;
+    int err = 0;
+
+    if(lockName[0] == '\0')
+        return;
+
+    pthread_mutex_lock(&queueLock);
+
+    if(tail - head == FINALIZE_QUEUE_LEN){
+        stats.nWaits++;
+        start = nowNs();
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += FINALIZE_WAIT_S;
+
+        while(tail - head == FINALIZE_QUEUE_LEN && err != ETIMEDOUT)
+            err = pthread_cond_timedwait(&notFull, &queueLock, &deadline);
+
+        waited = nowNs() - start;
+        if(waited > stats.maxWaitNs)
+            stats.maxWaitNs = waited;
+    }
+
+    // the worker is stuck (e.g. on a failing card), the file keeps its .lock name
+    if(tail - head == FINALIZE_QUEUE_LEN){
+        stats.nSkipped++;
+        pthread_mutex_unlock(&queueLock);
+        fprintf(stderr,"\tERR: finalize queue full, %s left unfinalized\n", lockName);
+        return;
+    }
+
+    fillJob(&queue[tail % FINALIZE_QUEUE_LEN], lockName, idx);
+    tail++;
+    if(tail - head > stats.maxDepth)
+        stats.maxDepth = tail - head;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+}
+
+void finalizeGetStats(finalizeStats_t* s){
+    pthread_mutex_lock(&queueLock);
+    *s = stats;
+    s->depth = tail - head;
+    pthread_mutex_unlock(&queueLock);
+}
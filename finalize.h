@@ -0,0 +1,32 @@
+#ifndef FINALIZE_H_
+#define FINALIZE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "eventfile.h"
+
+#define FINALIZE_QUEUE_LEN 32
+#define FINALIZE_NAME_LEN  64
+// longest a submit waits for room before leaving the file with its .lock name
+#define FINALIZE_WAIT_S    5
+
+// Latencies are from finalizeSubmit to the directory fsync. nWaits counts the
+// submits that found the queue full, nSkipped those that gave up waiting.
+typedef struct finalizeStats{
+    uint32_t depth;
+    uint32_t maxDepth;
+    uint32_t nDone;
+    uint32_t nFailed;
+    uint32_t nWaits;
+    uint32_t nSkipped;
+    uint64_t maxWaitNs;
+    uint64_t lastNs;
+    uint64_t maxNs;
+    uint64_t totalNs;
+} finalizeStats_t;
+
+int finalizeStart(pthread_t* id);
+void finalizeSubmit(const char* lockName, const evtIndex_t* idx);
+void finalizeGetStats(finalizeStats_t* stats);
+
+#endif
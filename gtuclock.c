@@ -0,0 +1,287 @@
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "gtuclock.h"
+#include "timesvc.h"
+
+#define GTU_CLOCK_PERIOD_S    1
+#define GTU_CLOCK_TRIES       3
+#define GTU_CLOCK_BRACKET_NS  20000
+#define GTU_CLOCK_FORGET      0.998
+#define GTU_CLOCK_REG_WEIGHT  1.0
+#define GTU_CLOCK_PPS_WEIGHT  1000.0
+#define GTU_CLOCK_MIN_SAMPLES 4
+#define GTU_CLOCK_JUMP_NS     10000000.0
+#define GTU_CLOCK_MAX_REJECTS 3
+
+// Weighted least squares of realtime against the GTU count, with the sums
+// kept around the newest sample so that they stay small: adding a sample
+// moves the origin to it, scales the old sums by GTU_CLOCK_FORGET (about
+// 500 samples of memory, so the fit follows the oscillator drift) and adds
+// the new weight at (0, 0). Samples are register reads bracketed by the time
+// service every second and, with much more weight, PPS triggered events, whose
+// true time is the whole second they mark.
+//
+// Writers serialise on fitLock; the fitted line is published under a
+// sequence lock like timesvc, so stamping an event is a few loads and one
+// multiply.
+typedef struct gtuClockFit{
+    uint32_t refGtu;
+    uint64_t refNs;
+    double   sw, sx, sy, sxx, sxy;
+    double   a, b;
+    double   rms2, ppsRms2, lastNs, maxNs;
+    uint32_t nSamples, nPps, nRegResid, nPpsResid;
+    uint32_t nRejected, nResets, rejects;
+    uint8_t  valid;
+} gtuClockFit_t;
+
+static pthread_mutex_t fitLock = PTHREAD_MUTEX_INITIALIZER;
+static gtuClockFit_t fit;
+
+static uint32_t seq;
+static gtuClockParams_t published;
+static uint32_t epoch;
+
+static void publish(void){
+    uint32_t s = seq;
+
+    __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    published.refGtu    = fit.refGtu;
+    published.refNs     = fit.refNs + (int64_t)llround(fit.a);
+    published.tickNs    = fit.b;
+    published.rmsNs     = sqrt(fit.rms2);
+    published.ppsRmsNs  = sqrt(fit.ppsRms2);
+    published.lastNs    = fit.lastNs;
+    published.maxNs     = fit.maxNs;
+    published.nSamples  = fit.nSamples;
+    published.nPps      = fit.nPps;
+    published.nRejected = fit.nRejected;
+    published.nResets   = fit.nResets;
+    published.epoch     = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+    published.valid     = fit.valid;
+
+    __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+}
+
+static void resetFit(void){
+    uint32_t nRejected = fit.nRejected;
+    uint32_t nResets = fit.nResets;
+
+    memset(&fit, 0, sizeof(fit));
+    fit.nRejected = nRejected;
+    fit.nResets   = nResets + 1;
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_RELEASE);
+}
+
+static void solve(void){
+    double det = fit.sw*fit.sxx - fit.sx*fit.sx;
+
+    fit.valid = 0;
+    if(fit.nSamples < GTU_CLOCK_MIN_SAMPLES || det <= 0.0)
+        return;
+
+    fit.b = (fit.sw*fit.sxy - fit.sx*fit.sy)/det;
+    fit.a = (fit.sy - fit.b*fit.sx)/fit.sw;
+    fit.valid = fit.b > 0.0;
+}
+
+static void residual(double r, int pps){
+    double* rms2 = pps ? &fit.ppsRms2 : &fit.rms2;
+    uint32_t* n = pps ? &fit.nPpsResid : &fit.nRegResid;
+    // plain mean until there are as many residuals as the fit remembers
+    double k = fmax(1.0/++(*n), 1.0 - GTU_CLOCK_FORGET);
+
+    *rms2 += k*(r*r - *rms2);
+    fit.lastNs = r;
+    if(fabs(r) > fit.maxNs)
+        fit.maxNs = fabs(r);
+}
+
+// A register sample off by more than GTU_CLOCK_JUMP_NS means that the counter
+// was reset or the realtime clock stepped, and restarts the fit at once. A PPS
+// sample that far off is more likely paired with the wrong second and only
+// restarts it when GTU_CLOCK_MAX_REJECTS come in a row.
+static void addSample(uint32_t gtu, uint64_t ns, double weight, int pps){
+    double dx = 0.0, dy = 0.0, r = 0.0, sx, sy;
+    int predicted = 0;
+
+    pthread_mutex_lock(&fitLock);
+
+    if(fit.nSamples > 0){
+        dx = (double)(int32_t)(gtu - fit.refGtu);
+        dy = (double)(int64_t)(ns - fit.refNs);
+
+        if(fit.valid){
+            r = dy - (fit.a + fit.b*dx);
+            predicted = 1;
+
+            if(fabs(r) > GTU_CLOCK_JUMP_NS){
+                if(pps && ++fit.rejects < GTU_CLOCK_MAX_REJECTS){
+                    fit.nRejected++;
+                    pthread_mutex_unlock(&fitLock);
+                    return;
+                }
+                resetFit();
+                predicted = 0;
+            }
+        }
+    }
+
+    if(fit.nSamples > 0){
+        sx = fit.sx;
+        sy = fit.sy;
+
+        fit.sxx = GTU_CLOCK_FORGET*(fit.sxx - 2.0*dx*sx + dx*dx*fit.sw);
+        fit.sxy = GTU_CLOCK_FORGET*(fit.sxy - dx*sy - dy*sx + dx*dy*fit.sw);
+        fit.sx  = GTU_CLOCK_FORGET*(sx - dx*fit.sw);
+        fit.sy  = GTU_CLOCK_FORGET*(sy - dy*fit.sw);
+        fit.sw  = GTU_CLOCK_FORGET*fit.sw;
+    }
+
+    fit.refGtu  = gtu;
+    fit.refNs   = ns;
+    fit.sw     += weight;
+    fit.rejects = 0;
+    fit.nSamples++;
+    fit.nPps   += pps;
+
+    if(predicted)
+        residual(r, pps);
+
+    solve();
+    publish();
+
+    pthread_mutex_unlock(&fitLock);
+}
+
+// GTU counter read between two time service reads, the tightest of a few tries.
+static void sampleRegister(axiRegisters_t* regs){
+    uint64_t t0, t1, best = UINT64_MAX, ns = 0;
+    uint32_t gtu, bestGtu = 0;
+
+    for(int i = 0; i < GTU_CLOCK_TRIES; i++){
+        t0  = timeSvcNowNs();
+        gtu = readReg(regs->statusReg, STATUS_REG_ADDR, GTU_COUNTER_ADDR);
+        t1  = timeSvcNowNs();
+
+        if(t1 - t0 < best){
+            best    = t1 - t0;
+            ns      = t0 + (t1 - t0)/2;
+            bestGtu = gtu;
+        }
+    }
+
+    if(best < GTU_CLOCK_BRACKET_NS)
+        addSample(bestGtu, ns, GTU_CLOCK_REG_WEIGHT, 0);
+}
+
+static void* gtuClockThread(void* arg){
+    axiRegisters_t* regs = (axiRegisters_t*)arg;
+    struct timespec wait = {GTU_CLOCK_PERIOD_S, 0};
+
+    for(;;){
+        sampleRegister(regs);
+        nanosleep(&wait, NULL);
+    }
+
+    return arg;
+}
+
+void gtuClockInit(void){
+    pthread_mutex_lock(&fitLock);
+    memset(&fit, 0, sizeof(fit));
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_RELEASE);
+    publish();
+    pthread_mutex_unlock(&fitLock);
+}
+
+int gtuClockStart(pthread_t* id, axiRegisters_t* regs){
+    int err = pthread_create(id, NULL, &gtuClockThread, (void*)regs);
+
+    if(err == 0)
+        pthread_detach(*id);
+
+    return err;
+}
+
+// eventNs is when the event was read, some time after the PPS edge: the edge
+// is the whole second nearest to the model time of gtuCount, or the one
+// before eventNs while there is no model yet.
+void gtuClockAddPps(uint32_t gtuCount, uint64_t eventNs){
+    uint64_t ns;
+
+    if(gtuClockNs(gtuCount, &ns) == 0)
+        ns = (ns + 500000000ULL)/1000000000ULL*1000000000ULL;
+    else
+        ns = eventNs/1000000000ULL*1000000000ULL;
+
+    addSample(gtuCount, ns, GTU_CLOCK_PPS_WEIGHT, 1);
+}
+
+// Realtime of gtuCount, -1 while there is no model.
+int gtuClockNs(uint32_t gtuCount, uint64_t* ns){
+    gtuClockParams_t p;
+    uint32_t s;
+
+    do{
+        s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        p.refGtu = published.refGtu;
+        p.refNs  = published.refNs;
+        p.tickNs = published.tickNs;
+        p.valid  = published.valid;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while((s & 1) || s != __atomic_load_n(&seq, __ATOMIC_RELAXED));
+
+    return gtuClockStamp(&p, gtuCount, ns);
+}
+
+// The time of gtuCount on a model taken with gtuClockGet, -1 if it is not valid.
+int gtuClockStamp(const gtuClockParams_t* params, uint32_t gtuCount, uint64_t* ns){
+    if(!params->valid)
+        return -1;
+
+    *ns = params->refNs + (int64_t)llround(params->tickNs*(int32_t)(gtuCount - params->refGtu));
+
+    return 0;
+}
+
+uint32_t gtuClockEpoch(void){
+    return __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+}
+
+void gtuClockGet(gtuClockParams_t* params){
+    uint32_t s;
+
+    do{
+        s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        memcpy(params, &published, sizeof(*params));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while((s & 1) || s != __atomic_load_n(&seq, __ATOMIC_RELAXED));
+}
+
+static uint32_t clampNs(double ns){
+    return ns < 4294967295.0 ? (uint32_t)llround(ns) : UINT32_MAX;
+}
+
+// The model in the form stored in the event file headers.
+void gtuClockInfo(const gtuClockParams_t* params, evtClockInfo_t* info){
+    double tickInt = floor(params->tickNs);
+
+    memset(info, 0, sizeof(*info));
+    if(!params->valid)
+        return;
+
+    info->refGtu   = params->refGtu;
+    info->refSec   = (uint32_t)(params->refNs/1000000000ULL);
+    info->refNsec  = (uint32_t)(params->refNs%1000000000ULL);
+    info->tickNs   = (uint32_t)tickInt;
+    info->tickFrac = (uint32_t)fmin((params->tickNs - tickInt)*4294967296.0, 4294967295.0);
+    info->nSamples = params->nSamples;
+    info->nPps     = params->nPps;
+    info->rmsNs    = clampNs(params->rmsNs);
+    info->ppsRmsNs = clampNs(params->ppsRmsNs);
+    info->maxNs    = clampNs(params->maxNs);
+}
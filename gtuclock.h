@@ -0,0 +1,38 @@
+#ifndef GTUCLOCK_H_
+#define GTUCLOCK_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "registers.h"
+#include "eventfile.h"
+
+// trgFlag bit of the events triggered by the GPS PPS (TRGGPS in the status register)
+#define GTU_CLOCK_PPS_FLAG (1U << 25)
+
+typedef struct gtuClockParams{
+    uint32_t refGtu;
+    uint64_t refNs;
+    double   tickNs;
+    double   rmsNs;
+    double   ppsRmsNs;
+    double   lastNs;
+    double   maxNs;
+    uint32_t nSamples;
+    uint32_t nPps;
+    uint32_t nRejected;
+    uint32_t nResets;
+    // changes whenever the fit restarts (gtuClockInit or a counter jump)
+    uint32_t epoch;
+    uint8_t  valid;
+} gtuClockParams_t;
+
+void gtuClockInit(void);
+int gtuClockStart(pthread_t* id, axiRegisters_t* regs);
+void gtuClockAddPps(uint32_t gtuCount, uint64_t eventNs);
+int gtuClockNs(uint32_t gtuCount, uint64_t* ns);
+int gtuClockStamp(const gtuClockParams_t* params, uint32_t gtuCount, uint64_t* ns);
+uint32_t gtuClockEpoch(void);
+void gtuClockGet(gtuClockParams_t* params);
+void gtuClockInfo(const gtuClockParams_t* params, evtClockInfo_t* info);
+
+#endif
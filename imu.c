@@ -3,7 +3,6 @@
 ////////////////////////////////////////////
 
 
-int16_t imu_priv_calib_counter = 0;
 int16_t const IMU_PRIV_CALIB_COUNTER_MAX = 200;
 
 
@@ -16,6 +15,13 @@ imu_t imu_init()
 
     imu_set_state(&imu, IMU_STATE_UNCALIBRATED);
     imu_set_calibration_mode(&imu, IMU_CALIBMODE_NEVER);
+    imu_set_estimation_mode(&imu, IMU_ESTIMODE_GYRO | IMU_ESTIMODE_ACCELEROMETER | IMU_ESTIMODE_COMPLEMENTARY);
+
+    imu._alpha = IMU_COMPLEMENTARY_ALPHA;
+    imu._beta = IMU_MADGWICK_BETA;
+    imu._kp = IMU_MAHONY_KP;
+    imu._ki = IMU_MAHONY_KI;
+    imu._integral_error = imu_vec3_create(0.f, 0.f, 0.f);
     
     imu.accelerometer_offset =
         imu.gyro_offset =
@@ -27,7 +33,12 @@ imu_t imu_init()
 
     imu.orientation.roll = imu.orientation.pitch = imu.orientation.yaw = 0.f;
     imu.orientation_quat = imu_quaternion_create(1.f, 0.f, 0.f, 0.f);
-    imu._gyro_ts = get_time_sec();
+    imu._generation = 1;
+    imu._orientation_generation = imu._rotation_generation = imu._world_accelerometer_generation = 0;
+    imu._sample_ts = 0;
+    imu._calib_counter = 0;
+
+    imu_bias_init(&imu.bias, &imu.gyro_offset);
 
     return imu;
 }
@@ -38,7 +49,7 @@ imu_t imu_init()
 
 void imu_calibrate(imu_t *imu)
 {
-    if(imu_priv_calib_counter++ < IMU_PRIV_CALIB_COUNTER_MAX)
+    if(imu->_calib_counter++ < IMU_PRIV_CALIB_COUNTER_MAX)
     {
         // these are not necessarily offset values, but for sake of consistency
         // in naming I call them offset.
@@ -57,7 +68,7 @@ void imu_calibrate(imu_t *imu)
         imu->accelerometer_offset = imu_vec3_scale(&imu->accelerometer_offset, 1.f / IMU_PRIV_CALIB_COUNTER_MAX);
         imu->gyro_offset = imu_vec3_scale(&imu->gyro_offset, 1.f / IMU_PRIV_CALIB_COUNTER_MAX);
 
-        imu_priv_calib_counter = 0;
+        imu->_calib_counter = 0;
         imu_set_state(imu, IMU_STATE_READY);
     }
 }
@@ -68,14 +79,41 @@ void imu_calibrate(imu_t *imu)
 
 void imu_main_loop(imu_t *imu)
 {
+    imu_main_loop_ts(imu, get_time_ns());
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_main_loop_ts(imu_t *imu, uint64_t timestamp)
+{
+    float dt = 0.f;
+
+    // first sample, out of order samples and long gaps are not integrated
+    if(imu->_sample_ts != 0 && timestamp > imu->_sample_ts && timestamp - imu->_sample_ts < IMU_MAX_DT_NS)
+        dt = (float)(timestamp - imu->_sample_ts) * 1e-9f;
+
+    // a late sample leaves the stamp alone, or the next one would be integrated
+    // over time already covered; one a long gap back means the clock restarted
+    if(imu->_sample_ts == 0 || timestamp > imu->_sample_ts || imu->_sample_ts - timestamp >= IMU_MAX_DT_NS)
+        imu->_sample_ts = timestamp;
+
     switch (imu->state)
     {
     case IMU_STATE_UNCALIBRATED:
 
-        if(imu->_calibration_mode != IMU_CALIBMODE_NEVER)
+        if(imu->_calibration_mode == IMU_CALIBMODE_ONLINE)
         {
-            imu->_calibration_time = time(NULL);
+            // the offsets set so far are the starting point of the estimate
+            imu_bias_init(&imu->bias, &imu->gyro_offset);
+            imu_set_state(imu, IMU_STATE_READY);
+        }
+        else if(imu->_calibration_mode != IMU_CALIBMODE_NEVER)
+        {
+            imu->_calibration_time = (time_t)(timestamp / 1000000000ULL);
             imu_set_state(imu, IMU_STATE_CALIBRATING);
+            imu->_calib_counter = 0;
             imu->gyro_offset = imu->accelerometer_offset = imu_vec3_create(0.f, 0.f, 0.f);
         }
         else
@@ -92,11 +130,17 @@ void imu_main_loop(imu_t *imu)
 
     case IMU_STATE_READY:
 
-        imu_process_raw_data(imu);
+        if(imu->_calibration_mode == IMU_CALIBMODE_ONLINE)
+        {
+            if(imu_bias_update(&imu->bias, &imu->gyro_raw, &imu->accelerometer_raw, imu->_scale_factor_gyro, imu->_scale_factor_accelerometer))
+                imu->gyro_offset = imu->bias.bias;
+        }
+
+        imu_process_raw_data_dt(imu, dt);
 
         if(imu->_calibration_mode == IMU_CALIBMODE_PERIODIC)
         {
-            if(time(NULL) - imu->_calibration_time > IMU_CALIBRATION_PERIOD)
+            if((time_t)(timestamp / 1000000000ULL) - imu->_calibration_time > IMU_CALIBRATION_PERIOD)
             {
                 imu_set_state(imu, IMU_STATE_UNCALIBRATED);
             }
@@ -172,6 +216,82 @@ int8_t imu_get_estimation_mode(imu_t * imu)
 
 
 void imu_process_raw_data(imu_t * imu)
+{
+    uint64_t now = get_time_ns();
+    float dt = (imu->_sample_ts != 0 && now - imu->_sample_ts < IMU_MAX_DT_NS) ? (float)(now - imu->_sample_ts) * 1e-9f : 0.f;
+
+    imu->_sample_ts = now;
+    imu_process_raw_data_dt(imu, dt);
+}
+
+
+////////////////////////////////////////////
+
+
+imu_euler_t imu_get_orientation(imu_t * imu)
+{
+    if(imu->_orientation_generation != imu->_generation)
+    {
+        imu->orientation = imu_quaternion_to_euler(&imu->orientation_quat);
+        imu->_orientation_generation = imu->_generation;
+    }
+
+    return imu->orientation;
+}
+
+
+////////////////////////////////////////////
+
+
+imu_mat3_t imu_get_rotation(imu_t * imu)
+{
+    if(imu->_rotation_generation != imu->_generation)
+    {
+        imu_quaternion_to_mat3_into(&imu->orientation_quat, imu->_rotation.m);
+        imu->_rotation_generation = imu->_generation;
+    }
+
+    return imu->_rotation;
+}
+
+
+////////////////////////////////////////////
+
+
+imu_vec3_t imu_get_world_accelerometer(imu_t * imu)
+{
+    imu_mat3_t rotation;
+
+    if(imu->_world_accelerometer_generation != imu->_generation)
+    {
+        rotation = imu_get_rotation(imu);
+        imu->_world_accelerometer = imu_mat3_rotate_vector(&rotation, &imu->accelerometer);
+        imu->_world_accelerometer_generation = imu->_generation;
+    }
+
+    return imu->_world_accelerometer;
+}
+
+
+////////////////////////////////////////////
+
+
+float imu_get_gyro_bias(const imu_t * imu, imu_vec3_t * bias)
+{
+    *bias = imu_vec3_scale(&imu->gyro_offset, imu->_scale_factor_gyro);
+
+    if(imu->_calibration_mode != IMU_CALIBMODE_ONLINE)
+        return 0.f;
+
+    return imu_bias_sigma(&imu->bias) * imu->_scale_factor_gyro;
+}
+
+
+////////////////////////////////////////////
+
+
+// subtracts the gyro offsets and scales the raw data, common to all filters
+static inline void imu_prepare_raw_data(imu_t * imu)
 {
     // subtracting mean noise offsets from new raw values
     imu->gyro = imu_vec3_dif(&imu->gyro_raw, &imu->gyro_offset);
@@ -179,18 +299,24 @@ void imu_process_raw_data(imu_t * imu)
     // scaling corrected raw data to 
     imu->accelerometer = imu_vec3_scale(&imu->accelerometer_raw, imu->_scale_factor_accelerometer);
     imu->gyro = imu_vec3_scale(&imu->gyro, imu->_scale_factor_gyro);
-    
-    const float alpha = 0.96f, one_minus_alpha = (1.f - alpha);
+}
+
+
+////////////////////////////////////////////
+
+
+static inline __attribute__((always_inline)) void imu_filter_complementary(imu_t * imu, float dt)
+{
+    const float one_minus_alpha = (1.f - imu->_alpha);
 
     ////////////////////////////////////////////
     // gyro integration
     ////////////////////////////////////////////
 
-    float dtime = get_time_sec() - imu->_gyro_ts;
     float rotvlen = imu_vec3_length(&imu->gyro);
-    float rotang = d2r(dtime * rotvlen);
-    float crotang_2 = cos(rotang * 0.5);
-    float srotang_2 = sin(rotang * 0.5);
+    float rotang = d2rf(dt * rotvlen);
+    float crotang_2 = cosf(rotang * 0.5f);
+    float srotang_2 = sinf(rotang * 0.5f);
 
     imu_vec3_t rotn = imu_vec3_normalize(&imu->gyro);
     // instantaneous rotation quaternion
@@ -198,8 +324,6 @@ void imu_process_raw_data(imu_t * imu)
     // integrated gyro quaternion
     imu_quaternion_t qw = imu_quaternion_product(&imu->orientation_quat, &rotation);
 
-    imu->_gyro_ts = get_time_sec();
-
     ////////////////////////////////////////////
     // complementary filter
     ////////////////////////////////////////////
@@ -215,15 +339,146 @@ void imu_process_raw_data(imu_t * imu)
     imu_vec3_t v = imu_vec3_create(qawrld.x, qawrld.y, qawrld.z);
     imu_vec3_t n = imu_vec3_cross(&v, &wup);
     n = imu_vec3_normalize(&n);
-    float tiltang = acos(imu_vec3_dot(&v, &wup)) * one_minus_alpha;
-    float ctiltang_2 = cos(tiltang * 0.5);
-    float stiltang_2 = sin(tiltang * 0.5);
+    float tiltang = acosf(imu_vec3_dot(&v, &wup)) * one_minus_alpha;
+    float ctiltang_2 = cosf(tiltang * 0.5f);
+    float stiltang_2 = sinf(tiltang * 0.5f);
     // tilt correction quaternion
     imu_quaternion_t qt = imu_quaternion_create(ctiltang_2, n.x * stiltang_2, n.y * stiltang_2, n.z * stiltang_2);
     // resulting quaternion of complementary filter
     imu->orientation_quat = imu_quaternion_product(&qt, &qw);
-    // updating orientation
-    imu->orientation = imu_quaternion_to_euler(&imu->orientation_quat);
+}
+
+
+////////////////////////////////////////////
+
+
+// Madgwick's gradient descent filter, IMU variant without magnetometer
+static inline __attribute__((always_inline)) void imu_filter_madgwick(imu_t * imu, float dt)
+{
+    imu_quaternion_t * q = &imu->orientation_quat;
+    imu_vec3_t g = imu_vec3_scale(&imu->gyro, d2rf(1.f));
+    imu_quaternion_t qg = imu_quaternion_create(0.f, g.x, g.y, g.z);
+    // rate of change of quaternion from gyro
+    imu_quaternion_t qdot = imu_quaternion_product(q, &qg);
+    qdot = imu_quaternion_scale(&qdot, 0.5f);
+
+    if(imu->accelerometer.x != 0.f || imu->accelerometer.y != 0.f || imu->accelerometer.z != 0.f)
+    {
+        imu_vec3_t a = imu_vec3_normalize(&imu->accelerometer);
+
+        float _2q0 = 2.f * q->w, _2q1 = 2.f * q->x, _2q2 = 2.f * q->y, _2q3 = 2.f * q->z;
+        float _4q0 = 4.f * q->w, _4q1 = 4.f * q->x, _4q2 = 4.f * q->y;
+        float _8q1 = 8.f * q->x, _8q2 = 8.f * q->y;
+        float q0q0 = q->w * q->w, q1q1 = q->x * q->x, q2q2 = q->y * q->y, q3q3 = q->z * q->z;
+
+        // gradient of the error between measured and estimated gravity
+        imu_quaternion_t step = imu_quaternion_create(
+            _4q0 * q2q2 + _2q2 * a.x + _4q0 * q1q1 - _2q1 * a.y,
+            _4q1 * q3q3 - _2q3 * a.x + 4.f * q0q0 * q->x - _2q0 * a.y - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * a.z,
+            4.f * q0q0 * q->y + _2q0 * a.x + _4q2 * q3q3 - _2q3 * a.y - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * a.z,
+            4.f * q1q1 * q->z - _2q1 * a.x + 4.f * q2q2 * q->z - _2q2 * a.y
+        );
+
+        if(step.w != 0.f || step.x != 0.f || step.y != 0.f || step.z != 0.f)
+        {
+            step = imu_quaternion_normalize(&step);
+            step = imu_quaternion_scale(&step, - imu->_beta);
+            qdot = imu_quaternion_sum(&qdot, &step);
+        }
+    }
+
+    qdot = imu_quaternion_scale(&qdot, dt);
+    *q = imu_quaternion_sum(q, &qdot);
+    *q = imu_quaternion_normalize(q);
+}
+
+
+////////////////////////////////////////////
+
+
+// Mahony's nonlinear complementary filter with proportional and integral feedback
+static inline __attribute__((always_inline)) void imu_filter_mahony(imu_t * imu, float dt)
+{
+    imu_quaternion_t * q = &imu->orientation_quat;
+    imu_vec3_t g = imu_vec3_scale(&imu->gyro, d2rf(1.f));
+
+    if(imu->accelerometer.x != 0.f || imu->accelerometer.y != 0.f || imu->accelerometer.z != 0.f)
+    {
+        imu_vec3_t a = imu_vec3_normalize(&imu->accelerometer);
+
+        // estimated direction of gravity in body frame, halved
+        imu_vec3_t v = imu_vec3_create(
+            q->x * q->z - q->w * q->y,
+            q->w * q->x + q->y * q->z,
+            q->w * q->w - 0.5f + q->z * q->z
+        );
+        // error is the cross product between measured and estimated gravity
+        imu_vec3_t e = imu_vec3_cross(&a, &v);
+
+        if(imu->_ki > 0.f)
+        {
+            imu_vec3_t ie = imu_vec3_scale(&e, 2.f * imu->_ki * dt);
+            imu->_integral_error = imu_vec3_sum(&imu->_integral_error, &ie);
+            g = imu_vec3_sum(&g, &imu->_integral_error);
+        }
+
+        e = imu_vec3_scale(&e, 2.f * imu->_kp);
+        g = imu_vec3_sum(&g, &e);
+    }
+
+    imu_quaternion_t qg = imu_quaternion_create(0.f, g.x, g.y, g.z);
+    imu_quaternion_t qdot = imu_quaternion_product(q, &qg);
+    qdot = imu_quaternion_scale(&qdot, 0.5f * dt);
+    *q = imu_quaternion_sum(q, &qdot);
+    *q = imu_quaternion_normalize(q);
+}
+
+
+////////////////////////////////////////////
+
+
+// generation 0 is never current, the caches start out stale
+#define IMU_DEFINE_PROCESS_RAW_DATA(name)                       \
+void imu_process_raw_data_##name(imu_t * imu, float dt)         \
+{                                                               \
+    imu_prepare_raw_data(imu);                                  \
+    imu_filter_##name(imu, dt);                                 \
+    if(++imu->_generation == 0)                                 \
+        imu->_generation = 1;                                   \
+}
+
+IMU_DEFINE_PROCESS_RAW_DATA(complementary)
+IMU_DEFINE_PROCESS_RAW_DATA(madgwick)
+IMU_DEFINE_PROCESS_RAW_DATA(mahony)
+
+
+////////////////////////////////////////////
+
+
+void imu_process_raw_data_dt(imu_t * imu, float dt)
+{
+#if defined(IMU_FILTER) && IMU_FILTER == IMU_ESTIMODE_MADGWICK
+    imu_process_raw_data_madgwick(imu, dt);
+#elif defined(IMU_FILTER) && IMU_FILTER == IMU_ESTIMODE_MAHONY
+    imu_process_raw_data_mahony(imu, dt);
+#elif defined(IMU_FILTER)
+    imu_process_raw_data_complementary(imu, dt);
+#else
+    switch (imu->_estimation_mode & IMU_ESTIMODE_FILTER_MASK)
+    {
+    case IMU_ESTIMODE_MADGWICK:
+        imu_process_raw_data_madgwick(imu, dt);
+        break;
+
+    case IMU_ESTIMODE_MAHONY:
+        imu_process_raw_data_mahony(imu, dt);
+        break;
+
+    default:
+        imu_process_raw_data_complementary(imu, dt);
+        break;
+    }
+#endif
 }
 
 
@@ -31,6 +31,7 @@
 #include "imu_utils.h"
 #include "imu_algebra.h"
 #include "imu_constants.h"
+#include "imu_bias.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,7 +41,6 @@ extern "C" {
 ////////////////////////////////////////////
 
 
-extern int16_t imu_priv_calib_counter;
 extern int16_t const IMU_PRIV_CALIB_COUNTER_MAX;
 
 ////////////////////////////////////////////
@@ -73,30 +73,60 @@ typedef struct IMU
     // computed orientation quaternion of the body
     imu_quaternion_t orientation_quat;
 
-    // orientation of the body in roll, pitch and yaw angles
+    // orientation of the body in roll, pitch and yaw angles.
+    // computed on demand, read it through imu_get_orientation()
     imu_euler_t orientation;
+
+    // bumped by every attitude update, the derived outputs below are valid
+    // while their generation matches it
+    uint32_t _generation;
+    uint32_t _orientation_generation;
+    uint32_t _rotation_generation;
+    uint32_t _world_accelerometer_generation;
+
+    // body to world rotation matrix of orientation_quat
+    imu_mat3_t _rotation;
+
+    // accelerometer in world frame (g), gravity included
+    imu_vec3_t _world_accelerometer;
     
     // current computational state of the library.
     int8_t state;
     
-    // timestamp to compute angular change in gyro
-    double _gyro_ts;
+    // timestamp of the last sample in nanoseconds, gyro is integrated over the difference to the next one
+    uint64_t _sample_ts;
     
     // number to multiply raw gyro data. changes according to full scale
-    double _scale_factor_gyro;
+    float _scale_factor_gyro;
 
     // number to multiply raw accelerometer data changes according to full scale
-    double _scale_factor_accelerometer;
+    float _scale_factor_accelerometer;
+
+    // samples accumulated so far by imu_calibrate()
+    int16_t _calib_counter;
 
     // timestamp of calibration change if status is calibrating, won't be updated. if status is ready imu will be recalibrated every n seconds.
     time_t _calibration_time;
 
-    // IMU_CALIBMODE_NEVER, IMU_CALIBMODE_ONCE or IMU_CALIBMODE_PERIODIC
+    // IMU_CALIBMODE_NEVER, IMU_CALIBMODE_ONCE, IMU_CALIBMODE_PERIODIC or IMU_CALIBMODE_ONLINE
     int8_t _calibration_mode;
+
+    // online gyro bias, copied to gyro_offset after every stationary window in IMU_CALIBMODE_ONLINE
+    imu_bias_t bias;
     
     // flags: IMU_ESTIMODE_GYRO, IMU_ESTIMODE_ACCELEROMETER or IMU_ESTIMODE_MAGNETOMETER (functionality disabled for now)
+    // plus one of IMU_ESTIMODE_COMPLEMENTARY, IMU_ESTIMODE_MADGWICK or IMU_ESTIMODE_MAHONY
     int8_t _estimation_mode;
 
+    // filter gains: complementary alpha, madgwick beta, mahony kp and ki
+    float _alpha;
+    float _beta;
+    float _kp;
+    float _ki;
+
+    // mahony integral feedback
+    imu_vec3_t _integral_error;
+
 } imu_t;
 
 
@@ -109,6 +139,15 @@ void imu_main_loop(imu_t * imu);
 ////////////////////////////////////////////
 
 
+/// same as imu_main_loop() for a sample taken at timestamp (nanoseconds, any
+/// monotonic clock as long as it is always the same one). gyro is integrated
+/// over the time between samples instead of the time between calls.
+void imu_main_loop_ts(imu_t * imu, uint64_t timestamp);
+
+
+////////////////////////////////////////////
+
+
 imu_t imu_init();
 
 
@@ -163,6 +202,41 @@ void imu_process_raw_data(imu_t * imu);
 ////////////////////////////////////////////
 
 
+/// derived outputs of the last update, computed on the first call after it
+/// and cached until the next one.
+imu_euler_t imu_get_orientation(imu_t * imu);
+imu_mat3_t imu_get_rotation(imu_t * imu);
+imu_vec3_t imu_get_world_accelerometer(imu_t * imu);
+
+
+////////////////////////////////////////////
+
+
+/// current gyro bias in deg/s, returns its standard error in deg/s.
+float imu_get_gyro_bias(const imu_t * imu, imu_vec3_t * bias);
+
+
+////////////////////////////////////////////
+
+
+/// processes the current raw data integrating gyro over dt seconds.
+void imu_process_raw_data_dt(imu_t * imu, float dt);
+
+
+////////////////////////////////////////////
+
+
+/// the same for one filter only, the filter math is inlined with no dispatch.
+/// building with -DIMU_FILTER=IMU_ESTIMODE_... pins imu_process_raw_data_dt()
+/// to one of these and leaves the filter bits of the estimation mode unused.
+void imu_process_raw_data_complementary(imu_t * imu, float dt);
+void imu_process_raw_data_madgwick(imu_t * imu, float dt);
+void imu_process_raw_data_mahony(imu_t * imu, float dt);
+
+
+////////////////////////////////////////////
+
+
 void imu_set_gyro_scale_factor(imu_t * imu, float scalefactor);
 
 
@@ -1,4 +1,5 @@
 #include "imu_algebra.h"
+#include "imu_rsqrt.h"
 
 ////////////////////////////////////////////
 
@@ -67,7 +68,7 @@ imu_vec3_t imu_vec3_cross(const imu_vec3_t * v1, const imu_vec3_t * v2)
 
 imu_vec3_t imu_vec3_normalize(const imu_vec3_t * v)
 {
-    float multiplier = imu_math_fast_inv_sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    float multiplier = imu_rsqrt(v->x * v->x + v->y * v->y + v->z * v->z);
     return imu_vec3_create(v->x * multiplier, v->y * multiplier, v->z * multiplier);
 }
 
@@ -86,7 +87,7 @@ imu_vec3_t imu_vec3_scale(const imu_vec3_t * q, float multiplier)
 
 float imu_vec3_length(const imu_vec3_t * v)
 {
-    return sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    return sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
 }
 
 
@@ -152,7 +153,7 @@ imu_quaternion_t imu_quaternion_inverse(const imu_quaternion_t * q)
 
 imu_quaternion_t imu_quaternion_normalize(const imu_quaternion_t * q)
 {
-    float multiplier = imu_math_fast_inv_sqrt(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
+    float multiplier = imu_rsqrt(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
     return imu_quaternion_create(q->w * multiplier, q->x * multiplier, q->y * multiplier, q->z * multiplier);
 }
 
@@ -173,27 +174,139 @@ float * imu_quaternion_to_rotation_mat(const imu_quaternion_t * q)
 {
     float * matrix = malloc(16 * sizeof(float));
 
-    matrix[0] = 1.0f - 2.0f*q->y*q->y - 2.0f*q->z*q->z;
-    matrix[1] = 2.0f*q->x*q->y - 2.0f*q->z*q->w;
-    matrix[2] = 2.0f*q->x*q->z + 2.0f*q->y*q->w;
-    matrix[3] = 0;
+    if(matrix != NULL)
+        imu_quaternion_to_mat4_into(q, matrix);
 
-    matrix[4] = 2.0f*q->x*q->y + 2.0f*q->z*q->w;
-    matrix[5] = 1.0f - 2.0f*q->x*q->x - 2.0f*q->z*q->z;
-    matrix[6] = 2.0f*q->y*q->z - 2.0f*q->x*q->w;
-    matrix[7] = 0;
+    return matrix;
+}
 
-    matrix[8] = 2.0f*q->x*q->z - 2.0f*q->y*q->w;
-    matrix[9] = 2.0f*q->y*q->z + 2.0f*q->x*q->w;
-    matrix[10] = 1.0f - 2.0f*q->x*q->x - 2.0f*q->y*q->y;
-    matrix[11] = 0;
 
-    matrix[12] = 0;
-    matrix[13] = 0;
-    matrix[14] = 0;
-    matrix[15] = 1;
+////////////////////////////////////////////
 
-    return matrix;
+
+void imu_quaternion_to_mat3_into(const imu_quaternion_t * q, float * m)
+{
+    float xx = q->x * q->x, yy = q->y * q->y, zz = q->z * q->z;
+    float xy = q->x * q->y, xz = q->x * q->z, yz = q->y * q->z;
+    float wx = q->w * q->x, wy = q->w * q->y, wz = q->w * q->z;
+
+    m[0] = 1.0f - 2.0f * (yy + zz);
+    m[1] = 2.0f * (xy - wz);
+    m[2] = 2.0f * (xz + wy);
+
+    m[3] = 2.0f * (xy + wz);
+    m[4] = 1.0f - 2.0f * (xx + zz);
+    m[5] = 2.0f * (yz - wx);
+
+    m[6] = 2.0f * (xz - wy);
+    m[7] = 2.0f * (yz + wx);
+    m[8] = 1.0f - 2.0f * (xx + yy);
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_quaternion_to_mat4_into(const imu_quaternion_t * q, float * m)
+{
+    float r[9];
+
+    imu_quaternion_to_mat3_into(q, r);
+
+    m[0] = r[0];
+    m[1] = r[1];
+    m[2] = r[2];
+    m[3] = 0;
+
+    m[4] = r[3];
+    m[5] = r[4];
+    m[6] = r[5];
+    m[7] = 0;
+
+    m[8] = r[6];
+    m[9] = r[7];
+    m[10] = r[8];
+    m[11] = 0;
+
+    m[12] = 0;
+    m[13] = 0;
+    m[14] = 0;
+    m[15] = 1;
+}
+
+
+////////////////////////////////////////////
+
+
+imu_mat3_t imu_quaternion_to_mat3(const imu_quaternion_t * q)
+{
+    imu_mat3_t m;
+    imu_quaternion_to_mat3_into(q, m.m);
+    return m;
+}
+
+
+////////////////////////////////////////////
+
+
+imu_mat4_t imu_quaternion_to_mat4(const imu_quaternion_t * q)
+{
+    imu_mat4_t m;
+    imu_quaternion_to_mat4_into(q, m.m);
+    return m;
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_quaternion_to_mat3_array(const imu_quaternion_t * q, imu_mat3_t * m, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        imu_quaternion_to_mat3_into(&q[i], m[i].m);
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_quaternion_to_mat4_array(const imu_quaternion_t * q, imu_mat4_t * m, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        imu_quaternion_to_mat4_into(&q[i], m[i].m);
+}
+
+
+////////////////////////////////////////////
+
+
+imu_vec3_t imu_mat3_rotate_vector(const imu_mat3_t * m, const imu_vec3_t * v)
+{
+    return imu_vec3_create(
+        m->m[0] * v->x + m->m[1] * v->y + m->m[2] * v->z,
+        m->m[3] * v->x + m->m[4] * v->y + m->m[5] * v->z,
+        m->m[6] * v->x + m->m[7] * v->y + m->m[8] * v->z
+    );
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_mat3_rotate_vectors(const imu_mat3_t * m, imu_vec3_t * out, const imu_vec3_t * in, size_t n)
+{
+    const float m0 = m->m[0], m1 = m->m[1], m2 = m->m[2];
+    const float m3 = m->m[3], m4 = m->m[4], m5 = m->m[5];
+    const float m6 = m->m[6], m7 = m->m[7], m8 = m->m[8];
+
+    for(size_t i = 0; i < n; i++)
+    {
+        float x = in[i].x, y = in[i].y, z = in[i].z;
+
+        out[i].x = m0 * x + m1 * y + m2 * z;
+        out[i].y = m3 * x + m4 * y + m5 * z;
+        out[i].z = m6 * x + m7 * y + m8 * z;
+    }
 }
 
 
@@ -202,11 +315,8 @@ float * imu_quaternion_to_rotation_mat(const imu_quaternion_t * q)
 
 imu_vec3_t imu_quaternion_rotate_vector(const imu_quaternion_t * q, imu_vec3_t * v)
 {
-    imu_quaternion_t qv = imu_quaternion_create(0., v->x, v->y, v->z);
-    imu_quaternion_t qinv = imu_quaternion_conjugate(&qv);
-    imu_quaternion_t tmp = imu_quaternion_product(q, &qv);
-    imu_quaternion_t vrot = imu_quaternion_product(&tmp, &qinv);
-    return imu_vec3_create(vrot.x, vrot.y, vrot.z);
+    imu_mat3_t m = imu_quaternion_to_mat3(q);
+    return imu_mat3_rotate_vector(&m, v);
 }
 
 
@@ -216,9 +326,9 @@ imu_vec3_t imu_quaternion_rotate_vector(const imu_quaternion_t * q, imu_vec3_t *
 imu_euler_t imu_quaternion_to_euler(const imu_quaternion_t * q)
 {
     imu_euler_t e;
-    e.roll = atan2(2 * (q->w* q->x + q->y * q->z), 1 - 2 * (q->x * q->x + q->y * q->y));
-    e.pitch = asin(2 * (q->w * q->y - q->z * q->x));
-    e.yaw = q->z == 0 ? 0.0 : atan2(2 * (q->w * q->z + q->x * q->y), 1- 2 * (q->y * q->y + q->z * q->z));
+    e.roll = atan2f(2.f * (q->w* q->x + q->y * q->z), 1.f - 2.f * (q->x * q->x + q->y * q->y));
+    e.pitch = asinf(2.f * (q->w * q->y - q->z * q->x));
+    e.yaw = q->z == 0.f ? 0.f : atan2f(2.f * (q->w * q->z + q->x * q->y), 1.f - 2.f * (q->y * q->y + q->z * q->z));
     return e;
 }
 
@@ -228,7 +338,7 @@ imu_euler_t imu_quaternion_to_euler(const imu_quaternion_t * q)
 
 float imu_quaternion_length(const imu_quaternion_t * q)
 {
-    return sqrt(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
+    return sqrtf(q->w * q->w + q->x * q->x + q->y * q->y + q->z * q->z);
 }
 
 
@@ -243,4 +353,38 @@ imu_quaternion_t imu_quaternion_rotate_vector_quaternion(const imu_quaternion_t
 }
 
 
+////////////////////////////////////////////
+
+
+imu_quaternion_t imu_quaternion_slerp(const imu_quaternion_t * q1, const imu_quaternion_t * q2, float t)
+{
+    imu_quaternion_t q;
+    float dot = q1->w * q2->w + q1->x * q2->x + q1->y * q2->y + q1->z * q2->z;
+    float sign = 1.f, s1, s2;
+
+    // q and -q are the same rotation, take the shorter arc
+    if(dot < 0.f)
+    {
+        dot = -dot;
+        sign = -1.f;
+    }
+
+    if(dot > 0.9995f)
+    {
+        // nearly parallel, linear interpolation is accurate and avoids sin(0)
+        s1 = 1.f - t;
+        s2 = t * sign;
+        q = imu_quaternion_create(s1 * q1->w + s2 * q2->w, s1 * q1->x + s2 * q2->x, s1 * q1->y + s2 * q2->y, s1 * q1->z + s2 * q2->z);
+        return imu_quaternion_normalize(&q);
+    }
+
+    float theta = acosf(dot);
+    float inv_sin = 1.f / sinf(theta);
+    s1 = sinf((1.f - t) * theta) * inv_sin;
+    s2 = sinf(t * theta) * inv_sin * sign;
+
+    return imu_quaternion_create(s1 * q1->w + s2 * q2->w, s1 * q1->x + s2 * q2->x, s1 * q1->y + s2 * q2->y, s1 * q1->z + s2 * q2->z);
+}
+
+
 ////////////////////////////////////////////
\ No newline at end of file
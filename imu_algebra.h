@@ -119,7 +119,46 @@ imu_quaternion_t imu_quaternion_inverse(const imu_quaternion_t * q);
 ////////////////////////////////////////////
 
 
-float * imu_quaternion_to_rotation_mat(const imu_quaternion_t * q);
+/// returns a malloc'd row-major 4x4 matrix the caller must free.
+/// deprecated, use imu_quaternion_to_mat4() or imu_quaternion_to_mat4_into().
+float * imu_quaternion_to_rotation_mat(const imu_quaternion_t * q) __attribute__((deprecated));
+
+
+////////////////////////////////////////////
+
+
+/// rotation matrix of the unit quaternion q, written to caller storage (9 or 16 floats, row-major).
+void imu_quaternion_to_mat3_into(const imu_quaternion_t * q, float * m);
+void imu_quaternion_to_mat4_into(const imu_quaternion_t * q, float * m);
+
+
+////////////////////////////////////////////
+
+
+imu_mat3_t imu_quaternion_to_mat3(const imu_quaternion_t * q);
+imu_mat4_t imu_quaternion_to_mat4(const imu_quaternion_t * q);
+
+
+////////////////////////////////////////////
+
+
+/// converts q[0..n) into the contiguous array m[0..n).
+void imu_quaternion_to_mat3_array(const imu_quaternion_t * q, imu_mat3_t * m, size_t n);
+void imu_quaternion_to_mat4_array(const imu_quaternion_t * q, imu_mat4_t * m, size_t n);
+
+
+////////////////////////////////////////////
+
+
+imu_vec3_t imu_mat3_rotate_vector(const imu_mat3_t * m, const imu_vec3_t * v);
+
+
+////////////////////////////////////////////
+
+
+/// rotates in[0..n) by the same matrix, out may alias in.
+/// 9 multiplications per vector against 32 for the double quaternion product.
+void imu_mat3_rotate_vectors(const imu_mat3_t * m, imu_vec3_t * out, const imu_vec3_t * in, size_t n);
 
 
 ////////////////////////////////////////////
@@ -158,6 +197,13 @@ float imu_quaternion_length(const imu_quaternion_t * q);
 imu_quaternion_t imu_quaternion_rotate_vector_quaternion(const imu_quaternion_t * q, const imu_quaternion_t * qu);
 
 
+////////////////////////////////////////////
+
+
+/// spherical linear interpolation between unit quaternions, t = 0 gives q1 and t = 1 gives q2.
+imu_quaternion_t imu_quaternion_slerp(const imu_quaternion_t * q1, const imu_quaternion_t * q2, float t);
+
+
 ////////////////////////////////////////////
 
 #ifdef __cplusplus
@@ -0,0 +1,424 @@
+#include "imu_batch.h"
+#include "imu_math.h"
+#include "imu_simd.h"
+#include "imu_rsqrt.h"
+
+////////////////////////////////////////////
+
+
+#define W IMU_SIMD_WIDTH
+
+// keeps the reciprocal square root of a zero length finite, a zero vector
+// then normalizes to zero like it does with imu_rsqrt()
+#define IMU_BATCH_TINY IMU_RSQRT_TINY
+
+// the element count is rarely a multiple of the vector width, the last partial
+// block is copied into these, padded, processed as a full block and copied back
+typedef struct imu_quaternion_lanes { float w[W], x[W], y[W], z[W]; } imu_quaternion_lanes_t;
+typedef struct imu_vec3_lanes { float x[W], y[W], z[W]; } imu_vec3_lanes_t;
+typedef struct imu_euler_lanes { float roll[W], pitch[W], yaw[W]; } imu_euler_lanes_t;
+typedef struct imu_scalar_lanes { float s[W]; } imu_scalar_lanes_t;
+
+
+////////////////////////////////////////////
+
+
+static imu_quaternion_soa_t quaternion_lanes(imu_quaternion_lanes_t * l, const imu_quaternion_soa_t * q, size_t i, size_t k)
+{
+    imu_quaternion_soa_t s = { l->w, l->x, l->y, l->z };
+
+    for(size_t j = 0; j < W; j++)
+    {
+        l->w[j] = (q != NULL && j < k) ? q->w[i + j] : 1.f;
+        l->x[j] = (q != NULL && j < k) ? q->x[i + j] : 0.f;
+        l->y[j] = (q != NULL && j < k) ? q->y[i + j] : 0.f;
+        l->z[j] = (q != NULL && j < k) ? q->z[i + j] : 0.f;
+    }
+
+    return s;
+}
+
+
+////////////////////////////////////////////
+
+
+static void quaternion_lanes_store(const imu_quaternion_lanes_t * l, const imu_quaternion_soa_t * q, size_t i, size_t k)
+{
+    for(size_t j = 0; j < k; j++)
+    {
+        q->w[i + j] = l->w[j];
+        q->x[i + j] = l->x[j];
+        q->y[i + j] = l->y[j];
+        q->z[i + j] = l->z[j];
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+static imu_vec3_soa_t vec3_lanes(imu_vec3_lanes_t * l, const imu_vec3_soa_t * v, size_t i, size_t k)
+{
+    imu_vec3_soa_t s = { l->x, l->y, l->z };
+
+    for(size_t j = 0; j < W; j++)
+    {
+        l->x[j] = (v != NULL && j < k) ? v->x[i + j] : 0.f;
+        l->y[j] = (v != NULL && j < k) ? v->y[i + j] : 0.f;
+        l->z[j] = (v != NULL && j < k) ? v->z[i + j] : 0.f;
+    }
+
+    return s;
+}
+
+
+////////////////////////////////////////////
+
+
+static void vec3_lanes_store(const imu_vec3_lanes_t * l, const imu_vec3_soa_t * v, size_t i, size_t k)
+{
+    for(size_t j = 0; j < k; j++)
+    {
+        v->x[i + j] = l->x[j];
+        v->y[i + j] = l->y[j];
+        v->z[i + j] = l->z[j];
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+static void quaternion_product_block(const imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q1, const imu_quaternion_soa_t * q2, size_t i)
+{
+    imu_vf_t aw = imu_vf_load(q1->w + i), ax = imu_vf_load(q1->x + i), ay = imu_vf_load(q1->y + i), az = imu_vf_load(q1->z + i);
+    imu_vf_t bw = imu_vf_load(q2->w + i), bx = imu_vf_load(q2->x + i), by = imu_vf_load(q2->y + i), bz = imu_vf_load(q2->z + i);
+
+    imu_vf_t rw = imu_vf_sub(imu_vf_sub(imu_vf_sub(imu_vf_mul(aw, bw), imu_vf_mul(ax, bx)), imu_vf_mul(ay, by)), imu_vf_mul(az, bz));
+    imu_vf_t rx = imu_vf_sub(imu_vf_add(imu_vf_add(imu_vf_mul(aw, bx), imu_vf_mul(ax, bw)), imu_vf_mul(ay, bz)), imu_vf_mul(az, by));
+    imu_vf_t ry = imu_vf_add(imu_vf_add(imu_vf_sub(imu_vf_mul(aw, by), imu_vf_mul(ax, bz)), imu_vf_mul(ay, bw)), imu_vf_mul(az, bx));
+    imu_vf_t rz = imu_vf_add(imu_vf_sub(imu_vf_add(imu_vf_mul(aw, bz), imu_vf_mul(ax, by)), imu_vf_mul(ay, bx)), imu_vf_mul(az, bw));
+
+    imu_vf_store(out->w + i, rw);
+    imu_vf_store(out->x + i, rx);
+    imu_vf_store(out->y + i, ry);
+    imu_vf_store(out->z + i, rz);
+}
+
+
+////////////////////////////////////////////
+
+
+static void quaternion_normalize_block(const imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q, size_t i)
+{
+    imu_vf_t w = imu_vf_load(q->w + i), x = imu_vf_load(q->x + i), y = imu_vf_load(q->y + i), z = imu_vf_load(q->z + i);
+    imu_vf_t len2 = imu_vf_add(imu_vf_add(imu_vf_mul(w, w), imu_vf_mul(x, x)), imu_vf_add(imu_vf_mul(y, y), imu_vf_mul(z, z)));
+    imu_vf_t m = imu_vf_rsqrt(imu_vf_max(len2, imu_vf_set1(IMU_BATCH_TINY)));
+
+    imu_vf_store(out->w + i, imu_vf_mul(w, m));
+    imu_vf_store(out->x + i, imu_vf_mul(x, m));
+    imu_vf_store(out->y + i, imu_vf_mul(y, m));
+    imu_vf_store(out->z + i, imu_vf_mul(z, m));
+}
+
+
+////////////////////////////////////////////
+
+
+static void vec3_normalize_block(const imu_vec3_soa_t * out, const imu_vec3_soa_t * v, size_t i)
+{
+    imu_vf_t x = imu_vf_load(v->x + i), y = imu_vf_load(v->y + i), z = imu_vf_load(v->z + i);
+    imu_vf_t len2 = imu_vf_add(imu_vf_add(imu_vf_mul(x, x), imu_vf_mul(y, y)), imu_vf_mul(z, z));
+    imu_vf_t m = imu_vf_rsqrt(imu_vf_max(len2, imu_vf_set1(IMU_BATCH_TINY)));
+
+    imu_vf_store(out->x + i, imu_vf_mul(x, m));
+    imu_vf_store(out->y + i, imu_vf_mul(y, m));
+    imu_vf_store(out->z + i, imu_vf_mul(z, m));
+}
+
+
+////////////////////////////////////////////
+
+
+static void quaternion_rotate_vector_block(const imu_vec3_soa_t * out, const imu_quaternion_soa_t * q, const imu_vec3_soa_t * v, size_t i)
+{
+    imu_vf_t qw = imu_vf_load(q->w + i), qx = imu_vf_load(q->x + i), qy = imu_vf_load(q->y + i), qz = imu_vf_load(q->z + i);
+    imu_vf_t vx = imu_vf_load(v->x + i), vy = imu_vf_load(v->y + i), vz = imu_vf_load(v->z + i);
+    imu_vf_t two = imu_vf_set1(2.f);
+
+    // v' = v + w t + q_v x t, with t = 2 q_v x v
+    imu_vf_t tx = imu_vf_mul(two, imu_vf_sub(imu_vf_mul(qy, vz), imu_vf_mul(qz, vy)));
+    imu_vf_t ty = imu_vf_mul(two, imu_vf_sub(imu_vf_mul(qz, vx), imu_vf_mul(qx, vz)));
+    imu_vf_t tz = imu_vf_mul(two, imu_vf_sub(imu_vf_mul(qx, vy), imu_vf_mul(qy, vx)));
+
+    imu_vf_store(out->x + i, imu_vf_add(imu_vf_add(vx, imu_vf_mul(qw, tx)), imu_vf_sub(imu_vf_mul(qy, tz), imu_vf_mul(qz, ty))));
+    imu_vf_store(out->y + i, imu_vf_add(imu_vf_add(vy, imu_vf_mul(qw, ty)), imu_vf_sub(imu_vf_mul(qz, tx), imu_vf_mul(qx, tz))));
+    imu_vf_store(out->z + i, imu_vf_add(imu_vf_add(vz, imu_vf_mul(qw, tz)), imu_vf_sub(imu_vf_mul(qx, ty), imu_vf_mul(qy, tx))));
+}
+
+
+////////////////////////////////////////////
+
+
+static void quaternion_to_euler_block(const imu_euler_soa_t * out, const imu_quaternion_soa_t * q, size_t i)
+{
+    float sinr[W], cosr[W], sinp[W], siny[W], cosy[W];
+    imu_vf_t w = imu_vf_load(q->w + i), x = imu_vf_load(q->x + i), y = imu_vf_load(q->y + i), z = imu_vf_load(q->z + i);
+    imu_vf_t one = imu_vf_set1(1.f), two = imu_vf_set1(2.f);
+
+    imu_vf_store(sinr, imu_vf_mul(two, imu_vf_add(imu_vf_mul(w, x), imu_vf_mul(y, z))));
+    imu_vf_store(cosr, imu_vf_sub(one, imu_vf_mul(two, imu_vf_add(imu_vf_mul(x, x), imu_vf_mul(y, y)))));
+    imu_vf_store(sinp, imu_vf_max(imu_vf_set1(-1.f), imu_vf_min(one, imu_vf_mul(two, imu_vf_sub(imu_vf_mul(w, y), imu_vf_mul(z, x))))));
+    imu_vf_store(siny, imu_vf_mul(two, imu_vf_add(imu_vf_mul(w, z), imu_vf_mul(x, y))));
+    imu_vf_store(cosy, imu_vf_sub(one, imu_vf_mul(two, imu_vf_add(imu_vf_mul(y, y), imu_vf_mul(z, z)))));
+
+    // no vector transcendental functions, the angles are taken lane by lane
+    for(size_t j = 0; j < W; j++)
+    {
+        out->roll[i + j] = atan2f(sinr[j], cosr[j]);
+        out->pitch[i + j] = asinf(sinp[j]);
+        out->yaw[i + j] = q->z[i + j] == 0.f ? 0.f : atan2f(siny[j], cosy[j]);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+static void complementary_step_block(const imu_quaternion_soa_t * q, const imu_vec3_soa_t * gyro, const imu_vec3_soa_t * accel, const float * dt, float alpha, size_t i)
+{
+    float ang[W], c[W], s[W];
+    const imu_vf_t tiny = imu_vf_set1(IMU_BATCH_TINY);
+
+    ////////////////////////////////////////////
+    // gyro integration
+    ////////////////////////////////////////////
+
+    imu_vf_t gx = imu_vf_load(gyro->x + i), gy = imu_vf_load(gyro->y + i), gz = imu_vf_load(gyro->z + i);
+    imu_vf_t g2 = imu_vf_max(imu_vf_add(imu_vf_add(imu_vf_mul(gx, gx), imu_vf_mul(gy, gy)), imu_vf_mul(gz, gz)), tiny);
+    imu_vf_t ginv = imu_vf_rsqrt(g2);
+
+    // half rotation angle in radians, |g| = |g|^2 / |g|
+    imu_vf_store(ang, imu_vf_mul(imu_vf_mul(imu_vf_load(dt + i), imu_vf_mul(g2, ginv)), imu_vf_set1((float)(PI / 360.))));
+
+    for(size_t j = 0; j < W; j++)
+    {
+        c[j] = cosf(ang[j]);
+        s[j] = sinf(ang[j]);
+    }
+
+    imu_vf_t rs = imu_vf_mul(imu_vf_load(s), ginv);
+    imu_vf_t rw = imu_vf_load(c), rx = imu_vf_mul(gx, rs), ry = imu_vf_mul(gy, rs), rz = imu_vf_mul(gz, rs);
+
+    imu_vf_t aw = imu_vf_load(q->w + i), ax = imu_vf_load(q->x + i), ay = imu_vf_load(q->y + i), az = imu_vf_load(q->z + i);
+
+    // integrated gyro quaternion qw = q * rotation
+    imu_vf_t ww = imu_vf_sub(imu_vf_sub(imu_vf_sub(imu_vf_mul(aw, rw), imu_vf_mul(ax, rx)), imu_vf_mul(ay, ry)), imu_vf_mul(az, rz));
+    imu_vf_t wx = imu_vf_sub(imu_vf_add(imu_vf_add(imu_vf_mul(aw, rx), imu_vf_mul(ax, rw)), imu_vf_mul(ay, rz)), imu_vf_mul(az, ry));
+    imu_vf_t wy = imu_vf_add(imu_vf_add(imu_vf_sub(imu_vf_mul(aw, ry), imu_vf_mul(ax, rz)), imu_vf_mul(ay, rw)), imu_vf_mul(az, rx));
+    imu_vf_t wz = imu_vf_add(imu_vf_sub(imu_vf_add(imu_vf_mul(aw, rz), imu_vf_mul(ax, ry)), imu_vf_mul(ay, rx)), imu_vf_mul(az, rw));
+
+    ////////////////////////////////////////////
+    // complementary filter
+    ////////////////////////////////////////////
+
+    imu_vf_t bx = imu_vf_load(accel->x + i), by = imu_vf_load(accel->y + i), bz = imu_vf_load(accel->z + i);
+
+    // p = qw * (0, accel)
+    imu_vf_t pw = imu_vf_sub(imu_vf_sub(imu_vf_set1(0.f), imu_vf_mul(wx, bx)), imu_vf_add(imu_vf_mul(wy, by), imu_vf_mul(wz, bz)));
+    imu_vf_t px = imu_vf_sub(imu_vf_add(imu_vf_mul(ww, bx), imu_vf_mul(wy, bz)), imu_vf_mul(wz, by));
+    imu_vf_t py = imu_vf_add(imu_vf_sub(imu_vf_mul(ww, by), imu_vf_mul(wx, bz)), imu_vf_mul(wz, bx));
+    imu_vf_t pz = imu_vf_sub(imu_vf_add(imu_vf_mul(ww, bz), imu_vf_mul(wx, by)), imu_vf_mul(wy, bx));
+
+    // world = p * conj(qw), scaled by 1/|qw|^2 as imu_quaternion_inverse() does.
+    // w of the result is ~0 but still enters the normalization like in the scalar path
+    imu_vf_t vw = imu_vf_add(imu_vf_add(imu_vf_mul(pw, ww), imu_vf_mul(px, wx)), imu_vf_add(imu_vf_mul(py, wy), imu_vf_mul(pz, wz)));
+    imu_vf_t vx = imu_vf_add(imu_vf_sub(imu_vf_mul(px, ww), imu_vf_mul(pw, wx)), imu_vf_sub(imu_vf_mul(pz, wy), imu_vf_mul(py, wz)));
+    imu_vf_t vy = imu_vf_add(imu_vf_sub(imu_vf_mul(py, ww), imu_vf_mul(pw, wy)), imu_vf_sub(imu_vf_mul(px, wz), imu_vf_mul(pz, wx)));
+    imu_vf_t vz = imu_vf_add(imu_vf_sub(imu_vf_mul(pz, ww), imu_vf_mul(pw, wz)), imu_vf_sub(imu_vf_mul(py, wx), imu_vf_mul(px, wy)));
+
+    // the 1/|qw|^2 scale cancels in the normalization
+    imu_vf_t vinv = imu_vf_rsqrt(imu_vf_max(imu_vf_add(imu_vf_add(imu_vf_mul(vw, vw), imu_vf_mul(vx, vx)), imu_vf_add(imu_vf_mul(vy, vy), imu_vf_mul(vz, vz))), tiny));
+    vx = imu_vf_mul(vx, vinv);
+    vy = imu_vf_mul(vy, vinv);
+    vz = imu_vf_mul(vz, vinv);
+
+    // tilt axis n = v x up = (vy, -vx, 0), tilt angle acos(v . up) = acos(vz)
+    imu_vf_t ninv = imu_vf_rsqrt(imu_vf_max(imu_vf_add(imu_vf_mul(vx, vx), imu_vf_mul(vy, vy)), tiny));
+    imu_vf_t nx = imu_vf_mul(vy, ninv), ny = imu_vf_mul(imu_vf_sub(imu_vf_set1(0.f), vx), ninv);
+
+    imu_vf_store(ang, imu_vf_max(imu_vf_set1(-1.f), imu_vf_min(imu_vf_set1(1.f), vz)));
+
+    for(size_t j = 0; j < W; j++)
+    {
+        float tiltang_2 = acosf(ang[j]) * (1.f - alpha) * 0.5f;
+        c[j] = cosf(tiltang_2);
+        s[j] = sinf(tiltang_2);
+    }
+
+    // tilt correction quaternion qt = (c, n s), result qt * qw
+    imu_vf_t tw = imu_vf_load(c), ts = imu_vf_load(s);
+    imu_vf_t tx = imu_vf_mul(nx, ts), ty = imu_vf_mul(ny, ts);
+
+    imu_vf_store(q->w + i, imu_vf_sub(imu_vf_sub(imu_vf_mul(tw, ww), imu_vf_mul(tx, wx)), imu_vf_mul(ty, wy)));
+    imu_vf_store(q->x + i, imu_vf_add(imu_vf_add(imu_vf_mul(tw, wx), imu_vf_mul(tx, ww)), imu_vf_mul(ty, wz)));
+    imu_vf_store(q->y + i, imu_vf_add(imu_vf_sub(imu_vf_mul(tw, wy), imu_vf_mul(tx, wz)), imu_vf_mul(ty, ww)));
+    imu_vf_store(q->z + i, imu_vf_sub(imu_vf_add(imu_vf_mul(tw, wz), imu_vf_mul(tx, wy)), imu_vf_mul(ty, wx)));
+}
+
+
+////////////////////////////////////////////
+
+
+const char * imu_batch_simd_name(void)
+{
+    return IMU_SIMD_NAME;
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_product(imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q1, const imu_quaternion_soa_t * q2, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        quaternion_product_block(out, q1, q2, i);
+
+    if(i < n)
+    {
+        imu_quaternion_lanes_t l1, l2, lo;
+        imu_quaternion_soa_t t1 = quaternion_lanes(&l1, q1, i, n - i);
+        imu_quaternion_soa_t t2 = quaternion_lanes(&l2, q2, i, n - i);
+        imu_quaternion_soa_t to = quaternion_lanes(&lo, NULL, 0, 0);
+
+        quaternion_product_block(&to, &t1, &t2, 0);
+        quaternion_lanes_store(&lo, out, i, n - i);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_normalize(imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        quaternion_normalize_block(out, q, i);
+
+    if(i < n)
+    {
+        imu_quaternion_lanes_t l;
+        imu_quaternion_soa_t t = quaternion_lanes(&l, q, i, n - i);
+
+        quaternion_normalize_block(&t, &t, 0);
+        quaternion_lanes_store(&l, out, i, n - i);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_vec3_normalize(imu_vec3_soa_t * out, const imu_vec3_soa_t * v, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        vec3_normalize_block(out, v, i);
+
+    if(i < n)
+    {
+        imu_vec3_lanes_t l;
+        imu_vec3_soa_t t = vec3_lanes(&l, v, i, n - i);
+
+        vec3_normalize_block(&t, &t, 0);
+        vec3_lanes_store(&l, out, i, n - i);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_rotate_vector(imu_vec3_soa_t * out, const imu_quaternion_soa_t * q, const imu_vec3_soa_t * v, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        quaternion_rotate_vector_block(out, q, v, i);
+
+    if(i < n)
+    {
+        imu_quaternion_lanes_t lq;
+        imu_vec3_lanes_t lv;
+        imu_quaternion_soa_t tq = quaternion_lanes(&lq, q, i, n - i);
+        imu_vec3_soa_t tv = vec3_lanes(&lv, v, i, n - i);
+
+        quaternion_rotate_vector_block(&tv, &tq, &tv, 0);
+        vec3_lanes_store(&lv, out, i, n - i);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_to_euler(imu_euler_soa_t * out, const imu_quaternion_soa_t * q, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        quaternion_to_euler_block(out, q, i);
+
+    if(i < n)
+    {
+        imu_quaternion_lanes_t lq;
+        imu_euler_lanes_t le;
+        imu_quaternion_soa_t tq = quaternion_lanes(&lq, q, i, n - i);
+        imu_euler_soa_t te = { le.roll, le.pitch, le.yaw };
+
+        quaternion_to_euler_block(&te, &tq, 0);
+
+        for(size_t j = 0; j < n - i; j++)
+        {
+            out->roll[i + j] = le.roll[j];
+            out->pitch[i + j] = le.pitch[j];
+            out->yaw[i + j] = le.yaw[j];
+        }
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_complementary_step(imu_quaternion_soa_t * q, const imu_vec3_soa_t * gyro, const imu_vec3_soa_t * accel, const float * dt, float alpha, size_t n)
+{
+    size_t i = 0;
+
+    for(; i + W <= n; i += W)
+        complementary_step_block(q, gyro, accel, dt, alpha, i);
+
+    if(i < n)
+    {
+        imu_quaternion_lanes_t lq;
+        imu_vec3_lanes_t lg, la;
+        imu_scalar_lanes_t ldt = {{ 0.f }};
+        imu_quaternion_soa_t tq = quaternion_lanes(&lq, q, i, n - i);
+        imu_vec3_soa_t tg = vec3_lanes(&lg, gyro, i, n - i);
+        imu_vec3_soa_t ta = vec3_lanes(&la, accel, i, n - i);
+
+        for(size_t j = 0; j < n - i; j++)
+            ldt.s[j] = dt[i + j];
+
+        complementary_step_block(&tq, &tg, &ta, ldt.s, alpha, 0);
+        quaternion_lanes_store(&lq, q, i, n - i);
+    }
+}
+
+
+////////////////////////////////////////////
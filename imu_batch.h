@@ -0,0 +1,74 @@
+#ifndef IMU_BATCH_H
+#define IMU_BATCH_H
+
+#include <stddef.h>
+#include "imu_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// batch versions of the hot imu_algebra operations, for reprocessing recorded
+/// data. every function works on n elements laid out as structure-of-arrays and
+/// is vectorized with the instruction set selected in imu_simd.h. outputs may
+/// alias inputs.
+
+
+////////////////////////////////////////////
+
+
+/// name of the vector instruction set the kernels were built for.
+const char * imu_batch_simd_name(void);
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_product(imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q1, const imu_quaternion_soa_t * q2, size_t n);
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_normalize(imu_quaternion_soa_t * out, const imu_quaternion_soa_t * q, size_t n);
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_vec3_normalize(imu_vec3_soa_t * out, const imu_vec3_soa_t * v, size_t n);
+
+
+////////////////////////////////////////////
+
+
+/// rotates v[i] by the unit quaternion q[i].
+void imu_batch_quaternion_rotate_vector(imu_vec3_soa_t * out, const imu_quaternion_soa_t * q, const imu_vec3_soa_t * v, size_t n);
+
+
+////////////////////////////////////////////
+
+
+void imu_batch_quaternion_to_euler(imu_euler_soa_t * out, const imu_quaternion_soa_t * q, size_t n);
+
+
+////////////////////////////////////////////
+
+
+/// one complementary filter update, same math as imu_process_raw_data(), for n
+/// independent filter states (e.g. separate recordings or segments of one).
+/// gyro is offset-corrected and scaled (deg/s), accel scaled, dt in seconds.
+void imu_batch_complementary_step(imu_quaternion_soa_t * q, const imu_vec3_soa_t * gyro, const imu_vec3_soa_t * accel, const float * dt, float alpha, size_t n);
+
+
+////////////////////////////////////////////
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
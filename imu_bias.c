@@ -0,0 +1,111 @@
+#include <math.h>
+
+#include "imu_bias.h"
+#include "imu_algebra.h"
+#include "imu_constants.h"
+
+////////////////////////////////////////////
+
+
+static inline void welford(float x, uint32_t n, float * mean, float * m2)
+{
+    float d = x - *mean;
+    *mean += d / (float)n;
+    *m2 += d * (x - *mean);
+}
+
+
+////////////////////////////////////////////
+
+
+static inline void fold(float m, float var, uint32_t k, float * bias, float * bias_var)
+{
+    float d = m - *bias;
+    *bias += d / (float)k;
+    *bias_var += (d * (m - *bias) - *bias_var) / (float)k;
+
+    // a single window says nothing about the spread between windows, its own
+    // standard error is the best guess until there are more of them
+    if(k == 1)
+        *bias_var = var / IMU_BIAS_WINDOW;
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_bias_init(imu_bias_t * b, const imu_vec3_t * seed)
+{
+    b->n = 0;
+    b->mean = b->m2 = imu_vec3_create(0.f, 0.f, 0.f);
+    b->accel_mean = b->accel_m2 = 0.f;
+
+    b->bias = *seed;
+    b->bias_var = imu_vec3_create(0.f, 0.f, 0.f);
+    b->windows = 0;
+    b->stationary = 0;
+}
+
+
+////////////////////////////////////////////
+
+
+int imu_bias_update(imu_bias_t * b, const imu_vec3_t * gyro_raw, const imu_vec3_t * accelerometer_raw, float gyro_scale, float accelerometer_scale)
+{
+    const float n = IMU_BIAS_WINDOW - 1;
+    const float gyro_var_max = IMU_BIAS_GYRO_STD_MAX * IMU_BIAS_GYRO_STD_MAX / (gyro_scale * gyro_scale);
+    const float accel_var_max = IMU_BIAS_ACCEL_STD_MAX * IMU_BIAS_ACCEL_STD_MAX;
+    imu_vec3_t var;
+    uint32_t k;
+
+    b->n++;
+    welford(gyro_raw->x, b->n, &b->mean.x, &b->m2.x);
+    welford(gyro_raw->y, b->n, &b->mean.y, &b->m2.y);
+    welford(gyro_raw->z, b->n, &b->mean.z, &b->m2.z);
+    welford(imu_vec3_length(accelerometer_raw) * accelerometer_scale, b->n, &b->accel_mean, &b->accel_m2);
+
+    if(b->n < IMU_BIAS_WINDOW)
+        return 0;
+
+    var = imu_vec3_scale(&b->m2, 1.f / n);
+
+    b->stationary = var.x < gyro_var_max && var.y < gyro_var_max && var.z < gyro_var_max &&
+                    b->accel_m2 / n < accel_var_max;
+
+    if(b->stationary)
+    {
+        k = b->windows < IMU_BIAS_MAX_WINDOWS ? b->windows + 1 : IMU_BIAS_MAX_WINDOWS;
+
+        fold(b->mean.x, var.x, k, &b->bias.x, &b->bias_var.x);
+        fold(b->mean.y, var.y, k, &b->bias.y, &b->bias_var.y);
+        fold(b->mean.z, var.z, k, &b->bias.z, &b->bias_var.z);
+
+        b->windows++;
+    }
+
+    b->n = 0;
+    b->mean = b->m2 = imu_vec3_create(0.f, 0.f, 0.f);
+    b->accel_mean = b->accel_m2 = 0.f;
+
+    return b->stationary;
+}
+
+
+////////////////////////////////////////////
+
+
+float imu_bias_sigma(const imu_bias_t * b)
+{
+    uint32_t k = b->windows < IMU_BIAS_MAX_WINDOWS ? b->windows : IMU_BIAS_MAX_WINDOWS;
+    float v = b->bias_var.x;
+
+    if(k == 0)
+        return INFINITY;
+
+    if(b->bias_var.y > v)
+        v = b->bias_var.y;
+    if(b->bias_var.z > v)
+        v = b->bias_var.z;
+
+    return sqrtf(v / (float)k);
+}
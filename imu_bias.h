@@ -0,0 +1,72 @@
+#ifndef IMU_BIAS_H
+#define IMU_BIAS_H
+
+#include <stdint.h>
+
+#include "imu_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// streaming gyro bias estimator. raw samples are accumulated in windows of
+/// IMU_BIAS_WINDOW with Welford's algorithm, a window is stationary when the
+/// gyro and accelerometer norm spreads are under IMU_BIAS_GYRO_STD_MAX and
+/// IMU_BIAS_ACCEL_STD_MAX, and the mean of every stationary window is folded
+/// into the estimate with a memory of IMU_BIAS_MAX_WINDOWS windows.
+typedef struct imu_bias
+{
+    // current window, raw gyro units and accelerometer norm in g
+    uint32_t n;
+    imu_vec3_t mean;
+    imu_vec3_t m2;
+    float accel_mean;
+    float accel_m2;
+
+    // estimated bias in raw gyro units and variance of the window means around it
+    imu_vec3_t bias;
+    imu_vec3_t bias_var;
+
+    // stationary windows folded into bias so far
+    uint32_t windows;
+
+    // result of the last completed window
+    uint8_t stationary;
+
+} imu_bias_t;
+
+
+////////////////////////////////////////////
+
+
+/// starts from seed (raw gyro units) with no confidence in it.
+void imu_bias_init(imu_bias_t * b, const imu_vec3_t * seed);
+
+
+////////////////////////////////////////////
+
+
+/// accumulates one raw sample, constant time. returns 1 when a stationary
+/// window has just been folded into b->bias.
+int imu_bias_update(imu_bias_t * b, const imu_vec3_t * gyro_raw, const imu_vec3_t * accelerometer_raw, float gyro_scale, float accelerometer_scale);
+
+
+////////////////////////////////////////////
+
+
+/// largest standard error of the bias over the three axes, raw gyro units.
+/// infinite until the first stationary window.
+float imu_bias_sigma(const imu_bias_t * b);
+
+
+////////////////////////////////////////////
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
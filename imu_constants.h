@@ -40,16 +40,35 @@ extern "C" {
 #define IMU_CALIBMODE_NEVER         0x00
 #define IMU_CALIBMODE_PERIODIC      0x01
 #define IMU_CALIBMODE_ONCE          0x02
+#define IMU_CALIBMODE_ONLINE        0x04
 
 #define IMU_ESTIMODE_GYRO           0x01
 #define IMU_ESTIMODE_ACCELEROMETER  0x02
 #define IMU_ESTIMODE_MAGNETOMETER   0x04
 
+// attitude filter, stored in the same byte as the sensor flags
+#define IMU_ESTIMODE_COMPLEMENTARY  0x00
+#define IMU_ESTIMODE_MADGWICK       0x10
+#define IMU_ESTIMODE_MAHONY         0x20
+#define IMU_ESTIMODE_FILTER_MASK    0x30
+
+#define IMU_COMPLEMENTARY_ALPHA     0.96f
+#define IMU_MADGWICK_BETA           0.1f
+#define IMU_MAHONY_KP               1.0f
+#define IMU_MAHONY_KI               0.0f
+
 #define IMU_CALIBRATION_BUFLEN      0x3C
 #define IMU_CALIBRATION_PERIOD      0x14 // seconds
 #define IMU_CALIBRATION_DURATION    0x05
 #define IMU_UNINITIALIZED           0x98967F   
 
+#define IMU_BIAS_WINDOW             50      // samples per stationarity test
+#define IMU_BIAS_GYRO_STD_MAX       0.5f    // deg/s
+#define IMU_BIAS_ACCEL_STD_MAX      0.02f   // g
+#define IMU_BIAS_MAX_WINDOWS        64      // memory of the online bias estimate
+
+#define IMU_MAX_DT_NS               1000000000ULL // longer gaps between samples are not integrated
+
 
 ////////////////////////////////////////////
 
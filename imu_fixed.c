@@ -0,0 +1,164 @@
+#include "imu_fixed.h"
+#include "imu_algebra.h"
+#include "imu_constants.h"
+
+////////////////////////////////////////////
+
+
+// 2^62 / 1e9, nanoseconds below 2^30 times this fit in 64 bits
+#define NS_TO_Q32_Q30   4611686018ULL
+
+#define Q30_HALF        (1 << 29)
+
+
+////////////////////////////////////////////
+
+
+static inline imu_q30_t mul30(imu_q30_t a, imu_q30_t b)
+{
+    return (imu_q30_t)(((int64_t)a * b) >> 30);
+}
+
+
+////////////////////////////////////////////
+
+
+// floor of the square root, bit by bit
+static uint32_t isqrt64(uint64_t n)
+{
+    uint64_t root = 0, bit = 1ULL << 62;
+
+    while(bit > n)
+        bit >>= 2;
+
+    while(bit != 0)
+    {
+        if(n >= root + bit)
+        {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_fixed_init(imu_fixed_t * f, float gyro_scale, const imu_vec3_t * gyro_offset, float kp)
+{
+    f->q[0] = IMU_Q30_ONE;
+    f->q[1] = f->q[2] = f->q[3] = 0;
+
+    f->gyro_scale = llrint((double)gyro_scale * PI / 180.0 * (double)(1ULL << 40));
+    f->kp2 = (int32_t)lrintf(2.f * kp * 65536.f);
+    f->sample_ts = 0;
+
+    imu_fixed_set_gyro_offset(f, gyro_offset);
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_fixed_set_gyro_offset(imu_fixed_t * f, const imu_vec3_t * gyro_offset)
+{
+    f->gyro_offset[0] = (int32_t)lrintf(gyro_offset->x * 256.f);
+    f->gyro_offset[1] = (int32_t)lrintf(gyro_offset->y * 256.f);
+    f->gyro_offset[2] = (int32_t)lrintf(gyro_offset->z * 256.f);
+}
+
+
+////////////////////////////////////////////
+
+
+void imu_fixed_update(imu_fixed_t * f, const int16_t * gyro, const int16_t * accelerometer, uint64_t timestamp)
+{
+    imu_q30_t * q = f->q;
+    int32_t g[3], a[3], v[3], e[3], h[3];
+    int64_t n2, inv;
+    uint64_t dt_ns = 0, step_ns, dt_q32;
+    int i;
+
+    // first sample, out of order samples and long gaps are not integrated
+    if(f->sample_ts != 0 && timestamp > f->sample_ts && timestamp - f->sample_ts < IMU_MAX_DT_NS)
+        dt_ns = timestamp - f->sample_ts;
+
+    // as in imu_main_loop_ts(), late samples leave the stamp alone
+    if(f->sample_ts == 0 || timestamp > f->sample_ts || f->sample_ts - timestamp >= IMU_MAX_DT_NS)
+        f->sample_ts = timestamp;
+
+    // bias corrected rates
+    for(i = 0; i < 3; i++)
+        g[i] = (int32_t)(((((int64_t)gyro[i] << 8) - f->gyro_offset[i]) * f->gyro_scale) >> 24);
+
+    n2 = (int64_t)accelerometer[0] * accelerometer[0] +
+         (int64_t)accelerometer[1] * accelerometer[1] +
+         (int64_t)accelerometer[2] * accelerometer[2];
+
+    if(n2 != 0)
+    {
+        // unit accelerometer, 2^46 / |a| scales a raw value to Q46 then down to Q30
+        inv = (1LL << 46) / isqrt64((uint64_t)n2);
+        for(i = 0; i < 3; i++)
+            a[i] = (int32_t)((accelerometer[i] * inv) >> 16);
+
+        // estimated direction of gravity in body frame, halved
+        v[0] = mul30(q[1], q[3]) - mul30(q[0], q[2]);
+        v[1] = mul30(q[0], q[1]) + mul30(q[2], q[3]);
+        v[2] = mul30(q[0], q[0]) - Q30_HALF + mul30(q[3], q[3]);
+
+        e[0] = mul30(a[1], v[2]) - mul30(a[2], v[1]);
+        e[1] = mul30(a[2], v[0]) - mul30(a[0], v[2]);
+        e[2] = mul30(a[0], v[1]) - mul30(a[1], v[0]);
+
+        for(i = 0; i < 3; i++)
+            g[i] += (int32_t)(((int64_t)e[i] * f->kp2) >> 22);
+    }
+
+    while(dt_ns > 0)
+    {
+        step_ns = dt_ns < IMU_FIXED_MAX_STEP_NS ? dt_ns : IMU_FIXED_MAX_STEP_NS;
+        dt_ns -= step_ns;
+
+        dt_q32 = (step_ns * NS_TO_Q32_Q30) >> 30;
+
+        // half angle increments
+        for(i = 0; i < 3; i++)
+            h[i] = (int32_t)(((int64_t)g[i] * (int64_t)dt_q32) >> 27);
+
+        // q += q * (0, h)
+        int32_t dw = (int32_t)((- (int64_t)q[1] * h[0] - (int64_t)q[2] * h[1] - (int64_t)q[3] * h[2]) >> 30);
+        int32_t dx = (int32_t)(((int64_t)q[0] * h[0] + (int64_t)q[2] * h[2] - (int64_t)q[3] * h[1]) >> 30);
+        int32_t dy = (int32_t)(((int64_t)q[0] * h[1] - (int64_t)q[1] * h[2] + (int64_t)q[3] * h[0]) >> 30);
+        int32_t dz = (int32_t)(((int64_t)q[0] * h[2] + (int64_t)q[1] * h[1] - (int64_t)q[2] * h[0]) >> 30);
+
+        q[0] += dw;
+        q[1] += dx;
+        q[2] += dy;
+        q[3] += dz;
+
+        // one Newton step towards |q| = 1, enough as steps are small
+        n2 = ((int64_t)q[0] * q[0] + (int64_t)q[1] * q[1] + (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30;
+        inv = ((3LL << 30) - n2) >> 1;
+
+        for(i = 0; i < 4; i++)
+            q[i] = (imu_q30_t)(((int64_t)q[i] * inv) >> 30);
+    }
+}
+
+
+////////////////////////////////////////////
+
+
+imu_quaternion_t imu_fixed_get_quaternion(const imu_fixed_t * f)
+{
+    return imu_quaternion_create(imu_q30_to_float(f->q[0]), imu_q30_to_float(f->q[1]),
+                                 imu_q30_to_float(f->q[2]), imu_q30_to_float(f->q[3]));
+}
@@ -0,0 +1,125 @@
+#ifndef IMU_FIXED_H
+#define IMU_FIXED_H
+
+#include <stdint.h>
+#include <math.h>
+
+#include "imu_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// integer only attitude update working on the raw int16 samples of the CAN
+/// IMU. it is Mahony's filter with proportional feedback, the same math as
+/// imu_process_raw_data_mahony() with _ki = 0, in these formats:
+///   quaternion      Q2.30 in int32
+///   gyro offsets    raw units Q8
+///   gyro scale      rad/s per raw unit Q40
+///   rates           rad/s Q24
+///   dt              seconds Q32
+/// every operation is an integer multiply, add or arithmetic shift, so the
+/// board and the offline tools give bit-identical results for the same input.
+/// floats are only used by init and the conversion helpers.
+///
+/// error against the float path: Q30 quantization adds ~1e-9 per component
+/// and step, the accelerometer norm is an integer square root (relative error
+/// below 1/|a| in raw units, ~6e-5 at 1 g) and the quaternion is renormalized
+/// with one Newton step per update. on the reference captures the fixed
+/// attitude stays within 1e-3 deg of the float Mahony filter fed with the same
+/// offsets, check a capture with imureplay -x.
+
+#define IMU_Q30_ONE             (1 << 30)
+
+// longer gaps are integrated in steps of this size, keeps |q| near 1 and in range
+#define IMU_FIXED_MAX_STEP_NS   20000000ULL
+
+typedef int32_t imu_q30_t;
+
+
+////////////////////////////////////////////
+
+
+typedef struct imu_fixed
+{
+    // orientation quaternion w, x, y, z
+    imu_q30_t q[4];
+
+    int32_t gyro_offset[3];
+    int64_t gyro_scale;
+
+    // twice the proportional gain, Q16
+    int32_t kp2;
+
+    // timestamp of the last sample in nanoseconds
+    uint64_t sample_ts;
+
+} imu_fixed_t;
+
+
+////////////////////////////////////////////
+
+
+static inline imu_q30_t imu_q30_from_float(float f)
+{
+    return (imu_q30_t)lrintf(f * (float)IMU_Q30_ONE);
+}
+
+
+////////////////////////////////////////////
+
+
+static inline float imu_q30_to_float(imu_q30_t q)
+{
+    return (float)q * (1.f / (float)IMU_Q30_ONE);
+}
+
+
+////////////////////////////////////////////
+
+
+/// thousandth scaled integers as sent on the CAN bus (quaternion, Euler angles).
+static inline imu_q30_t imu_q30_from_milli(int32_t m)
+{
+    return (imu_q30_t)(((int64_t)m * IMU_Q30_ONE) / 1000);
+}
+
+
+////////////////////////////////////////////
+
+
+/// gyro_scale in deg/s per raw unit and gyro_offset in raw units, like the
+/// float path. kp is the proportional gain of imu_t.
+void imu_fixed_init(imu_fixed_t * f, float gyro_scale, const imu_vec3_t * gyro_offset, float kp);
+
+
+////////////////////////////////////////////
+
+
+void imu_fixed_set_gyro_offset(imu_fixed_t * f, const imu_vec3_t * gyro_offset);
+
+
+////////////////////////////////////////////
+
+
+/// one sample taken at timestamp (nanoseconds, same clock for every call).
+void imu_fixed_update(imu_fixed_t * f, const int16_t * gyro, const int16_t * accelerometer, uint64_t timestamp);
+
+
+////////////////////////////////////////////
+
+
+imu_quaternion_t imu_fixed_get_quaternion(const imu_fixed_t * f);
+
+
+////////////////////////////////////////////
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,22 +1,12 @@
 #include "imu_math.h"
+#include "imu_rsqrt.h"
 
 ////////////////////////////////////////////
 
 
 float imu_math_fast_inv_sqrt(float n)
 {
-	long i;
-	float x2, y;
-	const float threehalfs = 1.5F;
-
-	x2 = n * 0.5F;
-	y  = n;
-	i  = * ( long * ) &y;                       // evil floating point bit level hacking
-	i  = 0x5f3759df - ( i >> 1 );               // what the fuck? 
-	y  = * ( float * ) &i;
-	y  = y * ( threehalfs - ( x2 * y * y ) );   // 1st iteration
-
-	return y;
+	return imu_rsqrt(n);
 }
 
 
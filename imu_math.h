@@ -39,11 +39,17 @@ extern "C" {
 #define d2r(x)(x * PI / 180)
 #define r2d(x)(x * 180 / PI)
 
+// single precision versions, keep float expressions from being promoted to double
+#define IMU_PI_F 3.14159265f
+
+#define d2rf(x)((x) * (IMU_PI_F / 180.f))
+#define r2df(x)((x) * (180.f / IMU_PI_F))
+
 
 ////////////////////////////////////////////
 
 
-/// fast inverse sqrt algorithm from Quake III Arena source (copy-paste).
+/// kept for existing callers, same as imu_rsqrt() from imu_rsqrt.h.
 float imu_math_fast_inv_sqrt(float n);
 
 
@@ -0,0 +1,17 @@
+#include "imu_rsqrt.h"
+#include "imu_simd.h"
+
+////////////////////////////////////////////
+
+
+void imu_rsqrt_n(float * out, const float * in, size_t n)
+{
+    const imu_vf_t tiny = imu_vf_set1(IMU_RSQRT_TINY);
+    size_t i = 0;
+
+    for(; i + IMU_SIMD_WIDTH <= n; i += IMU_SIMD_WIDTH)
+        imu_vf_store(out + i, imu_vf_rsqrt(imu_vf_max(imu_vf_load(in + i), tiny)));
+
+    for(; i < n; i++)
+        out[i] = imu_rsqrt(in[i]);
+}
@@ -0,0 +1,97 @@
+#ifndef IMU_RSQRT_H
+#define IMU_RSQRT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(IMU_SIMD_DISABLE)
+#include <arm_neon.h>
+#define IMU_RSQRT_NEON
+#elif defined(__SSE__) && !defined(IMU_SIMD_DISABLE)
+#include <xmmintrin.h>
+#define IMU_RSQRT_SSE
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// reciprocal square root: hardware estimate (SSE rsqrtss, NEON vrsqrte) or
+/// the integer bit trick elsewhere, refined by IMU_RSQRT_STEPS Newton-Raphson
+/// steps. build with -DIMU_RSQRT_STEPS=n to trade accuracy for speed, the same
+/// setting applies to imu_vf_rsqrt() of imu_simd.h, the vector version used by
+/// imu_rsqrt_n() and the batch kernels. inputs are clamped to IMU_RSQRT_TINY,
+/// so zero vectors normalize to zero.
+
+#ifndef IMU_RSQRT_STEPS
+#if defined(IMU_RSQRT_SSE)
+#define IMU_RSQRT_STEPS 1
+#else
+// the NEON estimate and the bit trick are only good to ~8 and ~5 bits
+#define IMU_RSQRT_STEPS 2
+#endif
+#endif
+
+#define IMU_RSQRT_TINY 1e-30f
+
+
+////////////////////////////////////////////
+
+
+static inline float imu_rsqrt_est(float x)
+{
+#if defined(IMU_RSQRT_SSE)
+    return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#elif defined(IMU_RSQRT_NEON)
+    return vget_lane_f32(vrsqrte_f32(vdup_n_f32(x)), 0);
+#else
+    uint32_t i;
+    float y;
+
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f3759df - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+
+    return y;
+#endif
+}
+
+
+////////////////////////////////////////////
+
+
+static inline float imu_rsqrt(float x)
+{
+    float y, hx;
+
+    x = x > IMU_RSQRT_TINY ? x : IMU_RSQRT_TINY;
+    y = imu_rsqrt_est(x);
+    hx = 0.5f * x;
+
+    for(int i = 0; i < IMU_RSQRT_STEPS; i++)
+        y = y * (1.5f - hx * y * y);
+
+    return y;
+}
+
+
+////////////////////////////////////////////
+
+
+/// out[i] = 1 / sqrt(in[i]) for n elements, IMU_SIMD_WIDTH at a time, out may
+/// alias in.
+void imu_rsqrt_n(float * out, const float * in, size_t n);
+
+
+////////////////////////////////////////////
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef IMU_SIMD_H
+#define IMU_SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// thin layer over the vector unit of the build target: AVX on analysis hosts
+/// built with -mavx, SSE on any other x86-64, NEON on the board (-mfpu=neon)
+/// and plain floats elsewhere or when built with -DIMU_SIMD_DISABLE. kernels
+/// written against it work on IMU_SIMD_WIDTH lanes at a time.
+
+#if defined(__AVX__) && !defined(IMU_SIMD_DISABLE)
+
+#include <immintrin.h>
+
+#define IMU_SIMD_WIDTH  8
+#define IMU_SIMD_NAME   "avx"
+
+typedef __m256 imu_vf_t;
+
+static inline imu_vf_t imu_vf_load(const float * p) { return _mm256_loadu_ps(p); }
+static inline void imu_vf_store(float * p, imu_vf_t a) { _mm256_storeu_ps(p, a); }
+static inline imu_vf_t imu_vf_set1(float f) { return _mm256_set1_ps(f); }
+static inline imu_vf_t imu_vf_add(imu_vf_t a, imu_vf_t b) { return _mm256_add_ps(a, b); }
+static inline imu_vf_t imu_vf_sub(imu_vf_t a, imu_vf_t b) { return _mm256_sub_ps(a, b); }
+static inline imu_vf_t imu_vf_mul(imu_vf_t a, imu_vf_t b) { return _mm256_mul_ps(a, b); }
+static inline imu_vf_t imu_vf_max(imu_vf_t a, imu_vf_t b) { return _mm256_max_ps(a, b); }
+static inline imu_vf_t imu_vf_min(imu_vf_t a, imu_vf_t b) { return _mm256_min_ps(a, b); }
+static inline imu_vf_t imu_vf_rsqrt_est(imu_vf_t a) { return _mm256_rsqrt_ps(a); }
+
+#define IMU_SIMD_RSQRT_STEPS 1
+
+#elif defined(__SSE__) && !defined(IMU_SIMD_DISABLE)
+
+#include <xmmintrin.h>
+
+#define IMU_SIMD_WIDTH  4
+#define IMU_SIMD_NAME   "sse"
+
+typedef __m128 imu_vf_t;
+
+static inline imu_vf_t imu_vf_load(const float * p) { return _mm_loadu_ps(p); }
+static inline void imu_vf_store(float * p, imu_vf_t a) { _mm_storeu_ps(p, a); }
+static inline imu_vf_t imu_vf_set1(float f) { return _mm_set1_ps(f); }
+static inline imu_vf_t imu_vf_add(imu_vf_t a, imu_vf_t b) { return _mm_add_ps(a, b); }
+static inline imu_vf_t imu_vf_sub(imu_vf_t a, imu_vf_t b) { return _mm_sub_ps(a, b); }
+static inline imu_vf_t imu_vf_mul(imu_vf_t a, imu_vf_t b) { return _mm_mul_ps(a, b); }
+static inline imu_vf_t imu_vf_max(imu_vf_t a, imu_vf_t b) { return _mm_max_ps(a, b); }
+static inline imu_vf_t imu_vf_min(imu_vf_t a, imu_vf_t b) { return _mm_min_ps(a, b); }
+static inline imu_vf_t imu_vf_rsqrt_est(imu_vf_t a) { return _mm_rsqrt_ps(a); }
+
+#define IMU_SIMD_RSQRT_STEPS 1
+
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(IMU_SIMD_DISABLE)
+
+#include <arm_neon.h>
+
+#define IMU_SIMD_WIDTH  4
+#define IMU_SIMD_NAME   "neon"
+
+typedef float32x4_t imu_vf_t;
+
+static inline imu_vf_t imu_vf_load(const float * p) { return vld1q_f32(p); }
+static inline void imu_vf_store(float * p, imu_vf_t a) { vst1q_f32(p, a); }
+static inline imu_vf_t imu_vf_set1(float f) { return vdupq_n_f32(f); }
+static inline imu_vf_t imu_vf_add(imu_vf_t a, imu_vf_t b) { return vaddq_f32(a, b); }
+static inline imu_vf_t imu_vf_sub(imu_vf_t a, imu_vf_t b) { return vsubq_f32(a, b); }
+static inline imu_vf_t imu_vf_mul(imu_vf_t a, imu_vf_t b) { return vmulq_f32(a, b); }
+static inline imu_vf_t imu_vf_max(imu_vf_t a, imu_vf_t b) { return vmaxq_f32(a, b); }
+static inline imu_vf_t imu_vf_min(imu_vf_t a, imu_vf_t b) { return vminq_f32(a, b); }
+static inline imu_vf_t imu_vf_rsqrt_est(imu_vf_t a) { return vrsqrteq_f32(a); }
+
+// the NEON estimate is only good to ~8 bits
+#define IMU_SIMD_RSQRT_STEPS 2
+
+#else
+
+#include <math.h>
+
+#define IMU_SIMD_WIDTH  1
+#define IMU_SIMD_NAME   "scalar"
+
+typedef float imu_vf_t;
+
+static inline imu_vf_t imu_vf_load(const float * p) { return *p; }
+static inline void imu_vf_store(float * p, imu_vf_t a) { *p = a; }
+static inline imu_vf_t imu_vf_set1(float f) { return f; }
+static inline imu_vf_t imu_vf_add(imu_vf_t a, imu_vf_t b) { return a + b; }
+static inline imu_vf_t imu_vf_sub(imu_vf_t a, imu_vf_t b) { return a - b; }
+static inline imu_vf_t imu_vf_mul(imu_vf_t a, imu_vf_t b) { return a * b; }
+static inline imu_vf_t imu_vf_max(imu_vf_t a, imu_vf_t b) { return a > b ? a : b; }
+static inline imu_vf_t imu_vf_min(imu_vf_t a, imu_vf_t b) { return a < b ? a : b; }
+static inline imu_vf_t imu_vf_rsqrt_est(imu_vf_t a) { return 1.f / sqrtf(a); }
+
+#define IMU_SIMD_RSQRT_STEPS 0
+
+#endif
+
+// -DIMU_RSQRT_STEPS=n overrides the refinement of every backend, see imu_rsqrt.h
+#ifdef IMU_RSQRT_STEPS
+#undef IMU_SIMD_RSQRT_STEPS
+#define IMU_SIMD_RSQRT_STEPS IMU_RSQRT_STEPS
+#endif
+
+
+////////////////////////////////////////////
+
+
+/// reciprocal square root, hardware estimate refined by Newton-Raphson steps.
+static inline imu_vf_t imu_vf_rsqrt(imu_vf_t a)
+{
+    imu_vf_t y = imu_vf_rsqrt_est(a);
+    const imu_vf_t half = imu_vf_set1(0.5f), threehalfs = imu_vf_set1(1.5f);
+
+    for(int i = 0; i < IMU_SIMD_RSQRT_STEPS; i++)
+        y = imu_vf_mul(y, imu_vf_sub(threehalfs, imu_vf_mul(imu_vf_mul(half, a), imu_vf_mul(y, y))));
+
+    return y;
+}
+
+
+////////////////////////////////////////////
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -53,6 +53,49 @@ typedef struct imu_euler {
 } imu_euler_t;
 
 
+////////////////////////////////////////////
+
+
+/// row-major rotation matrices, m[row * 3 + col] and m[row * 4 + col].
+typedef struct imu_mat3 {
+    float m[9];
+} imu_mat3_t;
+
+
+////////////////////////////////////////////
+
+
+typedef struct imu_mat4 {
+    float m[16];
+} imu_mat4_t;
+
+
+////////////////////////////////////////////
+
+
+/// structure-of-arrays views used by the batch kernels in imu_batch.h,
+/// component i of every array belongs to element i.
+typedef struct imu_vec3_soa {
+    float * x, * y, * z;
+} imu_vec3_soa_t;
+
+
+////////////////////////////////////////////
+
+
+typedef struct imu_quaternion_soa {
+    float * w, * x, * y, * z;
+} imu_quaternion_soa_t;
+
+
+////////////////////////////////////////////
+
+
+typedef struct imu_euler_soa {
+    float * roll, * pitch, * yaw;
+} imu_euler_soa_t;
+
+
 ////////////////////////////////////////////
 
 #ifdef __cplusplus
@@ -10,6 +10,27 @@ double get_time_sec()
         struct timespec now = {0, 0};
         clock_gettime(CLOCK_MONOTONIC, &now);
         return (double)now.tv_sec + 1e-9 * now.tv_nsec;
+    #else
+        struct timespec now = {0, 0};
+        timespec_get(&now, TIME_UTC);
+        return (double)now.tv_sec + 1e-9 * now.tv_nsec;
+    #endif
+}
+
+
+////////////////////////////////////////////
+
+
+uint64_t get_time_ns()
+{
+    #if defined(__linux__)
+        struct timespec now = {0, 0};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    #else
+        struct timespec now = {0, 0};
+        timespec_get(&now, TIME_UTC);
+        return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
     #endif
 }
 
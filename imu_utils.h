@@ -27,6 +27,7 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,6 +59,13 @@ double get_time_sec();
 ////////////////////////////////////////////
 
 
+// returns monotonic time in nanoseconds
+uint64_t get_time_ns();
+
+
+////////////////////////////////////////////
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "can.h"
+#include "imucan.h"
+#include "imu.h"
+#include "imu_batch.h"
+#include "imu_rsqrt.h"
+#include "imu_fixed.h"
+
+// Cost of the IMU library functions at the optimization level and ARCH_FLAGS
+// of the build, on a synthetic stream or on a CAN capture ("can cap on"). Of a
+// capture only the frames of the first CAN ID in it are used, one sensor.
+//
+//   imubench [-n ops] [-a] [capture]
+//     -a  print the accuracy of the reciprocal square roots against 1/sqrtf
+//         instead of timings: op,n,max_rel_err,rms_rel_err
+//
+// Output is CSV on stdout, one line per function, preceded by a '#' line with
+// the build and stream description:
+//   op,n,ns_per_op,ops_per_s,worst_ns
+// ns_per_op and ops_per_s come from one timed loop of n calls; worst_ns is the
+// slowest of n individually timed calls, less the clock overhead.
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS ""
+#endif
+
+#define BENCH_OPS      1000000
+#define BENCH_SAMPLES  4096
+#define BENCH_SET_LEN  1024
+#define BENCH_SET_MASK (BENCH_SET_LEN-1)
+#define BENCH_PERIOD   10000000ULL
+
+typedef struct benchStream{
+    imuSample_t* samples;
+    size_t       nSamples;
+    uint64_t     span;
+    uint64_t     nOther;
+} benchStream_t;
+
+static uint64_t timerNs;
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// smallest interval two back to back clock reads can measure
+static uint64_t timerOverhead(void){
+    uint64_t best = UINT64_MAX, s, e;
+
+    for(int i = 0; i < 10000; i++){
+        s = nowNs();
+        e = nowNs();
+        if(e - s < best)
+            best = e - s;
+    }
+
+    return best;
+}
+
+static void report(const char* name, size_t n, uint64_t total, uint64_t worst){
+    worst = worst > timerNs ? worst - timerNs : 0;
+
+    printf("%s,%zu,%.2f,%.0f,%llu\n", name, n, (double)total/n,
+           total > 0 ? 1e9*n/(double)total : 0.0, (unsigned long long)worst);
+}
+
+#define BENCH(name, n, setup, body)                             \
+    do{                                                         \
+        uint64_t t0, total, worst = 0, s, e;                    \
+        setup;                                                  \
+        t0 = nowNs();                                           \
+        for(size_t i = 0; i < (n); i++){ body; }                \
+        total = nowNs() - t0;                                   \
+        setup;                                                  \
+        for(size_t i = 0; i < (n); i++){                        \
+            s = nowNs();                                        \
+            body;                                               \
+            e = nowNs() - s;                                    \
+            if(e > worst)                                       \
+                worst = e;                                      \
+        }                                                       \
+        report(name, n, total, worst);                          \
+    }while(0)
+
+static uint32_t lcg = 1;
+
+static float randf(void){
+    lcg = lcg*1664525U + 1013904223U;
+
+    return (float)(lcg >> 8)/(float)(1U << 24)*2.0f - 1.0f;
+}
+
+// slow coning motion with sensor noise, in the raw units of the CAN IMU
+static int streamSynthetic(benchStream_t* st){
+    float t, wx, wy, wz;
+
+    st->nSamples = BENCH_SAMPLES;
+    st->samples  = calloc(st->nSamples, sizeof(imuSample_t));
+    if(st->samples == NULL)
+        return -1;
+
+    for(size_t i = 0; i < st->nSamples; i++){
+        t  = (float)i*BENCH_PERIOD*1e-9f;
+        wx = 5.0f*sinf(0.5f*t);
+        wy = 5.0f*cosf(0.5f*t);
+        wz = 1.0f;
+
+        st->samples[i].timestamp = (uint32_t)(i*BENCH_PERIOD/1000);
+        st->samples[i].rxTime    = i*BENCH_PERIOD;
+        st->samples[i].sampleTime = i*BENCH_PERIOD;
+        st->samples[i].accel[0]  = (int16_t)(300.0f*sinf(0.5f*t) + 20.0f*randf());
+        st->samples[i].accel[1]  = (int16_t)(300.0f*cosf(0.5f*t) + 20.0f*randf());
+        st->samples[i].accel[2]  = (int16_t)(16383.0f + 20.0f*randf());
+        st->samples[i].gyro[0]   = (int16_t)(wx/(GYRO_SCALE) + GYRO_X_OFFSET + 3.0f*randf());
+        st->samples[i].gyro[1]   = (int16_t)(wy/(GYRO_SCALE) + GYRO_Y_OFFSET + 3.0f*randf());
+        st->samples[i].gyro[2]   = (int16_t)(wz/(GYRO_SCALE) + GYRO_Z_OFFSET + 3.0f*randf());
+    }
+
+    st->span = st->nSamples*BENCH_PERIOD;
+
+    return 0;
+}
+
+static int streamCapture(benchStream_t* st, const char* path){
+    canSource_t src;
+    canRxFrame_t frames[CAN_BATCH_LEN];
+    imuCan_t imuCan;
+    imuSample_t* grown;
+    size_t cap = BENCH_SAMPLES;
+    canid_t canId = 0;
+    uint8_t haveId = 0;
+    int n;
+
+    if(canSourceFile(&src, path, 0) < 0)
+        return -1;
+
+    imuCanInit(&imuCan);
+    st->nSamples = 0;
+    st->nOther   = 0;
+    st->samples  = malloc(cap*sizeof(imuSample_t));
+
+    while(st->samples != NULL && (n = canSourceRecv(&src, frames, CAN_BATCH_LEN)) > 0){
+        for(int f = 0; f < n; f++){
+            if(!haveId){
+                canId  = frames[f].frame.can_id & CAN_EFF_MASK;
+                haveId = 1;
+            }
+
+            if((frames[f].frame.can_id & CAN_EFF_MASK) != canId){
+                st->nOther++;
+                continue;
+            }
+
+            if(st->nSamples == cap){
+                grown = realloc(st->samples, 2*cap*sizeof(imuSample_t));
+                if(grown == NULL){
+                    free(st->samples);
+                    st->samples = NULL;
+                    break;
+                }
+                st->samples = grown;
+                cap *= 2;
+            }
+
+            if(imuCanPush(&imuCan, &frames[f], &st->samples[st->nSamples]))
+                st->nSamples++;
+        }
+    }
+
+    canSourceClose(&src);
+
+    if(st->nOther > 0)
+        fprintf(stderr,"%llu frames of CAN IDs other than 0x%X skipped\n", (unsigned long long)st->nOther, canId);
+
+    if(st->samples == NULL){
+        fprintf(stderr,"\tERR: cannot allocate the samples of %s\n", path);
+        return -1;
+    }
+
+    if(st->nSamples < 2){
+        fprintf(stderr,"\tERR: no IMU samples in %s\n", path);
+        free(st->samples);
+        return -1;
+    }
+
+    // laps of the capture are replayed back to back one period apart
+    st->span = st->samples[st->nSamples-1].sampleTime - st->samples[0].sampleTime + BENCH_PERIOD;
+
+    return 0;
+}
+
+// the original Quake III estimate with one step, for comparison only
+static float quakeRsqrt(float x){
+    uint32_t i;
+    float y;
+
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f3759df - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+
+    return y*(1.5f - 0.5f*x*y*y);
+}
+
+static float libmRsqrt(float x){
+    return 1.0f/sqrtf(x);
+}
+
+// through the vector path, whatever the width of the build
+static float rsqrtNLane0(float x){
+    float in[8] = {x, x, x, x, x, x, x, x}, out[8];
+
+    imu_rsqrt_n(out, in, 8);
+
+    return out[0];
+}
+
+// relative error against 1/sqrt in double over a log sweep of 1e-6 .. 1e6
+static void accuracy(const char* name, float (*f)(float), size_t n){
+    double x, ref, err, worst = 0.0, sq = 0.0;
+
+    for(size_t i = 0; i < n; i++){
+        x = pow(10.0, -6.0 + 12.0*(double)i/(double)(n-1));
+        ref = 1.0/sqrt((double)(float)x);
+        err = fabs((double)f((float)x) - ref)/ref;
+        sq += err*err;
+        if(err > worst)
+            worst = err;
+    }
+
+    printf("%s,%zu,%.3e,%.3e\n", name, n, worst, sqrt(sq/n));
+}
+
+static void benchMainLoop(const char* name, int8_t filter, const benchStream_t* st, size_t n){
+    imu_t imu;
+    const imuSample_t* smp;
+    uint64_t lap = 0;
+    size_t j = 0;
+
+    BENCH(name, n,
+          { imu = imu_init();
+            imuCanConfigure(&imu);
+            imu_set_estimation_mode(&imu, IMU_ESTIMODE_GYRO | IMU_ESTIMODE_ACCELEROMETER | filter);
+            lap = 0;
+            j = 0; },
+          { smp = &st->samples[j];
+            imu_set_accelerometer_raw(&imu, smp->accel[0], smp->accel[1], smp->accel[2]);
+            imu_set_gyro_raw(&imu, smp->gyro[0], smp->gyro[1], smp->gyro[2]);
+            imu_main_loop_ts(&imu, smp->sampleTime + lap + 1);
+            if(++j == st->nSamples){
+                j = 0;
+                lap += st->span;
+            } });
+}
+
+static void benchFixed(const benchStream_t* st, size_t n){
+    imu_fixed_t fx;
+    imu_vec3_t offset = imu_vec3_create(GYRO_X_OFFSET, GYRO_Y_OFFSET, GYRO_Z_OFFSET);
+    const imuSample_t* smp;
+    uint64_t lap = 0;
+    size_t j = 0;
+
+    BENCH("imu_fixed_update", n,
+          { imu_fixed_init(&fx, GYRO_SCALE, &offset, IMU_MAHONY_KP);
+            lap = 0;
+            j = 0; },
+          { smp = &st->samples[j];
+            imu_fixed_update(&fx, smp->gyro, smp->accel, smp->sampleTime + lap + 1);
+            if(++j == st->nSamples){
+                j = 0;
+                lap += st->span;
+            } });
+}
+
+int main(int argc, char *argv[]){
+    benchStream_t st;
+    imu_quaternion_t* quats;
+    imu_vec3_t* vecs;
+    imu_vec3_t* rotated;
+    float* scalars;
+    float* soa;
+    imu_quaternion_soa_t qsoa;
+    imu_quaternion_t q;
+    imu_vec3_t v;
+    imu_euler_t eu;
+    imu_mat3_t m;
+    float acc = 0.0f;
+    size_t n = BENCH_OPS;
+    int accuracyOnly = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:a")) != -1){
+        switch(opt){
+            case 'n':
+                n = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                accuracyOnly = 1;
+                break;
+            default:
+                fprintf(stderr,"Usage: %s [-n ops] [-a] [capture]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if(n < 2)
+        n = BENCH_OPS;
+
+    if(accuracyOnly){
+        printf("# imubench accuracy simd=%s rsqrt_steps=%d flags=\"%s\" compiler=\"%s\"\n",
+               imu_batch_simd_name(), IMU_RSQRT_STEPS, BENCH_FLAGS, __VERSION__);
+        printf("op,n,max_rel_err,rms_rel_err\n");
+        accuracy("imu_rsqrt", imu_rsqrt, n);
+        accuracy("imu_rsqrt_n", rsqrtNLane0, n);
+        accuracy("imu_rsqrt_est", imu_rsqrt_est, n);
+        accuracy("quake_rsqrt", quakeRsqrt, n);
+        accuracy("1/sqrtf", libmRsqrt, n);
+        return 0;
+    }
+
+    if(optind < argc){
+        if(streamCapture(&st, argv[optind]) < 0)
+            return -1;
+    }else if(streamSynthetic(&st) < 0)
+        return -1;
+
+    quats   = malloc(BENCH_SET_LEN*sizeof(imu_quaternion_t));
+    vecs    = malloc(BENCH_SET_LEN*sizeof(imu_vec3_t));
+    rotated = malloc(BENCH_SET_LEN*sizeof(imu_vec3_t));
+    scalars = malloc(BENCH_SET_LEN*sizeof(float));
+    soa     = malloc(4*BENCH_SET_LEN*sizeof(float));
+
+    if(quats == NULL || vecs == NULL || rotated == NULL || scalars == NULL || soa == NULL){
+        fprintf(stderr,"\tERR: out of memory\n");
+        return -1;
+    }
+
+    for(size_t i = 0; i < BENCH_SET_LEN; i++){
+        q = imu_quaternion_create(randf(), randf(), randf(), randf());
+        quats[i]   = imu_quaternion_scale(&q, 1.0f/imu_quaternion_length(&q));
+        vecs[i]    = imu_vec3_create(randf(), randf(), randf());
+        scalars[i] = 1e-3f + fabsf(randf())*1e3f;
+    }
+
+    qsoa.w = soa;
+    qsoa.x = soa + BENCH_SET_LEN;
+    qsoa.y = soa + 2*BENCH_SET_LEN;
+    qsoa.z = soa + 3*BENCH_SET_LEN;
+
+    timerNs = timerOverhead();
+
+    printf("# imubench source=%s samples=%zu simd=%s flags=\"%s\" compiler=\"%s\" timer_ns=%llu\n",
+           optind < argc ? argv[optind] : "synthetic", st.nSamples, imu_batch_simd_name(),
+           BENCH_FLAGS, __VERSION__, (unsigned long long)timerNs);
+    printf("op,n,ns_per_op,ops_per_s,worst_ns\n");
+
+    benchMainLoop("imu_main_loop/complementary", IMU_ESTIMODE_COMPLEMENTARY, &st, n);
+    benchMainLoop("imu_main_loop/madgwick", IMU_ESTIMODE_MADGWICK, &st, n);
+    benchMainLoop("imu_main_loop/mahony", IMU_ESTIMODE_MAHONY, &st, n);
+    benchFixed(&st, n);
+
+    BENCH("imu_quaternion_product", n, {},
+          { q = imu_quaternion_product(&quats[i & BENCH_SET_MASK], &quats[(i+1) & BENCH_SET_MASK]);
+            acc += q.w; });
+
+    BENCH("imu_quaternion_normalize", n, {},
+          { q = imu_quaternion_normalize(&quats[i & BENCH_SET_MASK]);
+            acc += q.w; });
+
+    BENCH("imu_vec3_normalize", n, {},
+          { v = imu_vec3_normalize(&vecs[i & BENCH_SET_MASK]);
+            acc += v.x; });
+
+    BENCH("imu_math_fast_inv_sqrt", n, {},
+          { acc += imu_math_fast_inv_sqrt(scalars[i & BENCH_SET_MASK]); });
+
+    BENCH("imu_rsqrt", n, {},
+          { acc += imu_rsqrt(scalars[i & BENCH_SET_MASK]); });
+
+    BENCH("quake_rsqrt", n, {},
+          { acc += quakeRsqrt(scalars[i & BENCH_SET_MASK]); });
+
+    BENCH("1/sqrtf", n, {},
+          { acc += 1.0f/sqrtf(scalars[i & BENCH_SET_MASK]); });
+
+    BENCH("imu_rsqrt_n/1024", n/BENCH_SET_LEN + 1, {},
+          { imu_rsqrt_n(soa, scalars, BENCH_SET_LEN);
+            acc += soa[i & BENCH_SET_MASK]; });
+
+    BENCH("imu_quaternion_to_euler", n, {},
+          { eu = imu_quaternion_to_euler(&quats[i & BENCH_SET_MASK]);
+            acc += eu.roll; });
+
+    BENCH("imu_quaternion_slerp", n, {},
+          { q = imu_quaternion_slerp(&quats[i & BENCH_SET_MASK], &quats[(i+1) & BENCH_SET_MASK], 0.3f);
+            acc += q.w; });
+
+    BENCH("imu_quaternion_to_mat3", n, {},
+          { m = imu_quaternion_to_mat3(&quats[i & BENCH_SET_MASK]);
+            acc += m.m[0]; });
+
+    BENCH("imu_quaternion_rotate_vector", n, {},
+          { v = imu_quaternion_rotate_vector(&quats[i & BENCH_SET_MASK], &vecs[i & BENCH_SET_MASK]);
+            acc += v.x; });
+
+    // one op is a block of BENCH_SET_LEN elements
+    m = imu_quaternion_to_mat3(&quats[0]);
+    BENCH("imu_mat3_rotate_vectors/1024", n/BENCH_SET_LEN + 1, {},
+          { imu_mat3_rotate_vectors(&m, rotated, vecs, BENCH_SET_LEN);
+            acc += rotated[i & BENCH_SET_MASK].x; });
+
+    for(size_t i = 0; i < BENCH_SET_LEN; i++){
+        qsoa.w[i] = quats[i].w;
+        qsoa.x[i] = quats[i].x;
+        qsoa.y[i] = quats[i].y;
+        qsoa.z[i] = quats[i].z;
+    }
+
+    BENCH("imu_batch_quaternion_normalize/1024", n/BENCH_SET_LEN + 1, {},
+          { imu_batch_quaternion_normalize(&qsoa, &qsoa, BENCH_SET_LEN);
+            acc += qsoa.w[i & BENCH_SET_MASK]; });
+
+    fprintf(stderr,"checksum=%f\n", acc);
+
+    free(st.samples);
+    free(quats);
+    free(vecs);
+    free(rotated);
+    free(scalars);
+    free(soa);
+
+    return 0;
+}
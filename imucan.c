@@ -0,0 +1,196 @@
+#include <stddef.h>
+#include <string.h>
+#include "imucan.h"
+
+#define FIELD_NONE 0
+#define FIELD_U32  1
+#define FIELD_I16  2
+#define FIELD_I32  3
+
+#define FIELD_BIT(n)   (1U << (n))
+#define ALL_FIELDS     (FIELD_BIT(14) - 1)
+
+typedef struct imuCanField{
+    uint8_t  type;
+    uint8_t  bit;
+    uint16_t offset;
+} imuCanField_t;
+
+static const imuCanField_t fields[CAN_MAX_ID] = {
+    [CAN_TIMESTAMP_ID] = {FIELD_U32, 0,  offsetof(imuSample_t, timestamp)},
+    [CAN_AX_ID]        = {FIELD_I16, 1,  offsetof(imuSample_t, accel[0])},
+    [CAN_AY_ID]        = {FIELD_I16, 2,  offsetof(imuSample_t, accel[1])},
+    [CAN_AZ_ID]        = {FIELD_I16, 3,  offsetof(imuSample_t, accel[2])},
+    [CAN_GX_ID]        = {FIELD_I16, 4,  offsetof(imuSample_t, gyro[0])},
+    [CAN_GY_ID]        = {FIELD_I16, 5,  offsetof(imuSample_t, gyro[1])},
+    [CAN_GZ_ID]        = {FIELD_I16, 6,  offsetof(imuSample_t, gyro[2])},
+    [CAN_Q0_ID]        = {FIELD_I32, 7,  offsetof(imuSample_t, quat[0])},
+    [CAN_Q1_ID]        = {FIELD_I32, 8,  offsetof(imuSample_t, quat[1])},
+    [CAN_Q2_ID]        = {FIELD_I32, 9,  offsetof(imuSample_t, quat[2])},
+    [CAN_Q3_ID]        = {FIELD_I32, 10, offsetof(imuSample_t, quat[3])},
+    [CAN_ROLL_ID]      = {FIELD_I32, 11, offsetof(imuSample_t, eulers[0])},
+    [CAN_PITCH_ID]     = {FIELD_I32, 12, offsetof(imuSample_t, eulers[1])},
+    [CAN_YAW_ID]       = {FIELD_I32, 13, offsetof(imuSample_t, eulers[2])},
+};
+
+void imuCanInit(imuCan_t* imuCan){
+    memset(imuCan, 0, sizeof(imuCan_t));
+}
+
+// Scales and gyro offsets of the IMU on the CAN bus, shared by the daemon and
+// the offline tools so both run the same pipeline.
+void imuCanConfigure(imu_t* imu){
+    imu_set_calibration_mode(imu, IMU_CALIBMODE_ONLINE);
+    imu_set_gyro_scale_factor(imu, GYRO_SCALE);
+    imu_set_accelerometer_scale_factor(imu, ACCEL_SCALE);
+    imu->gyro_offset.x = GYRO_X_OFFSET;
+    imu->gyro_offset.y = GYRO_Y_OFFSET;
+    imu->gyro_offset.z = GYRO_Z_OFFSET;
+}
+
+static void closeCycle(imuCan_t* imuCan){
+    if(imuCan->inCycle){
+        if(imuCan->dup)
+            imuCan->stats.duplicate++;
+        else
+            imuCan->stats.incomplete++;
+    }
+
+    imuCan->inCycle = 0;
+}
+
+static uint64_t sampleTime(imuCan_t* imuCan, const imuSample_t* sample){
+    // a sensor without a clock sends 0
+    if(sample->timestamp == 0)
+        return sample->rxTime;
+
+    if(imuCan->sampleTime == 0)
+        imuCan->sampleTime = sample->timestamp*IMU_CAN_TIMESTAMP_NS;
+    else
+        imuCan->sampleTime += (uint32_t)(sample->timestamp - imuCan->lastTimestamp)*IMU_CAN_TIMESTAMP_NS;
+
+    imuCan->lastTimestamp = sample->timestamp;
+
+    return imuCan->sampleTime;
+}
+
+// Returns 1 and fills sample when rxFrame completes a cycle, 0 otherwise.
+int imuCanPush(imuCan_t* imuCan, const canRxFrame_t* rxFrame, imuSample_t* sample){
+    const uint8_t* data = rxFrame->frame.data;
+    const imuCanField_t* field;
+    uint8_t* dst;
+    uint32_t raw;
+    int16_t raw16;
+
+    if(data[0] >= CAN_MAX_ID || fields[data[0]].type == FIELD_NONE){
+        imuCan->stats.orphan++;
+        return 0;
+    }
+
+    field = &fields[data[0]];
+
+    if(data[0] == CAN_TIMESTAMP_ID){
+        closeCycle(imuCan);
+        imuCan->inCycle = 1;
+        imuCan->dup     = 0;
+        imuCan->seen    = 0;
+        imuCan->pending.rxTime = rxFrame->rxTime;
+    }else if(!imuCan->inCycle){
+        imuCan->stats.orphan++;
+        return 0;
+    }
+
+    if(imuCan->seen & FIELD_BIT(field->bit))
+        imuCan->dup = 1;
+
+    imuCan->seen |= FIELD_BIT(field->bit);
+
+    raw = (uint32_t)data[1]       | (uint32_t)data[2] << 8 |
+          (uint32_t)data[3] << 16 | (uint32_t)data[4] << 24;
+    dst = (uint8_t*)&imuCan->pending + field->offset;
+
+    if(field->type == FIELD_I16){
+        raw16 = (int16_t)(raw & 0xFFFF);
+        memcpy(dst, &raw16, sizeof(raw16));
+    }else
+        memcpy(dst, &raw, sizeof(raw));
+
+    if(imuCan->seen != ALL_FIELDS)
+        return 0;
+
+    if(imuCan->dup){
+        closeCycle(imuCan);
+        return 0;
+    }
+
+    imuCan->inCycle = 0;
+    imuCan->stats.complete++;
+    *sample = imuCan->pending;
+    sample->sampleTime = sampleTime(imuCan, sample);
+
+    return 1;
+}
+
+void imuCanSensorInit(imuCanSensor_t* sensor, uint32_t canId, uint32_t canMask){
+    memset(sensor, 0, sizeof(imuCanSensor_t));
+    sensor->canId   = canId;
+    sensor->canMask = canMask;
+
+    imuCanInit(&sensor->assembler);
+    sensor->imu = imu_init();
+    imuCanConfigure(&sensor->imu);
+    imu_fixed_init(&sensor->fixed, GYRO_SCALE, &sensor->imu.gyro_offset, sensor->imu._kp);
+#ifdef IMU_FIXED_POINT
+    sensor->fixedPoint = 1;
+#endif
+}
+
+// the part of imu_main_loop_ts() that is not the filter, then the fixed-point update
+static void updateFixed(imuCanSensor_t* sensor, const imuSample_t* sample){
+    imu_t* imu = &sensor->imu;
+
+    if(imu->state != IMU_STATE_READY){
+        imu_bias_init(&imu->bias, &imu->gyro_offset);
+        imu_set_state(imu, IMU_STATE_READY);
+    }
+
+    if(imu->_calibration_mode == IMU_CALIBMODE_ONLINE &&
+       imu_bias_update(&imu->bias, &imu->gyro_raw, &imu->accelerometer_raw, imu->_scale_factor_gyro, imu->_scale_factor_accelerometer)){
+        imu->gyro_offset = imu->bias.bias;
+        imu_fixed_set_gyro_offset(&sensor->fixed, &imu->gyro_offset);
+    }
+
+    imu_fixed_update(&sensor->fixed, sample->gyro, sample->accel, sample->sampleTime);
+
+    imu->gyro = imu_vec3_dif(&imu->gyro_raw, &imu->gyro_offset);
+    imu->gyro = imu_vec3_scale(&imu->gyro, imu->_scale_factor_gyro);
+    imu->accelerometer = imu_vec3_scale(&imu->accelerometer_raw, imu->_scale_factor_accelerometer);
+    imu->orientation_quat = imu_fixed_get_quaternion(&sensor->fixed);
+    imu->_sample_ts = sensor->fixed.sample_ts;
+    if(++imu->_generation == 0)
+        imu->_generation = 1;
+}
+
+// Feeds a committed sample to the sensor's attitude estimate.
+void imuCanSensorUpdate(imuCanSensor_t* sensor, const imuSample_t* sample){
+    sensor->sample = *sample;
+
+    imu_set_accelerometer_raw(&sensor->imu, sample->accel[0], sample->accel[1], sample->accel[2]);
+    imu_set_gyro_raw(&sensor->imu, sample->gyro[0], sample->gyro[1], sample->gyro[2]);
+
+    if(sensor->fixedPoint)
+        updateFixed(sensor, sample);
+    else
+        imu_main_loop_ts(&sensor->imu, sample->sampleTime);
+}
+
+// Returns the sensor rxFrame belongs to, NULL if no sensor matches its ID.
+imuCanSensor_t* imuCanRoute(imuCanSensor_t* sensors, int nSensors, const canRxFrame_t* rxFrame){
+    canid_t id = rxFrame->frame.can_id & CAN_EFF_MASK;
+
+    for(int i = 0; i < nSensors; i++)
+        if((id & sensors[i].canMask) == (sensors[i].canId & sensors[i].canMask))
+            return &sensors[i];
+
+    return NULL;
+}
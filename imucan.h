@@ -0,0 +1,97 @@
+#ifndef IMUCAN_H_
+#define IMUCAN_H_
+
+#include <stdint.h>
+#include "can.h"
+#include "imu.h"
+#include "imu_fixed.h"
+
+#define CAN_TIMESTAMP_ID 19
+#define CAN_AX_ID        20
+#define CAN_AY_ID        21
+#define CAN_AZ_ID        22
+#define CAN_GX_ID        23
+#define CAN_GY_ID        24
+#define CAN_GZ_ID        25
+#define CAN_Q0_ID        32
+#define CAN_Q1_ID        33
+#define CAN_Q2_ID        34
+#define CAN_Q3_ID        35
+#define CAN_ROLL_ID      36
+#define CAN_PITCH_ID     37
+#define CAN_YAW_ID       38
+#define CAN_MAX_ID       39
+
+#define IMU_CAN_MAX_SENSORS 4
+
+#define ACCEL_SCALE 2.0/32767.0
+#define GYRO_SCALE  250.0/32767.0
+
+// starting point of the online bias estimate, refined while the sensor is still
+#define GYRO_X_OFFSET 61.98
+#define GYRO_Y_OFFSET 27.80
+#define GYRO_Z_OFFSET 54.97
+
+// the CAN_TIMESTAMP_ID value counts microseconds
+#define IMU_CAN_TIMESTAMP_NS 1000ULL
+
+#define IMU_CAN_QUAT_SCALE  1000.0f
+#define IMU_CAN_EULER_SCALE 1000.0f
+
+typedef struct imuSample{
+    uint32_t timestamp;
+    uint64_t rxTime;
+    // timestamp unwrapped to ns, rxTime when the sensor sends none; what the
+    // attitude is integrated over
+    uint64_t sampleTime;
+    int16_t  accel[3];
+    int16_t  gyro[3];
+    int32_t  quat[4];
+    int32_t  eulers[3];
+} imuSample_t;
+
+typedef struct imuCanStats{
+    uint32_t complete;
+    uint32_t incomplete;
+    uint32_t duplicate;
+    uint32_t orphan;
+} imuCanStats_t;
+
+// Collects the frames of one CAN_TIMESTAMP_ID cycle. A sample is committed only
+// when every field of the cycle arrived exactly once; cycles cut short by the
+// next CAN_TIMESTAMP_ID are counted as incomplete, cycles where a field arrived
+// twice as duplicate, frames received outside a cycle as orphan.
+typedef struct imuCan{
+    imuSample_t   pending;
+    uint32_t      seen;
+    uint8_t       inCycle;
+    uint8_t       dup;
+    uint32_t      lastTimestamp;
+    uint64_t      sampleTime;
+    imuCanStats_t stats;
+} imuCan_t;
+
+// One IMU on the bus. Frames matching canId under canMask are assembled and fed
+// to its own imu_t; canId also tags the instance in the IMU output stream.
+// With fixedPoint the attitude comes from the integer update of imu_fixed.h
+// and is published in imu like the float filters do, together with the
+// scaled rates and the online gyro bias.
+typedef struct imuCanSensor{
+    uint32_t      canId;
+    uint32_t      canMask;
+    uint8_t       fixedPoint;
+    imuCan_t      assembler;
+    imu_t         imu;
+    imu_fixed_t   fixed;
+    imuSample_t   sample;
+    imuCanStats_t stats;
+} imuCanSensor_t;
+
+void imuCanInit(imuCan_t* imuCan);
+void imuCanConfigure(imu_t* imu);
+int imuCanPush(imuCan_t* imuCan, const canRxFrame_t* rxFrame, imuSample_t* sample);
+void imuCanSensorInit(imuCanSensor_t* sensor, uint32_t canId, uint32_t canMask);
+void imuCanSensorUpdate(imuCanSensor_t* sensor, const imuSample_t* sample);
+imuCanSensor_t* imuCanRoute(imuCanSensor_t* sensors, int nSensors, const canRxFrame_t* rxFrame);
+
+#endif
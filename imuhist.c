@@ -0,0 +1,119 @@
+#include <string.h>
+#include "imuhist.h"
+#include "imu_algebra.h"
+
+void imuHistInit(imuHist_t* hist){
+    memset(hist, 0, sizeof(imuHist_t));
+}
+
+void imuHistPush(imuHist_t* hist, uint64_t rxTime, uint32_t timestamp, const imu_quaternion_t* quat){
+    uint32_t idx = hist->head;
+    imuHistEntry_t* e = &hist->entries[idx & IMU_HIST_MASK];
+
+    if(idx != hist->start && rxTime < hist->entries[(idx-1) & IMU_HIST_MASK].rxTime)
+        __atomic_store_n(&hist->start, idx, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&e->seq, 2*idx+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    e->timestamp = timestamp;
+    e->rxTime    = rxTime;
+    e->quat      = *quat;
+
+    __atomic_store_n(&e->seq, 2*idx+2, __ATOMIC_RELEASE);
+    __atomic_store_n(&hist->head, idx+1, __ATOMIC_RELEASE);
+}
+
+// Copies entry idx, fails if the slot is being written or already holds a
+// newer entry.
+static int readEntry(imuHist_t* hist, uint32_t idx, imuHistEntry_t* out){
+    const imuHistEntry_t* e = &hist->entries[idx & IMU_HIST_MASK];
+    uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+
+    if(seq != 2*idx+2)
+        return -1;
+
+    out->timestamp = e->timestamp;
+    out->rxTime    = e->rxTime;
+    out->quat      = e->quat;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) ? 0 : -1;
+}
+
+static int lookup(imuHist_t* hist, uint64_t t, imu_quaternion_t* quat, uint32_t* timestamp){
+    imuHistEntry_t lo, hi;
+    uint32_t start = __atomic_load_n(&hist->start, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&hist->head, __ATOMIC_ACQUIRE);
+    uint32_t count = (head - start < IMU_HIST_LEN) ? head - start : IMU_HIST_LEN;
+    uint32_t first = head - count;
+    uint32_t l = 0, r = count-1, m;
+    int res;
+
+    if(count == 0)
+        return IMU_HIST_NONE;
+
+    if(readEntry(hist, head-1, &hi) < 0)
+        return -1;
+
+    if(t >= hi.rxTime){
+        *quat = hi.quat;
+        *timestamp = hi.timestamp;
+        res = IMU_HIST_HELD;
+        goto done;
+    }
+
+    if(readEntry(hist, first, &lo) < 0)
+        return -1;
+
+    if(t < lo.rxTime){
+        *quat = lo.quat;
+        *timestamp = lo.timestamp;
+        res = IMU_HIST_STALE;
+        goto done;
+    }
+
+    // invariant: entry first+l is at or before t, entry first+r is after t
+    while(r - l > 1){
+        m = l + (r - l)/2;
+
+        if(readEntry(hist, first+m, &lo) < 0)
+            return -1;
+
+        if(lo.rxTime <= t)
+            l = m;
+        else
+            r = m;
+    }
+
+    if(readEntry(hist, first+l, &lo) < 0 || readEntry(hist, first+r, &hi) < 0)
+        return -1;
+
+    *quat = imu_quaternion_slerp(&lo.quat, &hi.quat, (float)(t - lo.rxTime)/(float)(hi.rxTime - lo.rxTime));
+    *timestamp = lo.timestamp;
+    res = IMU_HIST_INTERP;
+
+done:
+    // a restart while searching may have mixed the two time bases
+    return (__atomic_load_n(&hist->start, __ATOMIC_ACQUIRE) == start) ? res : -1;
+}
+
+// Attitude at time t (same clock as rxTime), slerp-interpolated between the
+// two samples around t. After the newest sample the newest attitude is held,
+// before the oldest one the oldest is returned flagged as stale. With no
+// attitude (IMU_HIST_NONE) quat is the identity and timestamp 0.
+int imuHistLookup(imuHist_t* hist, uint64_t t, imu_quaternion_t* quat, uint32_t* timestamp){
+    int res = -1;
+
+    for(int i = 0; i < IMU_HIST_TRIES && res < 0; i++)
+        res = lookup(hist, t, quat, timestamp);
+
+    if(res <= IMU_HIST_NONE){
+        *quat = imu_quaternion_create(1.0f, 0.0f, 0.0f, 0.0f);
+        *timestamp = 0;
+        return IMU_HIST_NONE;
+    }
+
+    return res;
+}
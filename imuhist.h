@@ -0,0 +1,38 @@
+#ifndef IMUHIST_H_
+#define IMUHIST_H_
+
+#include <stdint.h>
+#include "imu_types.h"
+
+#define IMU_HIST_LEN   256
+#define IMU_HIST_MASK  (IMU_HIST_LEN-1)
+#define IMU_HIST_TRIES 4
+
+#define IMU_HIST_NONE   0x00
+#define IMU_HIST_INTERP 0x01
+#define IMU_HIST_HELD   0x02
+#define IMU_HIST_STALE  0x04
+
+typedef struct imuHistEntry{
+    uint32_t         seq;
+    uint32_t         timestamp;
+    uint64_t         rxTime;
+    imu_quaternion_t quat;
+} imuHistEntry_t;
+
+// Written only by the CAN reader, read lock-free by any thread. Entries are
+// ordered by rxTime; seq is odd while an entry is being written and tells the
+// readers which generation of the slot they copied. A sample older than the
+// newest one (CLOCK_REALTIME stepped back) restarts the history at start, the
+// entries before it are in the old time base.
+typedef struct imuHist{
+    uint32_t       head;
+    uint32_t       start;
+    imuHistEntry_t entries[IMU_HIST_LEN];
+} imuHist_t;
+
+void imuHistInit(imuHist_t* hist);
+void imuHistPush(imuHist_t* hist, uint64_t rxTime, uint32_t timestamp, const imu_quaternion_t* quat);
+int imuHistLookup(imuHist_t* hist, uint64_t t, imu_quaternion_t* quat, uint32_t* timestamp);
+
+#endif
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "can.h"
+#include "imucan.h"
+#include "imu.h"
+#include "imu_fixed.h"
+
+// Feeds a CAN capture recorded by the daemon ("can cap on") through the same
+// assembler and IMU pipeline as canReaderThread, without any CAN interface.
+//
+//   imureplay [-r] [-v] [-i canid] [-f filter | -a | -x] <capture|->
+//     -r  replay with the original timing instead of as fast as possible (a
+//         capture from stdin is paced too)
+//     -i  replay the sensor with this CAN ID (by default the one of the first
+//         frame; frames of other IDs are counted and skipped)
+//     -v  print every committed sample as CSV
+//     -f  attitude filter: complementary (default), madgwick or mahony
+//     -a  replay the capture once per filter and print a comparison table
+//     -x  run the fixed-point path of imu_fixed.h next to the float Mahony
+//         filter, with the same gyro offsets, and report how far apart they get
+//     -   read the capture from stdin (e.g. a pipe from a remote board)
+//
+// Accuracy is the tilt error against the quaternion computed by the sensor
+// itself: the angle between the world vertical seen in body coordinates by
+// the two estimates. Yaw is not observable without a magnetometer.
+
+#define USAGE "Usage: %s [-r] [-v] [-i canid] [-f complementary|madgwick|mahony | -a | -x] <capture|->\n"
+
+typedef struct{
+    const char* name;
+    int8_t mode;
+} filterName_t;
+
+static const filterName_t filters[] = {
+    {"complementary", IMU_ESTIMODE_COMPLEMENTARY},
+    {"madgwick", IMU_ESTIMODE_MADGWICK},
+    {"mahony", IMU_ESTIMODE_MAHONY}
+};
+
+#define FILTERS_NUM (sizeof(filters)/sizeof(filters[0]))
+
+typedef struct{
+    uint64_t nFrames;
+    uint64_t nUpdates;
+    uint64_t procTime;
+    uint64_t worst;
+    double tiltSq;
+    double tiltMax;
+    imu_quaternion_t q;
+    uint64_t fixedTime;
+    uint64_t fixedWorst;
+    double fixedDiffSq;
+    double fixedDiffMax;
+    double fixedTiltSq;
+    double fixedTiltMax;
+    imu_quaternion_t fixedQ;
+    uint32_t canId;
+    uint64_t nOther;
+    imu_vec3_t bias;
+    float biasSigma;
+    imuCanStats_t stats;
+} replayResult_t;
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// world vertical in body coordinates, third row of the rotation matrix of q
+static void bodyUp(float w, float x, float y, float z, double up[3]){
+    double n = sqrt(w*w + x*x + y*y + z*z);
+
+    if(n == 0.0)
+        n = 1.0;
+
+    w /= n; x /= n; y /= n; z /= n;
+
+    up[0] = 2.0*(x*z - w*y);
+    up[1] = 2.0*(y*z + w*x);
+    up[2] = 1.0 - 2.0*(x*x + y*y);
+}
+
+static double tiltError(const imu_quaternion_t* q, const imuSample_t* sample){
+    double u[3], v[3], d;
+
+    bodyUp(q->w, q->x, q->y, q->z, u);
+    bodyUp(sample->quat[0], sample->quat[1], sample->quat[2], sample->quat[3], v);
+
+    d = u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+    if(d > 1.0)
+        d = 1.0;
+    else if(d < -1.0)
+        d = -1.0;
+
+    return acos(d)*180.0/M_PI;
+}
+
+#define FIRST_ID 0xFFFFFFFF
+
+// rotation angle between two quaternions in degrees, from conj(a) * b so it
+// stays accurate for tiny angles and slightly non-unit inputs
+static double quatAngle(const imu_quaternion_t* a, const imu_quaternion_t* b){
+    double w = (double)a->w*b->w + (double)a->x*b->x + (double)a->y*b->y + (double)a->z*b->z;
+    double x = (double)a->w*b->x - (double)a->x*b->w - (double)a->y*b->z + (double)a->z*b->y;
+    double y = (double)a->w*b->y + (double)a->x*b->z - (double)a->y*b->w - (double)a->z*b->x;
+    double z = (double)a->w*b->z - (double)a->x*b->y + (double)a->y*b->x - (double)a->z*b->w;
+
+    return 2.0*atan2(sqrt(x*x + y*y + z*z), fabs(w))*180.0/M_PI;
+}
+
+static int replay(const char* path, uint8_t realTime, uint8_t verbose, uint32_t canId, int8_t filter, uint8_t fixed, replayResult_t* res){
+    canSource_t src;
+    canRxFrame_t frames[CAN_BATCH_LEN];
+    imuCan_t imuCan;
+    imuSample_t sample;
+    imu_t imu;
+    imu_fixed_t fx;
+    imu_quaternion_t fq;
+    uint64_t start, elapsed;
+    double tilt;
+    int n, err;
+
+    if(strcmp(path, "-") == 0)
+        err = canSourcePipe(&src, STDIN_FILENO, realTime);
+    else
+        err = canSourceFile(&src, path, realTime);
+
+    if(err < 0)
+        return -1;
+
+    memset(res, 0, sizeof(replayResult_t));
+
+    imuCanInit(&imuCan);
+    imu = imu_init();
+    imuCanConfigure(&imu);
+    imu_set_estimation_mode(&imu, IMU_ESTIMODE_GYRO | IMU_ESTIMODE_ACCELEROMETER | filter);
+    imu_fixed_init(&fx, GYRO_SCALE, &imu.gyro_offset, imu._kp);
+
+    while((n = canSourceRecv(&src, frames, CAN_BATCH_LEN)) > 0){
+        res->nFrames += n;
+
+        for(int f = 0; f < n; f++){
+            // one assembler and filter, one sensor
+            if(canId == FIRST_ID)
+                canId = frames[f].frame.can_id & CAN_EFF_MASK;
+
+            if((frames[f].frame.can_id & CAN_EFF_MASK) != canId){
+                res->nOther++;
+                continue;
+            }
+
+            if(!imuCanPush(&imuCan, &frames[f], &sample))
+                continue;
+
+            start = nowNs();
+            imu_set_accelerometer_raw(&imu, sample.accel[0], sample.accel[1], sample.accel[2]);
+            imu_set_gyro_raw(&imu, sample.gyro[0], sample.gyro[1], sample.gyro[2]);
+            imu_main_loop_ts(&imu, sample.sampleTime);
+            elapsed = nowNs() - start;
+
+            res->procTime += elapsed;
+            if(elapsed > res->worst)
+                res->worst = elapsed;
+            res->nUpdates++;
+
+            if(fixed){
+                imu_fixed_set_gyro_offset(&fx, &imu.gyro_offset);
+
+                start = nowNs();
+                imu_fixed_update(&fx, sample.gyro, sample.accel, sample.sampleTime);
+                elapsed = nowNs() - start;
+
+                res->fixedTime += elapsed;
+                if(elapsed > res->fixedWorst)
+                    res->fixedWorst = elapsed;
+
+                fq = imu_fixed_get_quaternion(&fx);
+                tilt = quatAngle(&fq, &imu.orientation_quat);
+                res->fixedDiffSq += tilt*tilt;
+                if(tilt > res->fixedDiffMax)
+                    res->fixedDiffMax = tilt;
+
+                tilt = tiltError(&fq, &sample);
+                res->fixedTiltSq += tilt*tilt;
+                if(tilt > res->fixedTiltMax)
+                    res->fixedTiltMax = tilt;
+            }
+
+            tilt = tiltError(&imu.orientation_quat, &sample);
+            res->tiltSq += tilt*tilt;
+            if(tilt > res->tiltMax)
+                res->tiltMax = tilt;
+
+            if(verbose)
+                printf("%u,%llu,%f,%f,%f,%f,%f,%f,%f,%f\n", sample.timestamp, (unsigned long long)sample.rxTime,
+                       imu.orientation_quat.w, imu.orientation_quat.x, imu.orientation_quat.y, imu.orientation_quat.z,
+                       sample.quat[0]/IMU_CAN_QUAT_SCALE, sample.quat[1]/IMU_CAN_QUAT_SCALE,
+                       sample.quat[2]/IMU_CAN_QUAT_SCALE, sample.quat[3]/IMU_CAN_QUAT_SCALE);
+        }
+    }
+
+    canSourceClose(&src);
+
+    res->q = imu.orientation_quat;
+    res->fixedQ = imu_fixed_get_quaternion(&fx);
+    res->biasSigma = imu_get_gyro_bias(&imu, &res->bias);
+    res->stats = imuCan.stats;
+    res->canId = canId;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    replayResult_t res;
+    uint8_t realTime = 0;
+    uint8_t verbose = 0;
+    uint8_t all = 0;
+    uint8_t fixed = 0;
+    int8_t filter = IMU_ESTIMODE_COMPLEMENTARY;
+    uint32_t canId = FIRST_ID;
+    unsigned int i;
+    int opt;
+
+    while((opt = getopt(argc, argv, "rvi:f:ax")) != -1){
+        switch(opt){
+            case 'r':
+                realTime = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'i':
+                canId = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                for(i = 0; i < FILTERS_NUM; i++)
+                    if(strcmp(optarg, filters[i].name) == 0)
+                        break;
+
+                if(i == FILTERS_NUM){
+                    fprintf(stderr,"\tERR: unknown filter %s\n", optarg);
+                    return -1;
+                }
+
+                filter = filters[i].mode;
+                break;
+            case 'a':
+                all = 1;
+                break;
+            case 'x':
+                fixed = 1;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return -1;
+        }
+    }
+
+    if(optind >= argc){
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+
+    if(all){
+        if(strcmp(argv[optind], "-") == 0){
+            fprintf(stderr,"\tERR: -a needs a capture file, stdin can be replayed only once\n");
+            return -1;
+        }
+
+        printf("filter,updates,ns_per_update,worst_ns,tilt_rms_deg,tilt_max_deg\n");
+
+        for(i = 0; i < FILTERS_NUM; i++){
+            if(replay(argv[optind], realTime, 0, canId, filters[i].mode, 0, &res) < 0)
+                return -1;
+
+            printf("%s,%llu,%.1f,%llu,%.3f,%.3f\n", filters[i].name, (unsigned long long)res.nUpdates,
+                   res.nUpdates > 0 ? (double)res.procTime/res.nUpdates : 0.0, (unsigned long long)res.worst,
+                   res.nUpdates > 0 ? sqrt(res.tiltSq/res.nUpdates) : 0.0, res.tiltMax);
+        }
+
+        return 0;
+    }
+
+    if(verbose)
+        printf("timestamp,rxTime,qw,qx,qy,qz,sqw,sqx,sqy,sqz\n");
+
+    // the fixed-point path is Mahony's filter, compare it with the same one
+    if(fixed)
+        filter = IMU_ESTIMODE_MAHONY;
+
+    if(replay(argv[optind], realTime, verbose, canId, filter, fixed, &res) < 0)
+        return -1;
+
+    fprintf(stderr,"canid=0x%X frames=%llu other_ids=%llu updates=%llu complete=%u incomplete=%u duplicate=%u orphan=%u\n",
+            res.canId, (unsigned long long)res.nFrames, (unsigned long long)res.nOther, (unsigned long long)res.nUpdates,
+            res.stats.complete, res.stats.incomplete, res.stats.duplicate, res.stats.orphan);
+
+    if(res.nUpdates > 0)
+        fprintf(stderr,"ns/update=%.1f updates/s=%.0f worst_ns=%llu tilt_rms_deg=%.3f tilt_max_deg=%.3f\n",
+                (double)res.procTime/res.nUpdates, 1e9*res.nUpdates/(double)res.procTime, (unsigned long long)res.worst,
+                sqrt(res.tiltSq/res.nUpdates), res.tiltMax);
+
+    fprintf(stderr,"final q=%f,%f,%f,%f\n", res.q.w, res.q.x, res.q.y, res.q.z);
+    if(fixed && res.nUpdates > 0){
+        fprintf(stderr,"fixed ns/update=%.1f worst_ns=%llu tilt_rms_deg=%.3f tilt_max_deg=%.3f\n",
+                (double)res.fixedTime/res.nUpdates, (unsigned long long)res.fixedWorst,
+                sqrt(res.fixedTiltSq/res.nUpdates), res.fixedTiltMax);
+        fprintf(stderr,"fixed-float rms_deg=%.6f max_deg=%.6f final q=%f,%f,%f,%f\n",
+                sqrt(res.fixedDiffSq/res.nUpdates), res.fixedDiffMax,
+                res.fixedQ.w, res.fixedQ.x, res.fixedQ.y, res.fixedQ.z);
+    }
+
+    fprintf(stderr,"gyro bias=%f,%f,%f deg/s sigma=%f deg/s\n", res.bias.x, res.bias.y, res.bias.z, res.biasSigma);
+
+    return 0;
+}
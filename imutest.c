@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "imu.h"
+#include "imu_batch.h"
+#include "imucan.h"
+#include "imu_math.h"
+#include "imu_rsqrt.h"
+
+// Checks of the IMU library, run by "make check": the reciprocal square roots
+// against 1/sqrt, the imu_batch kernels against the scalar imu_algebra
+// functions and the batch complementary filter against imu_main_loop_ts() on
+// the same samples, and the fixed-point path of canReaderThread against the
+// float Mahony filter. Prints one line per check and exits non-zero when any
+// of them is out of tolerance.
+
+#define TEST_N      37      // not a multiple of any vector width, covers the tails
+#define TEST_STEPS  500
+#define TEST_PERIOD 10000000ULL
+#define TEST_TOL    1e-4f
+#define TEST_FILTER_TOL 1e-3f
+#define TEST_FIXED_TOL  1e-5f
+#define TEST_RATE       20.f    // deg/s about x, alternately half and one and a half
+#define TEST_RSQRT_N    1001    // log sweep of 1e-6 .. 1e6
+#define TEST_RSQRT_TOL  1e-5f   // relative, the bit trick with 2 steps reaches 5e-6
+
+static uint32_t lcg = 1;
+static int failed;
+
+static float randf(void){
+    lcg = lcg*1664525u + 1013904223u;
+
+    return (float)(lcg >> 8)/(float)(1u << 24)*2.f - 1.f;
+}
+
+static imu_quaternion_t randQuat(void){
+    imu_quaternion_t q = imu_quaternion_create(randf(), randf(), randf(), randf());
+
+    return imu_quaternion_normalize(&q);
+}
+
+static void check(const char* name, float err, float tol){
+    int ok = err <= tol;
+
+    printf("%s,%g,%s\n", name, err, ok ? "ok" : "FAIL");
+    failed |= !ok;
+}
+
+static float quatErr(const imu_quaternion_t* a, float w, float x, float y, float z){
+    float e = fabsf(a->w - w);
+
+    e = fmaxf(e, fabsf(a->x - x));
+    e = fmaxf(e, fabsf(a->y - y));
+    e = fmaxf(e, fabsf(a->z - z));
+
+    return e;
+}
+
+static float vecErr(const imu_vec3_t* a, float x, float y, float z){
+    return fmaxf(fabsf(a->x - x), fmaxf(fabsf(a->y - y), fabsf(a->z - z)));
+}
+
+// relative error of the reciprocal square roots against 1/sqrt in double
+static void testRsqrt(void){
+    float x[TEST_RSQRT_N], y[TEST_RSQRT_N];
+    double ref, err[3] = {0.0, 0.0, 0.0};
+    int i;
+
+    for(i = 0; i < TEST_RSQRT_N; i++)
+        x[i] = (float)pow(10.0, -6.0 + 12.0*i/(TEST_RSQRT_N - 1));
+
+    imu_rsqrt_n(y, x, TEST_RSQRT_N);
+
+    for(i = 0; i < TEST_RSQRT_N; i++){
+        ref = 1.0/sqrt((double)x[i]);
+        err[0] = fmax(err[0], fabs(imu_rsqrt(x[i]) - ref)/ref);
+        err[1] = fmax(err[1], fabs(imu_math_fast_inv_sqrt(x[i]) - ref)/ref);
+        err[2] = fmax(err[2], fabs(y[i] - ref)/ref);
+    }
+
+    check("imu_rsqrt", (float)err[0], TEST_RSQRT_TOL);
+    check("imu_math_fast_inv_sqrt", (float)err[1], TEST_RSQRT_TOL);
+    check("imu_rsqrt_n", (float)err[2], TEST_RSQRT_TOL);
+}
+
+static void testKernels(void){
+    float b[18][TEST_N];
+    imu_quaternion_soa_t q1 = {b[0], b[1], b[2], b[3]}, q2 = {b[4], b[5], b[6], b[7]}, qo = {b[8], b[9], b[10], b[11]};
+    imu_vec3_soa_t v = {b[12], b[13], b[14]}, vo = {b[15], b[16], b[17]};
+    imu_euler_soa_t eo = {b[15], b[16], b[17]};
+    imu_quaternion_t a[TEST_N], c[TEST_N], r;
+    imu_vec3_t u[TEST_N], s;
+    imu_euler_t e;
+    float err;
+    int i;
+
+    for(i = 0; i < TEST_N; i++){
+        a[i] = randQuat();
+        c[i] = randQuat();
+        u[i] = imu_vec3_create(randf()*10.f, randf()*10.f, randf()*10.f);
+        q1.w[i] = a[i].w; q1.x[i] = a[i].x; q1.y[i] = a[i].y; q1.z[i] = a[i].z;
+        q2.w[i] = c[i].w; q2.x[i] = c[i].x; q2.y[i] = c[i].y; q2.z[i] = c[i].z;
+        v.x[i] = u[i].x; v.y[i] = u[i].y; v.z[i] = u[i].z;
+    }
+
+    imu_batch_quaternion_product(&qo, &q1, &q2, TEST_N);
+    for(err = 0.f, i = 0; i < TEST_N; i++){
+        r = imu_quaternion_product(&a[i], &c[i]);
+        err = fmaxf(err, quatErr(&r, qo.w[i], qo.x[i], qo.y[i], qo.z[i]));
+    }
+    check("quaternion_product", err, TEST_TOL);
+
+    for(i = 0; i < TEST_N; i++){
+        qo.w[i] = q1.w[i]*3.f; qo.x[i] = q1.x[i]*3.f; qo.y[i] = q1.y[i]*3.f; qo.z[i] = q1.z[i]*3.f;
+    }
+    imu_batch_quaternion_normalize(&qo, &qo, TEST_N);
+    for(err = 0.f, i = 0; i < TEST_N; i++){
+        r = imu_quaternion_scale(&a[i], 3.f);
+        r = imu_quaternion_normalize(&r);
+        err = fmaxf(err, quatErr(&r, qo.w[i], qo.x[i], qo.y[i], qo.z[i]));
+    }
+    check("quaternion_normalize", err, TEST_TOL);
+
+    imu_batch_vec3_normalize(&vo, &v, TEST_N);
+    for(err = 0.f, i = 0; i < TEST_N; i++){
+        s = imu_vec3_normalize(&u[i]);
+        err = fmaxf(err, vecErr(&s, vo.x[i], vo.y[i], vo.z[i]));
+    }
+    check("vec3_normalize", err, TEST_TOL);
+
+    imu_batch_quaternion_rotate_vector(&vo, &q1, &v, TEST_N);
+    for(err = 0.f, i = 0; i < TEST_N; i++){
+        s = imu_quaternion_rotate_vector(&a[i], &u[i]);
+        err = fmaxf(err, vecErr(&s, vo.x[i], vo.y[i], vo.z[i])/10.f);
+    }
+    check("quaternion_rotate_vector", err, TEST_TOL);
+
+    imu_batch_quaternion_to_euler(&eo, &q1, TEST_N);
+    for(err = 0.f, i = 0; i < TEST_N; i++){
+        e = imu_quaternion_to_euler(&a[i]);
+        // angles near +-180 may wrap to the other side
+        err = fmaxf(err, fminf(fabsf(e.roll - eo.roll[i]), 360.f - fabsf(e.roll - eo.roll[i]))/180.f);
+        err = fmaxf(err, fabsf(e.pitch - eo.pitch[i])/180.f);
+        err = fmaxf(err, fminf(fabsf(e.yaw - eo.yaw[i]), 360.f - fabsf(e.yaw - eo.yaw[i]))/180.f);
+    }
+    check("quaternion_to_euler", err, TEST_TOL);
+}
+
+#if !defined(IMU_FILTER) || IMU_FILTER == IMU_ESTIMODE_COMPLEMENTARY
+// TEST_N independent filters with their own offsets and motion, each fed to
+// imu_main_loop_ts() and, as one lane, to imu_batch_complementary_step()
+static void testComplementary(void){
+    float b[10][TEST_N], dt[TEST_N];
+    imu_quaternion_soa_t q = {b[0], b[1], b[2], b[3]};
+    imu_vec3_soa_t gyro = {b[4], b[5], b[6]}, accel = {b[7], b[8], b[9]};
+    imu_t imu[TEST_N];
+    imu_vec3_t rate[TEST_N];
+    float gx, gy, gz, ax, ay, az, err = 0.f;
+    uint64_t ts;
+
+    for(int i = 0; i < TEST_N; i++){
+        imu[i] = imu_init();
+        imu_set_estimation_mode(&imu[i], IMU_ESTIMODE_GYRO | IMU_ESTIMODE_ACCELEROMETER | IMU_ESTIMODE_COMPLEMENTARY);
+        imu_set_gyro_scale_factor(&imu[i], 1.f/131.f);
+        imu_set_accelerometer_scale_factor(&imu[i], 1.f/16384.f);
+        imu[i].gyro_offset = imu_vec3_create(randf()*20.f, randf()*20.f, randf()*20.f);
+        imu_set_state(&imu[i], IMU_STATE_READY);
+        rate[i] = imu_vec3_create(randf()*2000.f, randf()*2000.f, randf()*2000.f);
+        q.w[i] = 1.f; q.x[i] = q.y[i] = q.z[i] = 0.f;
+    }
+
+    for(int k = 0; k < TEST_STEPS; k++){
+        ts = 1000000000ULL + k*TEST_PERIOD;
+
+        for(int i = 0; i < TEST_N; i++){
+            gx = imu[i].gyro_offset.x + rate[i].x + randf()*50.f;
+            gy = imu[i].gyro_offset.y + rate[i].y + randf()*50.f;
+            gz = imu[i].gyro_offset.z + rate[i].z + randf()*50.f;
+            ax = randf()*2000.f;
+            ay = randf()*2000.f;
+            az = 16384.f + randf()*2000.f;
+
+            imu_set_gyro_raw(&imu[i], gx, gy, gz);
+            imu_set_accelerometer_raw(&imu[i], ax, ay, az);
+            imu_main_loop_ts(&imu[i], ts);
+
+            gyro.x[i]  = (gx - imu[i].gyro_offset.x)*imu[i]._scale_factor_gyro;
+            gyro.y[i]  = (gy - imu[i].gyro_offset.y)*imu[i]._scale_factor_gyro;
+            gyro.z[i]  = (gz - imu[i].gyro_offset.z)*imu[i]._scale_factor_gyro;
+            accel.x[i] = ax*imu[i]._scale_factor_accelerometer;
+            accel.y[i] = ay*imu[i]._scale_factor_accelerometer;
+            accel.z[i] = az*imu[i]._scale_factor_accelerometer;
+            // the first sample of imu_main_loop_ts() is not integrated
+            dt[i] = k == 0 ? 0.f : TEST_PERIOD*1e-9f;
+        }
+
+        imu_batch_complementary_step(&q, &gyro, &accel, dt, imu[0]._alpha, TEST_N);
+    }
+
+    for(int i = 0; i < TEST_N; i++)
+        err = fmaxf(err, quatErr(&imu[i].orientation_quat, q.w[i], q.x[i], q.y[i], q.z[i]));
+
+    check("complementary_step", err, TEST_FILTER_TOL);
+}
+#endif
+
+// A sample stamped before the previous one must not change the interval the
+// next one is integrated over. The rotation is about gravity, so the tilt
+// correction the late sample still gets changes nothing.
+static void testLateSample(void){
+    imu_t a = imu_init(), b = imu_init();
+    uint64_t ts;
+
+    imu_set_estimation_mode(&a, IMU_ESTIMODE_GYRO | IMU_ESTIMODE_ACCELEROMETER);
+    imu_set_gyro_scale_factor(&a, 1.f/131.f);
+    imu_set_accelerometer_scale_factor(&a, 1.f/16384.f);
+    imu_set_accelerometer_raw(&a, 0.f, 0.f, 16384.f);
+    imu_set_state(&a, IMU_STATE_READY);
+    b = a;
+
+    for(int k = 0; k < TEST_STEPS; k++){
+        ts = 1000000000ULL + k*TEST_PERIOD;
+
+        imu_set_gyro_raw(&a, 0.f, 0.f, TEST_RATE*131.f);
+        imu_set_gyro_raw(&b, 0.f, 0.f, TEST_RATE*131.f);
+        imu_main_loop_ts(&a, ts);
+        imu_main_loop_ts(&b, ts);
+
+        if(k % 50 == 10)
+            imu_main_loop_ts(&b, ts - 3*TEST_PERIOD);
+    }
+
+    check("late_sample", quatErr(&a.orientation_quat, b.orientation_quat.w, b.orientation_quat.x,
+                                 b.orientation_quat.y, b.orientation_quat.z), TEST_TOL);
+}
+
+// The float Mahony filter as imu_main_loop_ts() runs it without FILTER=,
+// called directly since FILTER= builds pin imu_process_raw_data_dt()
+static void mahonyStep(imu_t* imu, const imuSample_t* sample, float dt){
+    imu_set_accelerometer_raw(imu, sample->accel[0], sample->accel[1], sample->accel[2]);
+    imu_set_gyro_raw(imu, sample->gyro[0], sample->gyro[1], sample->gyro[2]);
+
+    if(imu->_calibration_mode == IMU_CALIBMODE_ONLINE &&
+       imu_bias_update(&imu->bias, &imu->gyro_raw, &imu->accelerometer_raw, imu->_scale_factor_gyro, imu->_scale_factor_accelerometer))
+        imu->gyro_offset = imu->bias.bias;
+
+    imu_process_raw_data_mahony(imu, dt);
+}
+
+// imuCanSensorUpdate() with fixedPoint, as FIXED=1 builds run it on the CAN
+// thread: the attitude and scaled rates it publishes in imu must move, and stay
+// close to what the float Mahony filter makes of the same samples
+static void testFixedPath(void){
+    imuCanSensor_t fx, fl;
+    imuSample_t sample;
+    imu_quaternion_t q;
+    imu_vec3_t axis;
+    float rate = 0.f, err = 0.f;
+
+    imuCanSensorInit(&fx, 0, 0);
+    imuCanSensorInit(&fl, 0, 0);
+    fx.fixedPoint = 1;
+    imu_bias_init(&fl.imu.bias, &fl.imu.gyro_offset);
+
+    memset(&sample, 0, sizeof(sample));
+    for(int k = 0; k < TEST_STEPS; k++){
+        sample.timestamp  = 1 + k*(uint32_t)(TEST_PERIOD/IMU_CAN_TIMESTAMP_NS);
+        sample.sampleTime = sample.timestamp*IMU_CAN_TIMESTAMP_NS;
+        // not constant, or the online bias estimate would take it for a still sensor
+        rate = k % 2 ? 1.5f*TEST_RATE : 0.5f*TEST_RATE;
+        sample.gyro[0]  = (int16_t)lrintf(rate/(GYRO_SCALE) + GYRO_X_OFFSET);
+        sample.gyro[1]  = (int16_t)lrintf(GYRO_Y_OFFSET);
+        sample.gyro[2]  = (int16_t)lrintf(GYRO_Z_OFFSET);
+        sample.accel[2] = 16383;
+
+        imuCanSensorUpdate(&fx, &sample);
+        mahonyStep(&fl.imu, &sample, k == 0 ? 0.f : TEST_PERIOD*1e-9f);
+    }
+
+    q = imu_fixed_get_quaternion(&fx.fixed);
+    check("fixed_published", quatErr(&fx.imu.orientation_quat, q.w, q.x, q.y, q.z), 0.f);
+
+    // attitude left the identity, about x
+    axis = imu_vec3_create(fx.imu.orientation_quat.x, fx.imu.orientation_quat.y, fx.imu.orientation_quat.z);
+    check("fixed_moved", fx.imu.orientation_quat.x > 0.01f && fabsf(axis.y) + fabsf(axis.z) < 0.01f ? 0.f : 1.f, 0.f);
+    check("fixed_gyro", fabsf(fx.imu.gyro.x - rate)/rate, 0.01f);
+
+    err = quatErr(&fl.imu.orientation_quat, fx.imu.orientation_quat.w, fx.imu.orientation_quat.x,
+                  fx.imu.orientation_quat.y, fx.imu.orientation_quat.z);
+    check("fixed_vs_mahony", err, TEST_FIXED_TOL);
+}
+
+int main(void){
+    printf("# simd %s\n", imu_batch_simd_name());
+    printf("check,max_err,result\n");
+
+    testRsqrt();
+    testKernels();
+#if defined(IMU_FILTER) && IMU_FILTER != IMU_ESTIMODE_COMPLEMENTARY
+    // imu_main_loop_ts() runs another filter in this build
+    printf("complementary_step,,skipped\n");
+#else
+    testComplementary();
+#endif
+    testLateSample();
+    testFixedPath();
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,7 +1,3 @@
-#include <sys/ioctl.h>
-#include <net/if.h>
-#include <linux/can.h>
-#include <linux/can/raw.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -23,6 +19,16 @@
 #include "dma.h"
 #include "crc32.h"
 #include "imu.h"
+#include "trace.h"
+#include "can.h"
+#include "imucan.h"
+#include "imuhist.h"
+#include "eventfile.h"
+#include "timesvc.h"
+#include "gtuclock.h"
+#include "finalize.h"
+#include "evtwriter.h"
+#include "evtqueue.h"
 
 #define CONN_PORT        5000
 #define IMU_PORT         5001
@@ -31,16 +37,23 @@
 #define BIND_MAX_TRIES   10
 #define LISTEN_MAX_TRIES 10
 
-#define DATA_HEADER      0x424B4C43
 #define DATA_ADDR        0x00000000
-#define DATA_BYTES       512
-#define DATA_NUMERICS    6
-#define DATA_WORDS       (DATA_BYTES/4)
-#define DATA_GPS_BYTES   (DATA_BYTES-(DATA_NUMERICS*4))
 
 #define UNIXTIME_LEN     15
 #define FILENAME_LEN     55
+#define FILENAME_EXT_LEN 8
+#define CAPNAME_LEN      48
 #define TRG_NUM_PER_FILE 25
+#define FILE_PREALLOC    ((TRG_NUM_PER_FILE+1)*sizeof(spb2Data_t))
+#define ATT_PREALLOC     (TRG_NUM_PER_FILE*sizeof(spb2Att_t))
+
+#define RUN_FILE         "/srv/ftp/.clkb_run"
+
+#ifndef SW_VERSION
+#define SW_VERSION       "unknown"
+#endif
+
+#define USAGE "Usage: %s [-b boardid] [-z keyframes] [-w stdio|uring] [-q queuelen] [-p block|drop-newest|drop-oldest|degrade] [canid[/mask] ...]\n"
 
 #define TRGCNT_IDX 0
 #define GTUCNT_IDX 1
@@ -51,29 +64,12 @@
 
 #define RUN_STATUS_MASK 0x01
 
-#define CAN_TIMESTAMP_ID 19
-#define CAN_AX_ID        20
-#define CAN_AY_ID        21
-#define CAN_AZ_ID        22
-#define CAN_GX_ID        23
-#define CAN_GY_ID        24
-#define CAN_GZ_ID        25
-#define CAN_Q0_ID        32
-#define CAN_Q1_ID        33
-#define CAN_Q2_ID        34
-#define CAN_Q3_ID        35
-#define CAN_ROLL_ID      36
-#define CAN_PITCH_ID     37
-#define CAN_YAW_ID       38
-
-#define ACCEL_SCALE 2.0/32767.0
-#define GYRO_SCALE  250.0/32767.0
-
-#define GYRO_X_OFFSET 61.98
-#define GYRO_Y_OFFSET 27.80
-#define GYRO_Z_OFFSET 54.97
-
-#define IMUSTR_MAX_LEN 1024
+#define CAN_IFNAME       "can0"
+#define IMU_CAN_ID       0x0B2
+#define IMU_CAN_MASK     CAN_SFF_MASK
+
+#define IMUSTR_LEN     1024
+#define IMUSTR_MAX_LEN (IMUSTR_LEN*IMU_CAN_MAX_SENSORS)
 
 pthread_mutex_t mtx;
 
@@ -90,58 +86,141 @@ typedef struct chkFifoArgs{
     int*            socketStatus;
     uint32_t*       fifoData;
     uint32_t*       imuTimestamp;
+    imuHist_t*      imuHist;
 } chkFifoArgs_t;
 
+typedef struct storageArgs{
+    uint32_t     keyInterval;
+    uint32_t     boardId;
+    evtWriter_t* writer;
+    // the .att sidecar of the event file, same backend
+    evtWriter_t* attWriter;
+} storageArgs_t;
+
 typedef struct canReaderArgs{
     uint32_t* cmdID;
-    int       canSocket;
+    canSource_t* canSrc;
     uint32_t* imuTimestamp;
-    imu_t*    imu;
-    float*    quat;
-    float*    eulers;
+    imuCanSensor_t* sensors;
+    int             nSensors;
+    imuHist_t*      imuHist;
 } canReaderArgs_t;
 
 typedef struct imuDataOutArgs{
     uint32_t* cmdID;
-    uint32_t* imuTimestamp;
-    imu_t*    imu;
-    float*    quat;
-    float*    eulers;
+    imuCanSensor_t* sensors;
+    int             nSensors;
 } imuDataOutArgs_t;
 
-typedef struct spb2Data{
-    uint32_t     header;
-    uint32_t     unixTime;
-    uint32_t     trgCount;
-    uint32_t     gtuCount;
-    uint32_t     trgFlag;
-    uint32_t     aliveTime;
-    uint32_t     deadTime;
-    uint32_t     status;
-    char         gpsStr[DATA_GPS_BYTES];
-    unsigned int crc;
-} spb2Data_t;
-
 void genFileName(uint32_t fileCounter, char* fileName, uint32_t fileNameLen){
-    time_t rawtime = time(NULL);
-    struct tm *ptm = localtime(&rawtime);
+    char stamp[TIMESVC_STAMP_LEN];
 
-    snprintf(fileName, fileNameLen, "/srv/ftp/clkb_event_%04d%02d%02d%02d%02d%02d-%04d.dat.lock",
-             ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday,
-             ptm->tm_hour, ptm->tm_min, ptm->tm_sec,
-             fileCounter);
+    timeSvcStamp(timeSvcNowNs(), stamp);
+    snprintf(fileName, fileNameLen, "/srv/ftp/clkb_event_%s-%04d.dat.lock", stamp, fileCounter);
 
     return;
 }
 
+void genCaptureName(char* capName, uint32_t capNameLen){
+    char stamp[TIMESVC_STAMP_LEN];
+
+    timeSvcStamp(timeSvcNowNs(), stamp);
+    snprintf(capName, capNameLen, "/srv/ftp/can_%s.cap", stamp);
+
+    return;
+}
+
+void genAttFileName(char* fileName, char* attFileName, uint32_t fileNameLen){
+    size_t len = strlen(fileName);
+
+    strncpy(attFileName, fileName, fileNameLen-1);
+
+    if(len >= FILENAME_EXT_LEN)
+        memcpy(attFileName+len-FILENAME_EXT_LEN, "att.lock", FILENAME_EXT_LEN);
+
+    return;
+}
+
+// The finalizer thread drops the .lock suffix, the name is cleared so that the
+// file is handed over only once.
 void unlockFile(char* fileName){
-    char unlockedFileName[FILENAME_LEN] = "";
+    finalizeSubmit(fileName, NULL);
+    fileName[0] = '\0';
 
-    if(strncmp(fileName,"",FILENAME_LEN) != 0){
-        strncpy(unlockedFileName,fileName,strlen(fileName)-5);
-        rename(fileName,unlockedFileName);
+    return;
+}
+
+// The sidecar holds one spb2Att_t per record of the event file.
+void openAttFile(evtWriter_t* writer, char* attFileName){
+    if(evtWriterOpen(writer, attFileName, ATT_PREALLOC) < 0)
+        fprintf(stderr,"\tERR: cannot open %s\n",attFileName);
+
+    return;
+}
+
+// Like the event file, released once its writes are done.
+void closeAttFile(evtWriter_t* writer, char* attFileName){
+    if(attFileName[0] != '\0' && evtWriterClose(writer) < 0)
+        fprintf(stderr,"\tERR: cannot close %s\n",attFileName);
+
+    unlockFile(attFileName);
+
+    return;
+}
+
+// Run numbers survive restarts in RUN_FILE, each run takes the next one.
+uint32_t nextRunNumber(void){
+    FILE* file;
+    unsigned int run = 0;
+
+    file = fopen(RUN_FILE, "r");
+    if(file != NULL){
+        if(fscanf(file, "%u", &run) != 1)
+            run = 0;
+        fclose(file);
     }
 
+    run++;
+
+    file = fopen(RUN_FILE, "w");
+    if(file != NULL){
+        fprintf(file, "%u\n", run);
+        fclose(file);
+    }else
+        fprintf(stderr,"\tERR: cannot save run number %u in %s\n",run,RUN_FILE);
+
+    return run;
+}
+
+// Writes the file header, the records follow it.
+void openEventFile(evtWriter_t* writer, char* fileName, evtFileHeader_t* hdr, evtIndex_t* idx, uint32_t stride){
+    uint32_t offset = 0;
+
+    evtFileHeaderSeal(hdr);
+
+    if(evtWriterOpen(writer, fileName, FILE_PREALLOC) < 0)
+        fprintf(stderr,"\tERR: cannot open %s\n",fileName);
+    else if(evtWriterWrite(writer, hdr, sizeof(evtFileHeader_t)) < 0)
+        fprintf(stderr,"\tERR: cannot write header of %s\n",fileName);
+    else
+        offset = sizeof(evtFileHeader_t);
+
+    evtIndexReset(idx, stride, offset);
+
+    return;
+}
+
+// Releases the file with its index trailer (when enabled), which the finalizer
+// thread appends before the rename.
+void closeEventFile(evtWriter_t* writer, char* fileName, evtIndex_t* idx, uint32_t stride){
+    if(fileName[0] != '\0' && evtWriterClose(writer) < 0)
+        fprintf(stderr,"\tERR: cannot close %s\n",fileName);
+
+    finalizeSubmit(fileName, (idx->summary.nRecords > 0 && evtIndexEnabled()) ? idx : NULL);
+    fileName[0] = '\0';
+
+    evtIndexReset(idx, stride, 0);
+
     return;
 }
 
@@ -173,22 +252,33 @@ void* cmdDecodeThread(void *arg){
     pthread_exit((void *)cmdArg->cmdID);
 }   
 
+// Events are built here and handed to the storage thread through the write
+// queue, a close item when the run stops. Jumps of the trigger counter are
+// passed along as upstream gaps.
 void* checkFifoThread(void *arg){
-    FILE *outFile;
     chkFifoArgs_t* chkArg = (chkFifoArgs_t*)arg;
     unsigned int exitCondition = 0;
     uint32_t statusReg = 0;
     uint32_t running = 0;
+    uint32_t wasRunning = 0;
     int socketStatusLocal = 0;
     uint32_t cmdIDLocal = NONE;
-    uint32_t eventCounter = 0;
-    uint32_t fileCounter = 0;
     uint32_t imuTimestamp = 0;
-    char fileName[FILENAME_LEN] = "";
-    spb2Data_t data = {0, 0, 0, 0, 0, 0, 0, 0, "", 0};
+    uint32_t lastTrg = 0;
+    uint64_t eventTime;
+    imu_quaternion_t attQuat = {1.0f, 0.0f, 0.0f, 0.0f};
+    spb2Data_t data = {0, 0, 0, 0, 0, 0, 0, 0, "", 0, 0};
+    spb2Att_t att;
+    evtQueueItem_t item;
+
+    traceRegister("checkFifo");
+    memset(&item, 0, sizeof(item));
 
     while(!exitCondition){
+        traceEvent(TRACE_DMA_ARMED, lastTrg);
         dma_transfer_s2mm(chkArg->regs->dmaReg, DATA_BYTES, chkArg->socketStatus, chkArg->cmdID, chkArg->regs->statusReg, &mtx);
+        eventTime = timeSvcNowNs();
+        traceEvent(TRACE_DMA_DONE, lastTrg);
 
         pthread_mutex_lock(&mtx);
         socketStatusLocal = *chkArg->socketStatus;
@@ -203,16 +293,8 @@ void* checkFifoThread(void *arg){
         memset(data.gpsStr, '\0', DATA_GPS_BYTES);
 
         if(!exitCondition && running){
-            if(!(eventCounter++ % TRG_NUM_PER_FILE)){
-                unlockFile(fileName);
-                genFileName(fileCounter++,fileName,FILENAME_LEN);
-            }
-
-            outFile = fopen(fileName, "ab");
-
             data.header    = DATA_HEADER;
             pthread_mutex_lock(&mtx);
-            data.unixTime  = (uint32_t)time(NULL);
             data.trgCount  = *(chkArg->fifoData+TRGCNT_IDX);
             data.gtuCount  = *(chkArg->fifoData+GTUCNT_IDX);
             data.trgFlag   = *(chkArg->fifoData+TRGFLG_IDX);
@@ -233,101 +315,305 @@ void* checkFifoThread(void *arg){
 
             pthread_mutex_unlock(&mtx);
 
-            data.crc = crc_32((unsigned char *)&data, sizeof(data)-sizeof(data.crc), startCRC32);
+            if(data.trgFlag & GTU_CLOCK_PPS_FLAG)
+                gtuClockAddPps(data.gtuCount, eventTime);
+
+            traceEvent(TRACE_RECORD_BUILT, data.trgCount);
+
+            memset(&att, 0, sizeof(att));
+            att.header    = ATT_HEADER;
+            att.trgCount  = data.trgCount;
+            att.gtuCount  = data.gtuCount;
+            att.eventTime = eventTime;
+            att.flags     = imuHistLookup(chkArg->imuHist, att.eventTime, &attQuat, &att.imuTimestamp);
+            att.quat[0]   = attQuat.w;
+            att.quat[1]   = attQuat.x;
+            att.quat[2]   = attQuat.y;
+            att.quat[3]   = attQuat.z;
+            att.crc       = crc_32((unsigned char *)&att, sizeof(att)-sizeof(att.crc), startCRC32);
+
+            memset(&item.dropped, 0, sizeof(item.dropped));
+            memset(&item.upstream, 0, sizeof(item.upstream));
+
+            // triggers the FIFO never gave us (a backward jump is a counter reset)
+            if(wasRunning && (int32_t)(data.trgCount - lastTrg) > 1){
+                item.upstream.nEvents       = data.trgCount - lastTrg - 1;
+                item.upstream.firstTrgCount = lastTrg + 1;
+                item.upstream.lastTrgCount  = data.trgCount - 1;
+            }
+
+            lastTrg    = data.trgCount;
+            wasRunning = 1;
 
-            fwrite(&data, sizeof(data), 1, outFile);
+            item.type      = EVT_ITEM_EVENT;
+            item.eventTime = eventTime;
+            item.data      = data;
+            item.att       = att;
+
+            traceEvent(evtQueuePush(&item) < 0 ? TRACE_DROPPED : TRACE_QUEUED, data.trgCount);
+        }else if(wasRunning){
+            wasRunning = 0;
+
+            memset(&item, 0, sizeof(item));
+            item.type = EVT_ITEM_CLOSE;
+            evtQueuePush(&item);
+        }
+    }
+
+    pthread_exit((void *)chkArg->fifoData);
+}
+
+// Marks lost events in the current file; the record that follows is stamped
+// stampTime.
+void writeGap(evtWriter_t* writer, char* fileName, evtIndex_t* idx, uint32_t kind, const evtQueueGap_t* lost, uint64_t stampTime){
+    evtQueueStats_t qStats;
+    evtGap_t gap;
+
+    if(lost->nEvents == 0 || fileName[0] == '\0')
+        return;
+
+    evtQueueGetStats(&qStats);
+
+    memset(&gap, 0, sizeof(gap));
+    gap.kind          = kind;
+    gap.nEvents       = lost->nEvents;
+    gap.firstTrgCount = lost->firstTrgCount;
+    gap.lastTrgCount  = lost->lastTrgCount;
+    gap.firstGtuCount = lost->firstGtuCount;
+    gap.lastGtuCount  = lost->lastGtuCount;
+    gap.unixTime      = (uint32_t)(stampTime/1000000000ULL);
+    gap.unixNsec      = (uint32_t)(stampTime%1000000000ULL);
+    gap.policy        = qStats.policy;
+    evtGapSeal(&gap);
+
+    if(evtWriterWrite(writer, &gap, sizeof(gap)) < 0)
+        fprintf(stderr,"\tERR: cannot write gap marker to %s\n",fileName);
+
+    evtIndexSkip(idx, sizeof(gap));
+
+    return;
+}
+
+void writeGaps(evtWriter_t* writer, char* fileName, evtIndex_t* idx, const evtQueueItem_t* item, uint64_t stampTime){
+    writeGap(writer, fileName, idx, EVT_GAP_UPSTREAM, &item->upstream, stampTime);
+    writeGap(writer, fileName, idx, EVT_GAP_DROPPED, &item->dropped, stampTime);
+
+    return;
+}
+
+// Writes what checkFifo queues, for the whole life of the daemon.
+void* storageThread(void *arg){
+    storageArgs_t* stoArg = (storageArgs_t*)arg;
+    uint32_t eventCounter = 0;
+    uint32_t fileCounter = 0;
+    uint32_t degradedLeft = 0;
+    uint32_t nDegraded;
+    char fileName[FILENAME_LEN] = "";
+    char attFileName[FILENAME_LEN] = "";
+    uint64_t eventTime;
+    uint64_t stampTime = 0;
+    uint8_t useModel = 0;
+    gtuClockParams_t clockParams;
+    evtQueueItem_t item;
+    evtQueueGap_t degradedRun;
+    // lost with no file open, marked in the next one
+    evtQueueGap_t heldDropped, heldUpstream;
+    spb2Data_t* data = &item.data;
+    evtIndex_t evtIdx;
+    evtFileHeader_t fileHdr;
+    evtZState_t evtZ;
+    uint8_t zData[EVT_Z_MAX_LEN];
+    spb2LData_t liteData;
+    size_t zLen;
+    int writeErr;
+    // index entries must fall on keyframes of compressed files
+    uint32_t stride = stoArg->keyInterval > 0 ? stoArg->keyInterval : EVT_INDEX_STRIDE;
+
+    traceRegister("storage");
+    evtIndexReset(&evtIdx, stride, 0);
+    evtZReset(&evtZ, stoArg->keyInterval);
+    memset(&heldDropped, 0, sizeof(heldDropped));
+    memset(&heldUpstream, 0, sizeof(heldUpstream));
+    evtFileHeaderInit(&fileHdr, stoArg->boardId, stoArg->keyInterval, EVT_CLOCK_TIMESVC, SW_VERSION);
+
+    while(1){
+        // a run of degraded events is marked once, up to the end of the file
+        nDegraded = evtQueuePop(&item, TRG_NUM_PER_FILE - eventCounter % TRG_NUM_PER_FILE, &degradedRun);
+        eventTime = item.eventTime;
+
+        if(item.type == EVT_ITEM_CLOSE){
+            if(fileName[0] == '\0'){
+                evtQueueGapMerge(&item.dropped, &heldDropped);
+                evtQueueGapMerge(&item.upstream, &heldUpstream);
+                heldDropped  = item.dropped;
+                heldUpstream = item.upstream;
+            }else
+                writeGaps(stoArg->writer, fileName, &evtIdx, &item, stampTime);
 
-            fclose(outFile);
-        }else{
             eventCounter = 0;
             fileCounter = 0;
-            unlockFile(fileName);
+            degradedLeft = 0;
+            closeEventFile(stoArg->writer, fileName, &evtIdx, stride);
+            closeAttFile(stoArg->attWriter, attFileName);
+            continue;
+        }
+
+        // the model the file is stamped with restarted (e.g. "gtu reset"), the rest goes to a new file
+        if(useModel && eventCounter % TRG_NUM_PER_FILE != 0 && gtuClockEpoch() != clockParams.epoch)
+            eventCounter += TRG_NUM_PER_FILE - eventCounter % TRG_NUM_PER_FILE;
+
+        if(!(eventCounter++ % TRG_NUM_PER_FILE)){
+            closeEventFile(stoArg->writer, fileName, &evtIdx, stride);
+            closeAttFile(stoArg->attWriter, attFileName);
+
+            if(eventCounter == 1)
+                fileHdr.info.runNumber = nextRunNumber();
+
+            genFileName(fileCounter,fileName,FILENAME_LEN);
+            genAttFileName(fileName,attFileName,FILENAME_LEN);
+
+            fileHdr.info.fileNumber  = fileCounter;
+            fileHdr.info.createdTime = (uint32_t)(eventTime/1000000000ULL);
+
+            // a file is stamped by the GTU clock model only if there was one when it was opened,
+            // and all of it by that model, the one its header describes
+            gtuClockGet(&clockParams);
+            useModel = clockParams.valid;
+            fileHdr.info.clockSource = useModel ? EVT_CLOCK_GTU : EVT_CLOCK_TIMESVC;
+            gtuClockInfo(&clockParams, &fileHdr.info.clock);
+
+            openEventFile(stoArg->writer, fileName, &fileHdr, &evtIdx, stride);
+            openAttFile(stoArg->attWriter, attFileName);
+            evtZReset(&evtZ, stoArg->keyInterval);
+            degradedLeft = 0;
+            traceEvent(TRACE_FILE_ROTATED, fileCounter++);
+        }
+
+        if(!useModel || gtuClockStamp(&clockParams, data->gtuCount, &stampTime) < 0)
+            stampTime = eventTime;
+
+        data->unixTime  = (uint32_t)(stampTime/1000000000ULL);
+        data->unixNsec  = (uint32_t)(stampTime%1000000000ULL);
+
+        evtQueueGapMerge(&item.dropped, &heldDropped);
+        evtQueueGapMerge(&item.upstream, &heldUpstream);
+        memset(&heldDropped, 0, sizeof(heldDropped));
+        memset(&heldUpstream, 0, sizeof(heldUpstream));
+        writeGaps(stoArg->writer, fileName, &evtIdx, &item, stampTime);
+
+        if(item.degraded && degradedLeft == 0){
+            writeGap(stoArg->writer, fileName, &evtIdx, EVT_GAP_DEGRADED, &degradedRun, stampTime);
+            degradedLeft = nDegraded;
         }
+        if(item.degraded)
+            degradedLeft--;
+
+        data->crc = crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32);
+        traceEvent(TRACE_CRC_DONE, data->trgCount);
+
+        if(item.degraded){
+            evtLiteEncode(data, &liteData);
+            evtZSkip(&evtZ);
+            zLen = sizeof(liteData);
+            writeErr = evtWriterWrite(stoArg->writer, &liteData, sizeof(liteData));
+        }else if(stoArg->keyInterval > 0){
+            zLen = evtZEncode(&evtZ, data, zData);
+            writeErr = evtWriterWrite(stoArg->writer, zData, zLen);
+        }else{
+            zLen = sizeof(*data);
+            writeErr = evtWriterWrite(stoArg->writer, data, sizeof(*data));
+        }
+        traceEvent(TRACE_WRITE_ISSUED, data->trgCount);
+
+        if(writeErr < 0)
+            fprintf(stderr,"\tERR: cannot write event %u to %s\n",data->trgCount,fileName);
+
+        evtIndexAdd(&evtIdx, data, zLen);
+
+        if(evtWriterWrite(stoArg->attWriter, &item.att, sizeof(item.att)) < 0)
+            fprintf(stderr,"\tERR: cannot write attitude of event %u to %s\n",data->trgCount,attFileName);
     }
 
-    pthread_exit((void *)chkArg->fifoData);
+    pthread_exit(NULL);
 }
 
 void* canReaderThread(void *arg){
     canReaderArgs_t* canArg = (canReaderArgs_t*)arg;
-    struct can_frame frame;
+    canRxFrame_t frames[CAN_BATCH_LEN];
+    imuCanSensor_t* sensor;
+    imuSample_t sample;
+    imu_quaternion_t quat;
+    FILE* capFile = NULL;
+    char capName[CAPNAME_LEN] = "";
     unsigned int exitCondition = 0;
     uint32_t cmdIDLocal = 0;
-    int      nBytes     = 0;
-    uint8_t  dataIdx    = 0;
-    uint32_t timestamp  = 0;
-    int16_t  accel[3]   = {0,0,0};
-    int16_t  gyro[3]    = {0,0,0};
-    float    quat[4]    = {0.0,0.0,0.0,0.0};
-    float    eulers[3]  = {0.0,0.0,0.0};
+    int      nFrames    = 0;
+
+    traceRegister("canReader");
 
     while(1){
-        nBytes = read(canArg->canSocket, &frame, sizeof(struct can_frame));
+        nFrames = canSourceRecv(canArg->canSrc, frames, CAN_BATCH_LEN);
 
         pthread_mutex_lock(&mtx);
         cmdIDLocal = *canArg->cmdID;
+        for(int i = 0; i < canArg->nSensors; i++)
+            canArg->sensors[i].stats = canArg->sensors[i].assembler.stats;
         pthread_mutex_unlock(&mtx);
 
-        exitCondition = (nBytes <= 0) || (cmdIDLocal == EXIT);
+        exitCondition = (nFrames <= 0) || (cmdIDLocal == EXIT);
 
         if(exitCondition != 0)
             break;
 
-        dataIdx = frame.data[0];
-
-        switch(dataIdx){
-            case CAN_TIMESTAMP_ID:
-                timestamp = frame.data[1]      |
-                            frame.data[2] << 8 |
-                            frame.data[3] << 16|
-                            frame.data[4] << 24;
-                break;
-            case CAN_AX_ID:
-            case CAN_AY_ID:
-            case CAN_AZ_ID:
-                accel[dataIdx-CAN_AX_ID] = frame.data[1] | frame.data[2] << 8;
-                break;
-            case CAN_GX_ID:
-            case CAN_GY_ID:
-            case CAN_GZ_ID:
-                gyro[dataIdx-CAN_GX_ID] = frame.data[1] | frame.data[2] << 8;
-                break;
-            case CAN_Q0_ID:
-            case CAN_Q1_ID:
-            case CAN_Q2_ID:
-            case CAN_Q3_ID:
-                quat[dataIdx-CAN_Q0_ID] = (float)(frame.data[1]      |
-                                                  frame.data[2] << 8 |
-                                                  frame.data[3] << 16|
-                                                  frame.data[4] << 24)/1000.0;
-                break;
-            case CAN_ROLL_ID:
-            case CAN_PITCH_ID:
-            case CAN_YAW_ID:
-                eulers[dataIdx-CAN_ROLL_ID] = (float)(frame.data[1]      |
-                                                      frame.data[2] << 8 |
-                                                      frame.data[3] << 16|
-                                                      frame.data[4] << 24)/1000.0;
-                break;
+        if(canCaptureEnabled() && capFile == NULL){
+            genCaptureName(capName, CAPNAME_LEN);
+            capFile = canCaptureOpen(capName);
+            if(capFile == NULL){
+                fprintf(stderr,"\tERR: Cannot open CAN capture %s...\n", capName);
+                canCaptureEnable(0);
+            }
+        }else if(!canCaptureEnabled() && capFile != NULL){
+            canCaptureClose(capFile);
+            capFile = NULL;
+            if(canCaptureDropped() > 0)
+                fprintf(stderr,"\tERR: %" PRIu64 " CAN frames not captured so far...\n", canCaptureDropped());
         }
 
-        if(dataIdx == CAN_YAW_ID){
-            pthread_mutex_lock(&mtx);
+        if(capFile != NULL)
+            canCaptureWrite(capFile, frames, nFrames);
+
+        for(int f = 0; f < nFrames; f++){
+            traceEvent(TRACE_CAN_FRAME, frames[f].frame.can_id);
 
-            memcpy(canArg->quat, quat, sizeof(quat));
-            memcpy(canArg->eulers, eulers, sizeof(eulers));
+            sensor = imuCanRoute(canArg->sensors, canArg->nSensors, &frames[f]);
+            if(sensor == NULL)
+                continue;
 
-            imu_set_accelerometer_raw(canArg->imu, accel[0], accel[1], accel[2]);
-            imu_set_gyro_raw(canArg->imu, gyro[0], gyro[1], gyro[2]);
-            imu_main_loop(canArg->imu);
+            if(!imuCanPush(&sensor->assembler, &frames[f], &sample))
+                continue;
 
-            *canArg->imuTimestamp = timestamp;
+            // the first sensor is the reference for the event records
+            if(sensor == canArg->sensors){
+                quat = imu_quaternion_create(sample.quat[0]/IMU_CAN_QUAT_SCALE, sample.quat[1]/IMU_CAN_QUAT_SCALE,
+                                             sample.quat[2]/IMU_CAN_QUAT_SCALE, sample.quat[3]/IMU_CAN_QUAT_SCALE);
+                imuHistPush(canArg->imuHist, sample.rxTime, sample.timestamp, &quat);
+            }
+
+            pthread_mutex_lock(&mtx);
+
+            imuCanSensorUpdate(sensor, &sample);
+
+            if(sensor == canArg->sensors)
+                *canArg->imuTimestamp = sample.timestamp;
             pthread_mutex_unlock(&mtx);
+            traceEvent(TRACE_IMU_UPDATE, sample.timestamp);
         }
     }
 
+    canCaptureClose(capFile);
+
     fprintf(stderr,"ERR: error reading from CAN...\n");
-    pthread_exit((void *)nBytes);
+    pthread_exit((void *)nFrames);
 }
 
 void* imuDataOutThread(void* arg){
@@ -341,8 +627,10 @@ void* imuDataOutThread(void* arg){
     struct sockaddr_in imu_addr;
     char imuStr[IMUSTR_MAX_LEN] = "";
     char oldImuStr[IMUSTR_MAX_LEN] = "";
-    float    quat[4]    = {0.0,0.0,0.0,0.0};
-    float    eulers[3]  = {0.0,0.0,0.0};
+    imuCanSensor_t* sensor;
+    imu_vec3_t gyroBias;
+    float gyroBiasSigma = 0.0;
+    int imuStrLen = 0;
 
     imuSockFd = socket(AF_INET, SOCK_STREAM, 0);
     memset(&imu_addr, '0', sizeof(imu_addr));
@@ -372,25 +660,41 @@ void* imuDataOutThread(void* arg){
         }
 
         while(1){
+            imuStrLen = 0;
+
             pthread_mutex_lock(&mtx);
-             snprintf(imuStr,IMUSTR_MAX_LEN,
-                    "$%c\tT = %08x\n"
+            for(int i = 0; i < imuArg->nSensors; i++){
+                sensor = &imuArg->sensors[i];
+                gyroBiasSigma = imu_get_gyro_bias(&sensor->imu, &gyroBias);
+                imuStrLen += snprintf(imuStr+imuStrLen, IMUSTR_MAX_LEN-imuStrLen,
+                    "$%c\tT = %08x\tR = %" PRIu64 "\tI = %03x\n"
                     "\t\taxR = %.0f, ayR = %.0f, azR = %.0f\n"
                     "\t\tgxR = %.0f, gyR = %.0f, gzR = %.0f\n"
                     "\t\tax = %.4f, ay = %.4f, az = %.4f\n"
                     "\t\tgx = %.4f, gy = %.4f, gz = %.4f\n"
                     "\t\troll = %.4f, pitch = %.4f, yaw = %.4f\n"
+                    "\t\tqw = %.4f, qx = %.4f, qy = %.4f, qz = %.4f\n"
+                    "\t\tcycles ok = %u, incomplete = %u, duplicate = %u, orphan = %u\n"
+                    "\t\tgbx = %.4f, gby = %.4f, gbz = %.4f, gbSigma = %.4f, still = %u\n"
                     "Q%f,%f,%f,%f\n",
                     2,
-                    *imuArg->imuTimestamp,
-                    imuArg->imu->accelerometer_raw.x, imuArg->imu->accelerometer_raw.y, imuArg->imu->accelerometer_raw.z,
-                    imuArg->imu->gyro_raw.x, imuArg->imu->gyro_raw.y, imuArg->imu->gyro_raw.z,
-                    imuArg->imu->accelerometer.x, imuArg->imu->accelerometer.y, imuArg->imu->accelerometer.z,
-                    imuArg->imu->gyro.x, imuArg->imu->gyro.y, imuArg->imu->gyro.z,
-                    imuArg->eulers[0]*180.0/PI, imuArg->eulers[1]*180.0/PI, imuArg->eulers[2]*180.0/PI,
-                    imuArg->quat[0], imuArg->quat[1], imuArg->quat[2], imuArg->quat[3]);
-/*                     imuArg->imu->orientation.roll*180.0/PI, imuArg->imu->orientation.pitch*180.0/PI, imuArg->imu->orientation.yaw*180.0/PI,
-                    imuArg->imu->orientation_quat.w, imuArg->imu->orientation_quat.x, imuArg->imu->orientation_quat.y, imuArg->imu->orientation_quat.z); */
+                    sensor->sample.timestamp, sensor->sample.rxTime, sensor->canId,
+                    sensor->imu.accelerometer_raw.x, sensor->imu.accelerometer_raw.y, sensor->imu.accelerometer_raw.z,
+                    sensor->imu.gyro_raw.x, sensor->imu.gyro_raw.y, sensor->imu.gyro_raw.z,
+                    sensor->imu.accelerometer.x, sensor->imu.accelerometer.y, sensor->imu.accelerometer.z,
+                    sensor->imu.gyro.x, sensor->imu.gyro.y, sensor->imu.gyro.z,
+                    sensor->sample.eulers[0]/IMU_CAN_EULER_SCALE*180.0/PI, sensor->sample.eulers[1]/IMU_CAN_EULER_SCALE*180.0/PI,
+                    sensor->sample.eulers[2]/IMU_CAN_EULER_SCALE*180.0/PI,
+                    sensor->imu.orientation_quat.w, sensor->imu.orientation_quat.x,
+                    sensor->imu.orientation_quat.y, sensor->imu.orientation_quat.z,
+                    sensor->stats.complete, sensor->stats.incomplete, sensor->stats.duplicate, sensor->stats.orphan,
+                    gyroBias.x, gyroBias.y, gyroBias.z, gyroBiasSigma, sensor->imu.bias.stationary,
+                    sensor->sample.quat[0]/IMU_CAN_QUAT_SCALE, sensor->sample.quat[1]/IMU_CAN_QUAT_SCALE,
+                    sensor->sample.quat[2]/IMU_CAN_QUAT_SCALE, sensor->sample.quat[3]/IMU_CAN_QUAT_SCALE);
+
+                if(imuStrLen >= IMUSTR_MAX_LEN)
+                    imuStrLen = IMUSTR_MAX_LEN-1;
+            }
 
             cmdIDLocal = *imuArg->cmdID;
             pthread_mutex_unlock(&mtx);
@@ -420,13 +724,21 @@ int main(int argc, char *argv[]){
     axiRegisters_t axiRegs;
     cmdDecodeArgs_t cmdDecodeArg;
     chkFifoArgs_t chkFifoArg;
+    storageArgs_t storageArg;
     canReaderArgs_t canReaderArgs;
     imuDataOutArgs_t imuDataOutArgs;
-    imu_t imu;
+    imuCanSensor_t imuSensors[IMU_CAN_MAX_SENSORS];
+    struct can_filter canFilters[IMU_CAN_MAX_SENSORS];
+    int nImuSensors = 0;
     pthread_t cmdDecID;
     pthread_t chkSttID;
     pthread_t canRdrID;
     pthread_t imuDatID;
+    pthread_t canCapID;
+    pthread_t timeSvcID;
+    pthread_t gtuClkID;
+    pthread_t finalizeID;
+    pthread_t storageID;
     int listenfd = 0;
     int connfd = 0;
     struct sockaddr_in serv_addr;
@@ -442,12 +754,71 @@ int main(int argc, char *argv[]){
     int tries = 0;
     void* mmapRet = NULL;
     int canSocket = 0;
-    struct ifreq ifr;
-    struct sockaddr_can canAddr;
-    struct can_filter rfilter;
+    uint32_t keyInterval = 0;
+    uint32_t boardId = 0;
+    evtWriter_t writer;
+    evtWriter_t attWriter;
+    int useUring = 0;
+    uint32_t queueLen = EVT_QUEUE_LEN;
+    int policy = EVT_QUEUE_BLOCK;
+    int opt;
+    canSource_t canSrc;
     uint32_t imuTimestamp = 0;
-    float quat[4] = {0.0,0.0,0.0,0.0};
-    float eulers[3] = {0.0,0.0,0.0};
+    imuHist_t imuHist;
+
+    while((opt = getopt(argc, argv, "b:z:w:q:p:")) != -1){
+        switch(opt){
+            case 'b':
+                boardId = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                keyInterval = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                useUring = strcmp(optarg, "uring") == 0;
+                if(!useUring && strcmp(optarg, "stdio") != 0){
+                    fprintf(stderr, USAGE, argv[0]);
+                    return -1;
+                }
+                break;
+            case 'q':
+                queueLen = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                policy = evtQueuePolicyParse(optarg);
+                if(policy < 0){
+                    fprintf(stderr, USAGE, argv[0]);
+                    return -1;
+                }
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return -1;
+        }
+    }
+
+    // before anything stamps events or names files
+    timeSvcInit();
+    err = timeSvcStart(&timeSvcID);
+    if(err != 0)
+        fprintf(stderr,"\tERR: Cannot create timeSvc thread...: [%s]\n", strerror(err));
+
+    evtWriterStdio(&writer);
+    evtWriterStdio(&attWriter);
+    if(useUring && ((err = evtWriterUring(&writer)) < 0 || (err = evtWriterUring(&attWriter)) < 0)){
+        fprintf(stderr,"\tERR: io_uring not available, writing with stdio: [%s]\n", strerror(-err));
+        evtWriterFree(&writer);
+        evtWriterStdio(&writer);
+        evtWriterStdio(&attWriter);
+    }
+    printf("Event writer: %s\n", evtWriterName(&writer));
+
+    // closed files are only renamed from .lock by this thread
+    err = finalizeStart(&finalizeID);
+    if(err != 0){
+        fprintf(stderr,"Cannot create finalize thread, program must be restarted: [%s]\n", strerror(err));
+        return -1;
+    }
 
     int devmem = open("/dev/mem", O_RDWR | O_SYNC);
     if (devmem < 0)
@@ -465,6 +836,13 @@ int main(int argc, char *argv[]){
 
     axiRegs.statusReg = (uint32_t*)mmapRet;
 
+    gtuClockInit();
+    if(mmapRet != MAP_FAILED){
+        err = gtuClockStart(&gtuClkID, &axiRegs);
+        if(err != 0)
+            fprintf(stderr,"\tERR: Cannot create gtuClock thread...: [%s]\n", strerror(err));
+    }
+
     mmapRet = mmap(0, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, devmem, L1CNT_REG_ADDR);
     if(mmapRet == MAP_FAILED)
         fprintf(stderr,"Error in mapping L1CNT_REG_ADDR\n");
@@ -538,49 +916,66 @@ int main(int argc, char *argv[]){
     chkFifoArg.socketStatus = &socketStatus;
     chkFifoArg.fifoData     = fifoData;
     chkFifoArg.imuTimestamp = &imuTimestamp;
+    chkFifoArg.imuHist      = &imuHist;
+
+    storageArg.keyInterval = keyInterval;
+    storageArg.boardId     = boardId;
+    storageArg.writer      = &writer;
+    storageArg.attWriter   = &attWriter;
 
-    canSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-    if(canSocket < 0)
-        fprintf(stderr,"\tERR: Cannot initialize CAN socket...\n");
+    if(evtQueueInit(queueLen, policy) < 0){
+        fprintf(stderr,"Cannot allocate the write queue, program must be restarted\n");
+        return -1;
+    }
+    printf("Write queue: %u events, %s\n", queueLen, evtQueuePolicyName(policy));
 
-    strcpy(ifr.ifr_name, "can0" );
-    ioctl(canSocket, SIOCGIFINDEX, &ifr);
+    err = pthread_create(&storageID, NULL, &storageThread, (void*)&storageArg);
+    if(err != 0){
+        fprintf(stderr,"Cannot create storage thread, program must be restarted: [%s]\n", strerror(err));
+        return -1;
+    }
+    pthread_detach(storageID);
 
-    memset(&canAddr, 0, sizeof(canAddr));
-    canAddr.can_family = AF_CAN;
-    canAddr.can_ifindex = ifr.ifr_ifindex;
+    // CAN IDs of the IMUs on the bus, the first one is the reference for the event records;
+    // the whole 11-bit ID is matched unless a mask follows it
+    for(int i = optind; i < argc && nImuSensors < IMU_CAN_MAX_SENSORS; i++){
+        char* end;
+        uint32_t canId = strtoul(argv[i], &end, 0);
+        uint32_t canMask = *end == '/' ? strtoul(end + 1, NULL, 0) : IMU_CAN_MASK;
 
-    err = bind(canSocket, (struct sockaddr *)&canAddr, sizeof(canAddr));
-    if (err < 0)
-        fprintf(stderr,"\tERR: Cannot bind CAN socket...\n");
+        imuCanSensorInit(&imuSensors[nImuSensors++], canId, canMask);
+    }
 
-    rfilter.can_id   = 0x0B2;
-    rfilter.can_mask = 0x0FF;
+    if(nImuSensors == 0)
+        imuCanSensorInit(&imuSensors[nImuSensors++], IMU_CAN_ID, IMU_CAN_MASK);
 
-    setsockopt(canSocket, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter));
+    for(int i = 0; i < nImuSensors; i++){
+        canFilters[i].can_id   = imuSensors[i].canId;
+        canFilters[i].can_mask = imuSensors[i].canMask;
+    }
+
+    canSocket = canOpen(CAN_IFNAME, canFilters, nImuSensors);
 
-	imu = imu_init();
-	imu_set_calibration_mode(&imu, IMU_CALIBMODE_NEVER);
-	imu_set_gyro_scale_factor(&imu, GYRO_SCALE);
-	imu_set_accelerometer_scale_factor(&imu, ACCEL_SCALE);
-    imu.gyro_offset.x = GYRO_X_OFFSET;
-    imu.gyro_offset.y = GYRO_Y_OFFSET;
-    imu.gyro_offset.z = GYRO_Z_OFFSET;
+    imuHistInit(&imuHist);
 
     canReaderArgs.cmdID        = &cmdID;
-    canReaderArgs.canSocket    = canSocket;
+    canReaderArgs.canSrc       = &canSrc;
     canReaderArgs.imuTimestamp = &imuTimestamp;
-    canReaderArgs.imu          = &imu;
-    canReaderArgs.quat         = quat;
-    canReaderArgs.eulers       = eulers;
+    canReaderArgs.sensors      = imuSensors;
+    canReaderArgs.nSensors     = nImuSensors;
+    canReaderArgs.imuHist      = &imuHist;
 
-    imuDataOutArgs.cmdID        = &cmdID;
-    imuDataOutArgs.imuTimestamp = &imuTimestamp;
-    imuDataOutArgs.imu          = &imu;
-    imuDataOutArgs.quat         = quat;
-    imuDataOutArgs.eulers       = eulers;
+    imuDataOutArgs.cmdID    = &cmdID;
+    imuDataOutArgs.sensors  = imuSensors;
+    imuDataOutArgs.nSensors = nImuSensors;
+
+    // without it captured frames are written by canReader itself
+    err = canCaptureStart(&canCapID);
+    if(err != 0)
+        fprintf(stderr,"\tERR: Cannot create canCapture thread...: [%s]\n", strerror(err));
 
     if(canSocket >= 0){
+        canSourceSocket(&canSrc, canSocket);
         err = pthread_create(&canRdrID, NULL, &canReaderThread, (void*)&canReaderArgs);
         if(err != 0){
             fprintf(stderr,"\tERR: Cannot create canReader thread...: [%s]\n", strerror(err));
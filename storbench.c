@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "eventfile.h"
+#include "evtwriter.h"
+#include "finalize.h"
+#include "crc32.h"
+
+// Event writer backends of ethCmd ("-w" option) on the same device: files of
+// records written back to back as checkFifo does, rotated every -f records.
+//
+//   storbench [-w stdio|uring] [-n records] [-f records per file] [-s] [-k] [dir]
+//     -w  only this backend, default both
+//     -s  finalize the files too (fsync, rename, directory fsync on the
+//         finalizer thread), as the daemon does
+//     -k  keep the files, default removed afterwards
+//
+// Output is CSV on stdout, one line per backend, preceded by a '#' line:
+//   backend,files,records,bytes,seconds,MB_s,p50_us,p99_us,max_us,stalls,errors
+// The latencies are those seen by the acquisition loop: one record write, plus
+// the close and open of the files when it rotates. seconds includes waiting
+// for everything in flight (and for the finalizer with -s).
+
+#define BENCH_RECORDS  10000
+#define BENCH_PER_FILE 25
+#define BENCH_PATH_LEN 64
+
+static uint64_t nowNs(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int compareNs(const void* p1, const void* p2){
+    uint64_t a = *(const uint64_t*)p1, b = *(const uint64_t*)p2;
+
+    return (a > b) - (a < b);
+}
+
+static void synthRecord(spb2Data_t* data, uint32_t i){
+    memset(data, 0, sizeof(*data));
+    data->header    = DATA_HEADER;
+    data->unixTime  = 1700000000 + i/3;
+    data->trgCount  = i;
+    data->gtuCount  = i*4000;
+    data->aliveTime = i*1200;
+    snprintf(data->gpsStr, DATA_GPS_BYTES, "$GPGGA,%06u.00,4124.8961,N,00208.3412,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n", i);
+    data->crc = crc_32((unsigned char *)data, sizeof(*data)-sizeof(data->crc), startCRC32);
+}
+
+static void fileName(char* path, const char* dir, const char* backend, uint32_t n, int locked){
+    snprintf(path, BENCH_PATH_LEN, "%s/clkb_storbench_%s_%04u.dat%s", dir, backend, n, locked ? ".lock" : "");
+}
+
+static int bench(evtWriter_t* w, const char* dir, uint32_t nRecords, uint32_t perFile, int finalize, int keep){
+    const char* backend = evtWriterName(w);
+    uint64_t* lat = malloc(nRecords*sizeof(uint64_t));
+    char path[BENCH_PATH_LEN] = "";
+    evtFileHeader_t hdr;
+    finalizeStats_t fin, fin0;
+    spb2Data_t data;
+    uint64_t start, t, elapsed;
+    uint32_t nFiles = 0;
+
+    if(lat == NULL){
+        fprintf(stderr,"\tERR: out of memory\n");
+        return -1;
+    }
+
+    evtFileHeaderInit(&hdr, 0, 0, EVT_CLOCK_SYSTEM, "storbench");
+    finalizeGetStats(&fin0);
+
+    start = nowNs();
+    for(uint32_t i = 0; i < nRecords; i++){
+        synthRecord(&data, i);
+
+        t = nowNs();
+        if(i % perFile == 0){
+            if(nFiles > 0){
+                evtWriterClose(w);
+                if(finalize)
+                    finalizeSubmit(path, NULL);
+            }
+            fileName(path, dir, backend, nFiles++, 1);
+            hdr.info.fileNumber = nFiles;
+            evtFileHeaderSeal(&hdr);
+            if(evtWriterOpen(w, path, (perFile+1)*sizeof(spb2Data_t)) < 0 ||
+               evtWriterWrite(w, &hdr, sizeof(hdr)) < 0){
+                fprintf(stderr,"\tERR: cannot open %s\n", path);
+                free(lat);
+                return -1;
+            }
+        }
+        evtWriterWrite(w, &data, sizeof(data));
+        lat[i] = nowNs() - t;
+    }
+
+    evtWriterClose(w);
+    if(finalize)
+        finalizeSubmit(path, NULL);
+    evtWriterFree(w);
+
+    do{
+        finalizeGetStats(&fin);
+    }while(finalize && fin.nDone - fin0.nDone < nFiles && usleep(1000) == 0);
+    elapsed = nowNs() - start;
+
+    qsort(lat, nRecords, sizeof(uint64_t), compareNs);
+
+    printf("%s,%u,%u,%llu,%.3f,%.1f,%.1f,%.1f,%.1f,%u,%u\n", backend, nFiles, nRecords,
+           (unsigned long long)w->stats.bytes, elapsed/1e9, w->stats.bytes*1e3/elapsed,
+           lat[nRecords/2]/1e3, lat[(uint64_t)nRecords*99/100]/1e3, lat[nRecords-1]/1e3,
+           w->stats.stalls, w->stats.errors + (fin.nFailed - fin0.nFailed));
+
+    for(uint32_t n = 0; !keep && n < nFiles; n++){
+        fileName(path, dir, backend, n, !finalize);
+        unlink(path);
+    }
+
+    free(lat);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    const char* dir = ".";
+    const char* only = NULL;
+    uint32_t nRecords = BENCH_RECORDS;
+    uint32_t perFile = BENCH_PER_FILE;
+    int finalize = 0, keep = 0, err = 0;
+    pthread_t finalizeID;
+    evtWriter_t w;
+    int opt;
+
+    while((opt = getopt(argc, argv, "w:n:f:sk")) != -1){
+        switch(opt){
+            case 'w':
+                only = optarg;
+                break;
+            case 'n':
+                nRecords = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                perFile = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                finalize = 1;
+                break;
+            case 'k':
+                keep = 1;
+                break;
+            default:
+                fprintf(stderr,"Usage: %s [-w stdio|uring] [-n records] [-f records per file] [-s] [-k] [dir]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    if(optind < argc)
+        dir = argv[optind];
+    if(nRecords == 0)
+        nRecords = BENCH_RECORDS;
+    if(perFile == 0)
+        perFile = BENCH_PER_FILE;
+
+    if(finalize && finalizeStart(&finalizeID) != 0){
+        fprintf(stderr,"\tERR: cannot start the finalizer\n");
+        return -1;
+    }
+
+    printf("# storbench dir=%s records_per_file=%u finalize=%d\n", dir, perFile, finalize);
+    printf("backend,files,records,bytes,seconds,MB_s,p50_us,p99_us,max_us,stalls,errors\n");
+
+    if(only == NULL || strcmp(only, "stdio") == 0){
+        evtWriterStdio(&w);
+        err |= bench(&w, dir, nRecords, perFile, finalize, keep);
+    }
+
+    if(only == NULL || strcmp(only, "uring") == 0){
+        if(evtWriterUring(&w) < 0){
+            fprintf(stderr,"\tERR: io_uring not available\n");
+            err = -1;
+        }else
+            err |= bench(&w, dir, nRecords, perFile, finalize, keep);
+    }
+
+    return err ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <time.h>
+#include "timesvc.h"
+
+#define TIMESVC_SAMPLES 3
+
+// Realtime is monotonic + offset. The service thread refreshes the offset and
+// the local time rendering of the current second once per second, readers
+// take both under a sequence lock and never call into the timezone code.
+typedef struct timeSvcState{
+    uint32_t seq;
+    int64_t  offset;
+    int64_t  second;
+    char     stamp[TIMESVC_STAMP_LEN];
+} timeSvcState_t;
+
+static timeSvcState_t state;
+
+static int64_t toNs(const struct timespec* ts){
+    return (int64_t)ts->tv_sec*1000000000LL + ts->tv_nsec;
+}
+
+// realtime read between two monotonic reads, the tightest of a few tries
+static int64_t measureOffset(void){
+    struct timespec m0, rt, m1;
+    int64_t best = INT64_MAX, offset = 0;
+
+    for(int i = 0; i < TIMESVC_SAMPLES; i++){
+        clock_gettime(CLOCK_MONOTONIC, &m0);
+        clock_gettime(CLOCK_REALTIME, &rt);
+        clock_gettime(CLOCK_MONOTONIC, &m1);
+
+        if(toNs(&m1) - toNs(&m0) < best){
+            best   = toNs(&m1) - toNs(&m0);
+            offset = toNs(&rt) - (toNs(&m0) + toNs(&m1))/2;
+        }
+    }
+
+    return offset;
+}
+
+static void render(int64_t second, char* stamp){
+    time_t rawtime = (time_t)second;
+    struct tm tm;
+
+    localtime_r(&rawtime, &tm);
+    strftime(stamp, TIMESVC_STAMP_LEN, "%Y%m%d%H%M%S", &tm);
+}
+
+static void publish(int64_t offset, int64_t second, const char* stamp){
+    uint32_t seq = state.seq;
+
+    __atomic_store_n(&state.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    state.offset = offset;
+    state.second = second;
+    memcpy(state.stamp, stamp, TIMESVC_STAMP_LEN);
+
+    __atomic_store_n(&state.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void update(void){
+    char stamp[TIMESVC_STAMP_LEN];
+    int64_t offset = measureOffset();
+    struct timespec now;
+    int64_t second;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    second = (toNs(&now) + offset)/1000000000LL;
+
+    render(second, stamp);
+    publish(offset, second, stamp);
+}
+
+static void* timeSvcThread(void* arg){
+    struct timespec now, wait;
+    int64_t rt;
+
+    for(;;){
+        update();
+
+        // wake up just after the next realtime second, sleeping on the
+        // monotonic clock so that steps of the realtime clock cannot stall us
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rt = toNs(&now) + state.offset;
+
+        wait.tv_sec  = 0;
+        wait.tv_nsec = 1000000000L - rt%1000000000L + 1000000L;
+        if(wait.tv_nsec >= 1000000000L){
+            wait.tv_sec   = 1;
+            wait.tv_nsec -= 1000000000L;
+        }
+
+        nanosleep(&wait, NULL);
+    }
+
+    return arg;
+}
+
+// First mapping, so timeSvcNowNs is valid before the thread runs.
+void timeSvcInit(void){
+    update();
+}
+
+int timeSvcStart(pthread_t* id){
+    int err = pthread_create(id, NULL, &timeSvcThread, NULL);
+
+    if(err == 0)
+        pthread_detach(*id);
+
+    return err;
+}
+
+uint64_t timeSvcNowNs(void){
+    struct timespec now;
+    uint32_t seq;
+    int64_t offset;
+
+    do{
+        seq = __atomic_load_n(&state.seq, __ATOMIC_ACQUIRE);
+        offset = state.offset;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while((seq & 1) || seq != __atomic_load_n(&state.seq, __ATOMIC_RELAXED));
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(toNs(&now) + offset);
+}
+
+// Local time of the second of ns, from the cache when it is the current one.
+void timeSvcStamp(uint64_t ns, char* stamp){
+    int64_t second = (int64_t)(ns/1000000000ULL);
+    uint32_t seq;
+    int hit;
+
+    do{
+        seq = __atomic_load_n(&state.seq, __ATOMIC_ACQUIRE);
+        hit = state.second == second;
+        if(hit)
+            memcpy(stamp, state.stamp, TIMESVC_STAMP_LEN);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }while((seq & 1) || seq != __atomic_load_n(&state.seq, __ATOMIC_RELAXED));
+
+    if(!hit)
+        render(second, stamp);
+}
@@ -0,0 +1,15 @@
+#ifndef TIMESVC_H_
+#define TIMESVC_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+// YYYYMMDDhhmmss in local time
+#define TIMESVC_STAMP_LEN 15
+
+void timeSvcInit(void);
+int timeSvcStart(pthread_t* id);
+uint64_t timeSvcNowNs(void);
+void timeSvcStamp(uint64_t ns, char* stamp);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "trace.h"
+
+__thread traceRing_t* traceLocalRing = NULL;
+
+static traceRing_t rings[TRACE_MAX_THREADS];
+static uint32_t nRings = 0;
+static pthread_mutex_t regMtx = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* tagNames[TRACE_TAG_MAX] = {
+    "UNKNOWN",
+    "DMA_ARMED",
+    "DMA_DONE",
+    "RECORD_BUILT",
+    "CRC_DONE",
+    "WRITE_ISSUED",
+    "FILE_ROTATED",
+    "CAN_FRAME",
+    "IMU_UPDATE",
+    "QUEUED",
+    "DROPPED"
+};
+
+const char* traceTagName(uint16_t tag){
+    if(tag >= TRACE_TAG_MAX)
+        return tagNames[0];
+
+    return tagNames[tag];
+}
+
+// Threads that are restarted (e.g. at every new connection) get back the ring
+// they used before, so the slots are never exhausted.
+void traceRegister(const char* name){
+    uint32_t i;
+
+    pthread_mutex_lock(&regMtx);
+
+    for(i = 0; i < nRings; i++)
+        if(strncmp(rings[i].name, name, TRACE_NAME_LEN) == 0)
+            break;
+
+    if(i == nRings && nRings < TRACE_MAX_THREADS){
+        strncpy(rings[i].name, name, TRACE_NAME_LEN-1);
+        __atomic_store_n(&nRings, nRings+1, __ATOMIC_RELEASE);
+    }
+
+    traceLocalRing = (i < TRACE_MAX_THREADS) ? &rings[i] : NULL;
+
+    pthread_mutex_unlock(&regMtx);
+}
+
+// Copies event i of ring, 0 if its slot is being written or already holds a
+// later event.
+static int copyEvent(const traceRing_t* ring, uint32_t i, traceEvent_t* ev){
+    const traceEvent_t* slot = &ring->events[i & TRACE_RING_MASK];
+    uint16_t seq = TRACE_SLOT_SEQ(i);
+
+    if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq)
+        return 0;
+
+    ev->ts  = slot->ts;
+    ev->arg = slot->arg;
+    ev->tag = slot->tag;
+    ev->seq = seq;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+int traceDump(const char* path){
+    static traceEvent_t snapshot[TRACE_RING_LEN];
+    static pthread_mutex_t dumpMtx = PTHREAD_MUTEX_INITIALIZER;
+    traceDumpHeader_t hdr;
+    traceDumpRing_t ringHdr;
+    struct timespec rt, mono;
+    uint32_t head, first, count;
+    int total = 0;
+    FILE* dumpFile;
+
+    dumpFile = fopen(path, "wb");
+    if(dumpFile == NULL)
+        return -1;
+
+    pthread_mutex_lock(&dumpMtx);
+
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic          = TRACE_DUMP_MAGIC;
+    hdr.version        = TRACE_DUMP_VERSION;
+    hdr.nRings         = __atomic_load_n(&nRings, __ATOMIC_ACQUIRE);
+    hdr.realtimeOffset = ((int64_t)rt.tv_sec - mono.tv_sec)*1000000000LL + (rt.tv_nsec - mono.tv_nsec);
+
+    fwrite(&hdr, sizeof(hdr), 1, dumpFile);
+
+    for(uint32_t r = 0; r < hdr.nRings; r++){
+        head  = __atomic_load_n(&rings[r].head, __ATOMIC_ACQUIRE);
+        first = head - TRACE_RING_LEN;
+        count = 0;
+
+        // events overwritten while the ring is copied, or never written, are
+        // skipped; what is left is in order
+        for(uint32_t i = first; i != head; i++)
+            count += copyEvent(&rings[r], i, &snapshot[count]);
+
+        memset(&ringHdr, 0, sizeof(ringHdr));
+        memcpy(ringHdr.name, rings[r].name, TRACE_NAME_LEN);
+        ringHdr.nEvents = count;
+        ringHdr.head    = head;
+
+        fwrite(&ringHdr, sizeof(ringHdr), 1, dumpFile);
+        fwrite(snapshot, sizeof(traceEvent_t), count, dumpFile);
+
+        total += count;
+    }
+
+    pthread_mutex_unlock(&dumpMtx);
+
+    fclose(dumpFile);
+
+    return total;
+}
@@ -0,0 +1,99 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define TRACE_MAX_THREADS  8
+#define TRACE_RING_LEN     4096
+#define TRACE_RING_MASK    (TRACE_RING_LEN-1)
+// never 0, which marks a slot being written
+#define TRACE_SLOT_SEQ(i)  ((uint16_t)(((i)/TRACE_RING_LEN) % 0xFFFF + 1))
+#define TRACE_NAME_LEN     16
+
+#define TRACE_DUMP_MAGIC   0x43525454
+#define TRACE_DUMP_VERSION 1
+#define TRACE_DUMP_PATH    "/srv/ftp/clkb_trace.bin"
+
+#define TRACE_DMA_ARMED    0x01
+#define TRACE_DMA_DONE     0x02
+#define TRACE_RECORD_BUILT 0x03
+#define TRACE_CRC_DONE     0x04
+#define TRACE_WRITE_ISSUED 0x05
+#define TRACE_FILE_ROTATED 0x06
+#define TRACE_CAN_FRAME    0x07
+#define TRACE_IMU_UPDATE   0x08
+#define TRACE_QUEUED       0x09
+#define TRACE_DROPPED      0x0A
+#define TRACE_TAG_MAX      0x0B
+
+// seq is TRACE_SLOT_SEQ of the event number once the slot is complete.
+typedef struct traceEvent{
+    uint64_t ts;
+    uint32_t arg;
+    uint16_t tag;
+    uint16_t seq;
+} traceEvent_t;
+
+// Single writer (the owning thread), any number of readers. head counts every
+// event ever written, the slot of an event is head & TRACE_RING_MASK. Readers
+// check the slot seq before and after copying an event.
+typedef struct traceRing{
+    char         name[TRACE_NAME_LEN];
+    uint32_t     head;
+    traceEvent_t events[TRACE_RING_LEN];
+} traceRing_t;
+
+// Layout of a dump file: one traceDumpHeader_t, then for every ring one
+// traceDumpRing_t followed by its nEvents events, oldest first.
+typedef struct traceDumpHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nRings;
+    uint32_t reserved;
+    int64_t  realtimeOffset;
+} traceDumpHeader_t;
+
+typedef struct traceDumpRing{
+    char     name[TRACE_NAME_LEN];
+    uint32_t nEvents;
+    uint32_t head;
+} traceDumpRing_t;
+
+extern __thread traceRing_t* traceLocalRing;
+
+void traceRegister(const char* name);
+int traceDump(const char* path);
+const char* traceTagName(uint16_t tag);
+
+static inline uint64_t traceNow(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec*1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static inline void traceEvent(uint16_t tag, uint32_t arg){
+    traceRing_t* ring = traceLocalRing;
+    traceEvent_t* ev;
+    uint32_t head;
+
+    if(ring == NULL)
+        return;
+
+    head = ring->head;
+    ev = &ring->events[head & TRACE_RING_MASK];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    ev->ts  = traceNow();
+    ev->arg = arg;
+    ev->tag = tag;
+
+    __atomic_store_n(&ev->seq, TRACE_SLOT_SEQ(head), __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+#endif
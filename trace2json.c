@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+// Converts a dump written by the "trace dump" command to the Chrome trace event
+// format, which can be opened in chrome://tracing or ui.perfetto.dev.
+// The DMA_ARMED/DMA_DONE pair becomes a "dma wait" slice, everything else an
+// instant event.
+
+static void printEvent(FILE* out, const traceEvent_t* ev, uint32_t tid, int64_t offset, int* first){
+    double ts = (double)((int64_t)ev->ts + offset)/1000.0;
+
+    fprintf(out, "%s\n", *first ? "" : ",");
+    *first = 0;
+
+    switch(ev->tag){
+        case TRACE_DMA_ARMED:
+            fprintf(out, "{\"name\":\"dma wait\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, tid);
+            break;
+        case TRACE_DMA_DONE:
+            fprintf(out, "{\"name\":\"dma wait\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, tid);
+            break;
+        default:
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%u}}",
+                    traceTagName(ev->tag), ts, tid, ev->arg);
+            break;
+    }
+}
+
+int main(int argc, char *argv[]){
+    FILE* in;
+    FILE* out = stdout;
+    traceDumpHeader_t hdr;
+    traceDumpRing_t ringHdr;
+    traceEvent_t ev;
+    int first = 1;
+
+    if(argc < 2){
+        fprintf(stderr,"Usage: %s <trace dump> [output.json]\n", argv[0]);
+        return -1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if(in == NULL){
+        fprintf(stderr,"ERR: cannot open %s\n", argv[1]);
+        return -1;
+    }
+
+    if(fread(&hdr, sizeof(hdr), 1, in) != 1 || hdr.magic != TRACE_DUMP_MAGIC || hdr.version != TRACE_DUMP_VERSION){
+        fprintf(stderr,"ERR: %s is not a trace dump\n", argv[1]);
+        fclose(in);
+        return -1;
+    }
+
+    if(argc > 2){
+        out = fopen(argv[2], "w");
+        if(out == NULL){
+            fprintf(stderr,"ERR: cannot open %s\n", argv[2]);
+            fclose(in);
+            return -1;
+        }
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for(uint32_t r = 0; r < hdr.nRings; r++){
+        if(fread(&ringHdr, sizeof(ringHdr), 1, in) != 1){
+            fprintf(stderr,"ERR: truncated dump\n");
+            break;
+        }
+
+        ringHdr.name[TRACE_NAME_LEN-1] = '\0';
+
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", r+1, ringHdr.name);
+        first = 0;
+
+        for(uint32_t i = 0; i < ringHdr.nEvents; i++){
+            if(fread(&ev, sizeof(ev), 1, in) != 1){
+                fprintf(stderr,"ERR: truncated dump\n");
+                break;
+            }
+
+            printEvent(out, &ev, r+1, hdr.realtimeOffset, &first);
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+
+    fclose(in);
+    if(out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int setup(unsigned entries, struct io_uring_params* p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+// Returns -errno when the kernel has no (or a disabled) io_uring.
+int uringInit(uring_t* ring, unsigned entries){
+    struct io_uring_params p;
+    uint8_t* sq;
+    uint8_t* cq;
+
+    memset(ring, 0, sizeof(uring_t));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = setup(entries, &p);
+    if(ring->fd < 0)
+        return -errno;
+
+    ring->entries  = p.sq_entries;
+    ring->sqMapLen = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    ring->cqMapLen = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cqMapLen > ring->sqMapLen)
+            ring->sqMapLen = ring->cqMapLen;
+        ring->cqMapLen = 0;
+    }
+
+    ring->sqMap = mmap(NULL, ring->sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sqMap == MAP_FAILED)
+        goto fail;
+
+    ring->cqMap = ring->sqMap;
+    if(ring->cqMapLen > 0){
+        ring->cqMap = mmap(NULL, ring->cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cqMap == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes = mmap(NULL, p.sq_entries*sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = ring->sqMap;
+    cq = ring->cqMap;
+    ring->sqHead = (unsigned*)(sq + p.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->cqHead = (unsigned*)(cq + p.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes   = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring->sqeTail = *ring->sqTail;
+
+    for(unsigned i = 0; i < p.sq_entries; i++)
+        ((unsigned*)(sq + p.sq_off.array))[i] = i;
+
+    return 0;
+
+fail:
+    uringExit(ring);
+
+    return -ENOMEM;
+}
+
+void uringExit(uring_t* ring){
+    if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->entries*sizeof(struct io_uring_sqe));
+    if(ring->cqMapLen > 0 && ring->cqMap != NULL && ring->cqMap != MAP_FAILED)
+        munmap(ring->cqMap, ring->cqMapLen);
+    if(ring->sqMap != NULL && ring->sqMap != MAP_FAILED)
+        munmap(ring->sqMap, ring->sqMapLen);
+    if(ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+}
+
+// Zeroed SQE to fill, NULL when the submission ring is full.
+struct io_uring_sqe* uringGetSqe(uring_t* ring){
+    struct io_uring_sqe* sqe;
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    if(ring->sqeTail - head >= ring->entries)
+        return NULL;
+
+    sqe = &ring->sqes[ring->sqeTail & *ring->sqMask];
+    ring->sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+// Submits the SQEs taken since the last call and waits for waitNr completions.
+int uringSubmit(uring_t* ring, unsigned waitNr){
+    unsigned toSubmit = ring->sqeTail - *ring->sqTail;
+    int ret;
+
+    __atomic_store_n(ring->sqTail, ring->sqeTail, __ATOMIC_RELEASE);
+
+    if(toSubmit == 0 && waitNr == 0)
+        return 0;
+
+    do{
+        ret = enter(ring->fd, toSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    }while(ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+}
+
+// Copies out and consumes the oldest completion, 0 when there is none.
+int uringPeekCqe(uring_t* ring, struct io_uring_cqe* cqe){
+    unsigned head = *ring->cqHead;
+
+    if(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    *cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+int uringWaitCqe(uring_t* ring, struct io_uring_cqe* cqe){
+    int ret;
+
+    while(!uringPeekCqe(ring, cqe)){
+        ret = uringSubmit(ring, 1);
+        if(ret < 0)
+            return ret;
+    }
+
+    return 1;
+}
+
+int uringRegister(uring_t* ring, unsigned opcode, const void* arg, unsigned nArgs){
+    int ret = (int)syscall(__NR_io_uring_register, ring->fd, opcode, arg, nArgs);
+
+    return ret < 0 ? -errno : ret;
+}
+
+// 0 when the kernel implements all nOps opcodes of ops, -EOPNOTSUPP when one of
+// them is missing or the kernel cannot tell (no IORING_REGISTER_PROBE before
+// 5.6, where a working io_uring_setup() still lacks e.g. IORING_OP_WRITE).
+int uringProbe(uring_t* ring, const uint8_t* ops, int nOps){
+    struct io_uring_probe* probe;
+    int ret;
+
+    probe = calloc(1, sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op));
+    if(probe == NULL)
+        return -ENOMEM;
+
+    ret = uringRegister(ring, IORING_REGISTER_PROBE, probe, 256) < 0 ? -EOPNOTSUPP : 0;
+
+    for(int i = 0; i < nOps && ret == 0; i++)
+        if(ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            ret = -EOPNOTSUPP;
+
+    free(probe);
+
+    return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on the raw system calls (no liburing on the board):
+// one submission and one completion ring, SQ array entry i always pointing to
+// SQE i, so submitting is publishing the new tail.
+typedef struct uring{
+    int                   fd;
+    unsigned              entries;
+    unsigned              sqeTail;
+    unsigned*             sqHead;
+    unsigned*             sqTail;
+    unsigned*             sqMask;
+    unsigned*             cqHead;
+    unsigned*             cqTail;
+    unsigned*             cqMask;
+    struct io_uring_sqe*  sqes;
+    struct io_uring_cqe*  cqes;
+    void*                 sqMap;
+    void*                 cqMap;
+    size_t                sqMapLen;
+    size_t                cqMapLen;
+} uring_t;
+
+int uringInit(uring_t* ring, unsigned entries);
+void uringExit(uring_t* ring);
+struct io_uring_sqe* uringGetSqe(uring_t* ring);
+int uringSubmit(uring_t* ring, unsigned waitNr);
+int uringPeekCqe(uring_t* ring, struct io_uring_cqe* cqe);
+int uringWaitCqe(uring_t* ring, struct io_uring_cqe* cqe);
+int uringRegister(uring_t* ring, unsigned opcode, const void* arg, unsigned nArgs);
+int uringProbe(uring_t* ring, const uint8_t* ops, int nOps);
+
+#endif